@@ -1,42 +1,119 @@
 #include "moonlight.hpp"
+#include "downmix.hpp"
 
-#define MAX_CHANNEL_COUNT 2
-#define FRAME_SIZE 240
+// The Opus stream can have up to 6 channels and 20 ms packets
+#define MAX_CHANNEL_COUNT 6
+#define MAX_SAMPLES_PER_FRAME 960
 
-#define CIRCULAR_BUFFER_SIZE 32
+// PPB_Audio only plays stereo, so anything else is downmixed before it's queued
+#define OUTPUT_CHANNEL_COUNT 2
 
-// This code uses volatiles for synchronization between the producer and consumer side. This is
-// only safe because this code executes under very specific conditions, namely that the framework
-// ensures AudioPlayerSampleCallback and AudDecDecodeAndPlaySample are each only active on one thread
-// at a time.
+// Sample frames the audio device asks for at a time. The jitter buffer
+// decouples this from the packet duration.
+#define OUTPUT_FRAME_SIZE 240
 
-static short s_CircularBuffer[CIRCULAR_BUFFER_SIZE][FRAME_SIZE * MAX_CHANNEL_COUNT];
-static int s_ReadIndex = 0;
-static int s_WriteIndex = 0;
+// The decoder's concealment sounds natural for a couple of packets but turns
+// into a buzz over longer gaps, so after this many in a row it's faded out
+// over the next few and the audio following the gap is faded back in
+#define PLC_FULL_GAIN_PACKETS 2
+#define PLC_FADE_PACKETS 4
 
-static void AudioPlayerSampleCallback(void* samples, uint32_t buffer_size, void* data) {
-    // It should only ask us for complete buffers
-    assert(buffer_size == FRAME_SIZE * MAX_CHANNEL_COUNT * sizeof(short));
-        
-    // If the indexes aren't equal, we have a sample
-    if (s_WriteIndex != s_ReadIndex) {
-        memcpy(samples, s_CircularBuffer[s_ReadIndex], buffer_size);
-        
-        // Use a full memory barrier to ensure the circular buffer is read before incrementing the index
-        __sync_synchronize();
-        
-        // This can race with the reader in the AudDecDecodeAndPlaySample function. This is
-        // not a problem because at worst, it just won't see that we've consumed this sample yet.
-        s_ReadIndex = (s_ReadIndex + 1) % CIRCULAR_BUFFER_SIZE;
+// These are only touched by AudDecDecodeAndPlaySample, which runs on one thread at a time
+static bool s_LostPacketPending;
+static int s_ConcealedPackets;
+static int s_SamplesPerFrame;
+static bool s_Downmix;
+static DOWNMIX_COEFFICIENTS s_DownmixCoefficients;
+static short s_DecodeBuffer[MAX_SAMPLES_PER_FRAME * MAX_CHANNEL_COUNT + DOWNMIX_INPUT_PADDING];
+static short s_DownmixBuffer[MAX_SAMPLES_PER_FRAME * OUTPUT_CHANNEL_COUNT];
+
+static void ApplyGainRamp(short* samples, int frames, float startGain, float endGain) {
+    for (int i = 0; i < frames; i++) {
+        float gain = startGain + (endGain - startGain) * i / frames;
+        for (int c = 0; c < OUTPUT_CHANNEL_COUNT; c++) {
+            samples[i * OUTPUT_CHANNEL_COUNT + c] = (short)(samples[i * OUTPUT_CHANNEL_COUNT + c] * gain);
+        }
+    }
+}
+
+static float ConcealmentGain(int concealedPackets) {
+    float gain = 1.0f - (float)(concealedPackets - PLC_FULL_GAIN_PACKETS) / PLC_FADE_PACKETS;
+    
+    if (gain > 1.0f) {
+        return 1.0f;
+    }
+    else if (gain < 0.0f) {
+        return 0.0f;
+    }
+    return gain;
+}
+
+// Decodes one packet to stereo. Returns the number of sample frames in *output
+// or an Opus error code.
+static int DecodePacket(char* data, int length, int decodeFec, short** output) {
+    int decodeLen;
+    
+    decodeLen = opus_multistream_decode(g_Instance->m_OpusDecoder, (unsigned char *)data, length,
+                                        s_DecodeBuffer, s_SamplesPerFrame, decodeFec);
+    if (decodeLen <= 0) {
+        return decodeLen;
+    }
+    
+    if (s_Downmix) {
+        DownmixToStereo(&s_DownmixCoefficients, s_DecodeBuffer, s_DownmixBuffer, decodeLen);
+        *output = s_DownmixBuffer;
     }
     else {
-        memset(samples, 0, buffer_size);
+        *output = s_DecodeBuffer;
     }
+    
+    return decodeLen;
+}
+
+// Produces audio for one lost packet. With FEC data, the decoder rebuilds it
+// from the redundant copy carried in the following packet if there is one and
+// falls back to regular concealment otherwise.
+static void ConcealLostPacket(char* fecData, int fecLength) {
+    short* pcmBuffer;
+    int decodeLen;
+    
+    decodeLen = DecodePacket(fecData, fecLength, fecData != NULL ? 1 : 0, &pcmBuffer);
+    if (decodeLen > 0) {
+        ApplyGainRamp(pcmBuffer, decodeLen,
+                      ConcealmentGain(s_ConcealedPackets), ConcealmentGain(s_ConcealedPackets + 1));
+        g_Instance->m_AudioJitterBuffer.Write(pcmBuffer, decodeLen, true);
+    }
+    
+    s_ConcealedPackets++;
+}
+
+static void AudioPlayerSampleCallback(void* samples, uint32_t buffer_size, void* data) {
+    // It should only ask us for complete buffers
+    assert(buffer_size == OUTPUT_FRAME_SIZE * OUTPUT_CHANNEL_COUNT * sizeof(short));
+    
+    g_Instance->m_AudioJitterBuffer.Read((short*)samples, OUTPUT_FRAME_SIZE);
 }
 
 int MoonlightInstance::AudDecInit(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* context, int flags) {
     int rc;
     
+    if (opusConfig->channelCount > MAX_CHANNEL_COUNT || opusConfig->samplesPerFrame > MAX_SAMPLES_PER_FRAME) {
+        return -1;
+    }
+    
+    s_SamplesPerFrame = opusConfig->samplesPerFrame;
+    s_Downmix = opusConfig->channelCount != OUTPUT_CHANNEL_COUNT;
+    if (s_Downmix && !DownmixInitialize(&s_DownmixCoefficients, opusConfig->channelCount)) {
+        return -1;
+    }
+    
+    // The framework ensures AudioPlayerSampleCallback and AudDecDecodeAndPlaySample
+    // are each only active on one thread at a time, as the jitter buffer requires
+    g_Instance->m_AudioJitterBuffer.Reset(opusConfig->sampleRate, OUTPUT_CHANNEL_COUNT,
+                                          g_Instance->m_AudioLatencyMs);
+    s_LostPacketPending = false;
+    s_ConcealedPackets = 0;
+    
     g_Instance->m_OpusDecoder = opus_multistream_decoder_create(opusConfig->sampleRate,
                                                                 opusConfig->channelCount,
                                                                 opusConfig->streams,
@@ -44,7 +121,7 @@ int MoonlightInstance::AudDecInit(int audioConfiguration, POPUS_MULTISTREAM_CONF
                                                                 opusConfig->mapping,
                                                                 &rc);
     
-    g_Instance->m_AudioPlayer = pp::Audio(g_Instance, pp::AudioConfig(g_Instance, PP_AUDIOSAMPLERATE_48000, FRAME_SIZE),
+    g_Instance->m_AudioPlayer = pp::Audio(g_Instance, pp::AudioConfig(g_Instance, PP_AUDIOSAMPLERATE_48000, OUTPUT_FRAME_SIZE),
                                           AudioPlayerSampleCallback, NULL);
     
     // Start playback now
@@ -63,30 +140,40 @@ void MoonlightInstance::AudDecCleanup(void) {
 }
 
 void MoonlightInstance::AudDecDecodeAndPlaySample(char* sampleData, int sampleLength) {
+    short* pcmBuffer;
     int decodeLen;
-        
-    // Check if there is space for this sample in the buffer. Again, this can race
-    // but in the worst case, we'll not see the sample callback having consumed a sample.
-    if (((s_WriteIndex + 1) % CIRCULAR_BUFFER_SIZE) == s_ReadIndex) {
+    
+    if (sampleData == NULL) {
+        // Hold back concealing the latest lost packet until we see whether the
+        // next one carries FEC data for it
+        if (s_LostPacketPending) {
+            ConcealLostPacket(NULL, 0);
+        }
+        s_LostPacketPending = true;
         return;
     }
     
-    decodeLen = opus_multistream_decode(g_Instance->m_OpusDecoder, (unsigned char *)sampleData, sampleLength,
-                                        s_CircularBuffer[s_WriteIndex], FRAME_SIZE, 0);
+    if (s_LostPacketPending) {
+        ConcealLostPacket(sampleData, sampleLength);
+        s_LostPacketPending = false;
+    }
+    
+    // Always decode, even if the jitter buffer is full, to keep the decoder's state in sync
+    decodeLen = DecodePacket(sampleData, sampleLength, 0, &pcmBuffer);
     if (decodeLen > 0) {
-        // Use a full memory barrier to ensure the circular buffer is written before incrementing the index
-        __sync_synchronize();
-        
-        // This can race with the reader in the sample callback, however this is a benign
-        // race since we'll either read the original value of s_WriteIndex (which is safe,
-        // we just won't consider this sample) or the new value of s_WriteIndex
-        s_WriteIndex = (s_WriteIndex + 1) % CIRCULAR_BUFFER_SIZE;
+        // Bring the audio back in if the gap was faded out
+        if (s_ConcealedPackets > PLC_FULL_GAIN_PACKETS) {
+            ApplyGainRamp(pcmBuffer, decodeLen, ConcealmentGain(s_ConcealedPackets), 1.0f);
+        }
+        g_Instance->m_AudioJitterBuffer.Write(pcmBuffer, decodeLen, false);
     }
+    
+    s_ConcealedPackets = 0;
 }
 
 AUDIO_RENDERER_CALLBACKS MoonlightInstance::s_ArCallbacks = {
     .init = MoonlightInstance::AudDecInit,
     .cleanup = MoonlightInstance::AudDecCleanup,
     .decodeAndPlaySample = MoonlightInstance::AudDecDecodeAndPlaySample,
-    .capabilities = CAPABILITY_DIRECT_SUBMIT
+    .capabilities = CAPABILITY_ADAPTIVE_SUBMIT
 };
@@ -21,8 +21,11 @@ ENET_SOURCE := \
 ENET_INCLUDE := $(ENET_DIR)/include
 
 COMMON_C_SOURCE := \
+	$(COMMON_C_DIR)/AnnexB.c              \
 	$(COMMON_C_DIR)/AudioStream.c         \
+	$(COMMON_C_DIR)/BufferPool.c          \
 	$(COMMON_C_DIR)/ByteBuffer.c          \
+	$(COMMON_C_DIR)/Capture.c             \
 	$(COMMON_C_DIR)/Connection.c          \
 	$(COMMON_C_DIR)/ControlStream.c       \
 	$(COMMON_C_DIR)/FakeCallbacks.c       \
@@ -37,6 +40,8 @@ COMMON_C_SOURCE := \
 	$(COMMON_C_DIR)/RtspParser.c          \
 	$(COMMON_C_DIR)/SdpGenerator.c        \
 	$(COMMON_C_DIR)/SimpleStun.c          \
+	$(COMMON_C_DIR)/SpscRing.c            \
+	$(COMMON_C_DIR)/Trace.c               \
 	$(COMMON_C_DIR)/VideoDepacketizer.c   \
 	$(COMMON_C_DIR)/VideoStream.c         \
     $(ENET_SOURCE)                        \
@@ -0,0 +1,104 @@
+#include "downmix.hpp"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DOWNMIX_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DOWNMIX_NEON
+#endif
+
+// ITU-R BS.775 folds the center and surrounds into each side at -3 dB. The
+// gains are scaled down so a full scale front channel with a full scale
+// center doesn't clip. The LFE channel is dropped, like most downmixes do.
+#define DOWNMIX_FRONT_GAIN 19195    // 0.586
+#define DOWNMIX_CENTER_GAIN 13573   // 0.414
+#define DOWNMIX_SURROUND_GAIN 13573 // 0.414
+
+bool DownmixInitialize(DOWNMIX_COEFFICIENTS* coefficients, int channels) {
+    memset(coefficients, 0, sizeof(*coefficients));
+    coefficients->channels = channels;
+
+    if (channels == 6) {
+        // FL FR C LFE SL SR
+        coefficients->left[0] = DOWNMIX_FRONT_GAIN;
+        coefficients->left[2] = DOWNMIX_CENTER_GAIN;
+        coefficients->left[4] = DOWNMIX_SURROUND_GAIN;
+        coefficients->right[1] = DOWNMIX_FRONT_GAIN;
+        coefficients->right[2] = DOWNMIX_CENTER_GAIN;
+        coefficients->right[5] = DOWNMIX_SURROUND_GAIN;
+        return true;
+    }
+
+    return false;
+}
+
+static short saturate(int32_t sample) {
+    if (sample > 32767) {
+        return 32767;
+    }
+    else if (sample < -32768) {
+        return -32768;
+    }
+    return (short)sample;
+}
+
+void DownmixToStereo(const DOWNMIX_COEFFICIENTS* coefficients, const short* input, short* output, int frames) {
+    int i = 0;
+
+#if defined(DOWNMIX_SSE2)
+    const __m128i left = _mm_loadu_si128((const __m128i*)coefficients->left);
+    const __m128i right = _mm_loadu_si128((const __m128i*)coefficients->right);
+
+    // Each frame is one multiply-add against each side's gains and a
+    // horizontal sum of the 4 partial sums
+    for (; i < frames; i++) {
+        __m128i samples = _mm_loadu_si128((const __m128i*)&input[i * coefficients->channels]);
+        __m128i leftSums = _mm_madd_epi16(samples, left);
+        __m128i rightSums = _mm_madd_epi16(samples, right);
+
+        // [L0+L2, R0+R2, L1+L3, R1+R3]
+        __m128i sums = _mm_add_epi32(_mm_unpacklo_epi32(leftSums, rightSums),
+                                     _mm_unpackhi_epi32(leftSums, rightSums));
+        sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(3, 2, 3, 2)));
+
+        sums = _mm_packs_epi32(_mm_srai_epi32(sums, 15), sums);
+        *(int32_t*)&output[i * 2] = _mm_cvtsi128_si32(sums);
+    }
+#elif defined(DOWNMIX_NEON)
+    const int16x8_t left = vld1q_s16(coefficients->left);
+    const int16x8_t right = vld1q_s16(coefficients->right);
+
+    for (; i < frames; i++) {
+        int16x8_t samples = vld1q_s16(&input[i * coefficients->channels]);
+        int32x4_t leftSums = vmull_s16(vget_low_s16(samples), vget_low_s16(left));
+        int32x4_t rightSums = vmull_s16(vget_low_s16(samples), vget_low_s16(right));
+
+        leftSums = vmlal_s16(leftSums, vget_high_s16(samples), vget_high_s16(left));
+        rightSums = vmlal_s16(rightSums, vget_high_s16(samples), vget_high_s16(right));
+
+        // [L, R]
+        int32x2_t sums = vpadd_s32(vpadd_s32(vget_low_s32(leftSums), vget_high_s32(leftSums)),
+                                   vpadd_s32(vget_low_s32(rightSums), vget_high_s32(rightSums)));
+
+        int16x4_t narrowed = vqshrn_n_s32(vcombine_s32(sums, sums), 15);
+        vst1_lane_s32((int32_t*)&output[i * 2], vreinterpret_s32_s16(narrowed), 0);
+    }
+#endif
+
+    for (; i < frames; i++) {
+        const short* samples = &input[i * coefficients->channels];
+        int32_t leftSum = 0;
+        int32_t rightSum = 0;
+
+        for (int c = 0; c < coefficients->channels; c++) {
+            leftSum += samples[c] * coefficients->left[c];
+            rightSum += samples[c] * coefficients->right[c];
+        }
+
+        output[i * 2] = saturate(leftSum >> 15);
+        output[i * 2 + 1] = saturate(rightSum >> 15);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// Most input channels a downmix can take
+#define DOWNMIX_MAX_CHANNELS 8
+
+// DownmixToStereo() reads whole vectors, so input buffers must have this many
+// extra samples past the last frame
+#define DOWNMIX_INPUT_PADDING DOWNMIX_MAX_CHANNELS
+
+typedef struct _DOWNMIX_COEFFICIENTS {
+    // Q15 gain of each input channel in the left and right outputs. Unused
+    // channels are zero, so a frame can always be loaded as one vector.
+    int16_t left[DOWNMIX_MAX_CHANNELS];
+    int16_t right[DOWNMIX_MAX_CHANNELS];
+
+    int channels;
+} DOWNMIX_COEFFICIENTS;
+
+// Sets up coefficients for folding the given number of channels down to
+// stereo. The channels are in the order described for the Opus mapping in
+// Limelight.h. Returns false if there's no downmix for this layout.
+bool DownmixInitialize(DOWNMIX_COEFFICIENTS* coefficients, int channels);
+
+// Downmixes interleaved input to interleaved stereo output, saturating
+// anything that would clip
+void DownmixToStereo(const DOWNMIX_COEFFICIENTS* coefficients, const short* input, short* output, int frames);
@@ -27,6 +27,7 @@
 #include "bs.h"
 #include "h264_stream.h"
 #include "h264_sei.h"
+#include "AnnexB.h"
 
 /**
  Create a new H264 stream object.  Allocates all structures contained within it.
@@ -96,36 +97,18 @@ int find_nal_unit(uint8_t* buf, int size, int* nal_start, int* nal_end)
     *nal_start = 0;
     *nal_end = 0;
     
-    i = 0;
-    while (   //( next_bits( 24 ) != 0x000001 && next_bits( 32 ) != 0x00000001 )
-        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) && 
-        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0 || buf[i+3] != 0x01) 
-        )
-    {
-        i++; // skip leading zero
-        if (i+4 >= size) { return 0; } // did not find nal start
-    }
+    // next_bits( 24 ) == 0x000001, which also finds the end of a 4 byte start code
+    i = AnbFindStartCode(buf, size);
+    if (i < 0 || i + 4 >= size) { return 0; } // did not find nal start
 
-    if  (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) // ( next_bits( 24 ) != 0x000001 )
-    {
-        i++;
-    }
-
-    if  (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) { /* error, should never happen */ return 0; }
     i+= 3;
     *nal_start = i;
     
-    while (   //( next_bits( 24 ) != 0x000000 && next_bits( 24 ) != 0x000001 )
-        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0) && 
-        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) 
-        )
-    {
-        i++;
-        // FIXME the next line fails when reading a nal that ends exactly at the end of the data
-        if (i+3 >= size) { *nal_end = size; return -1; } // did not find nal end, stream ended first
-    }
+    // next_bits( 24 ) == 0x000000 || next_bits( 24 ) == 0x000001
+    i = AnbFindNalEnd(&buf[i], size - i);
+    if (i < 0) { *nal_end = size; return -1; } // did not find nal end, stream ended first
     
-    *nal_end = i;
+    *nal_end = *nal_start + i;
     return (*nal_end - *nal_start);
 }
 
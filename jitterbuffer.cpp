@@ -0,0 +1,218 @@
+#include "jitterbuffer.hpp"
+
+#include <assert.h>
+#include <string.h>
+
+// How much the target grows after an underrun
+#define AUDIO_JITTER_UNDERRUN_STEP_MS 10
+
+// How much the target shrinks after a stretch of time in which the buffer never
+// came close to running dry. The stretch is long enough that outages recurring
+// every minute or so don't cause an underrun each time.
+#define AUDIO_JITTER_DECAY_STEP_MS 5
+#define AUDIO_JITTER_CALM_MS 120000
+
+// Packets arrive in 5 ms bursts, so the fill level is smoothed over roughly a
+// second of callbacks before it's compared to the target
+#define AUDIO_JITTER_SMOOTHING 256
+
+// Rate correction per ms away from the target. This drains a 10 ms excess in
+// about 10 seconds. The limit is well below an audible change in pitch and
+// far above the drift between any two real sample clocks.
+#define AUDIO_JITTER_PPM_PER_MS 100
+#define AUDIO_JITTER_MAX_CORRECTION_PPM 2000
+
+// Underruns and the start of playback are faded over 1 ms to avoid clicks
+#define AUDIO_JITTER_FADE_MS 1
+
+AudioJitterBuffer::AudioJitterBuffer() {
+    Reset(48000, AUDIO_JITTER_MAX_CHANNELS, AUDIO_JITTER_DEFAULT_TARGET_MS);
+}
+
+void AudioJitterBuffer::Reset(int sampleRate, int channels, int targetMs) {
+    assert(channels <= AUDIO_JITTER_MAX_CHANNELS);
+
+    if (targetMs < AUDIO_JITTER_MIN_TARGET_MS) {
+        targetMs = AUDIO_JITTER_MIN_TARGET_MS;
+    }
+    else if (targetMs > AUDIO_JITTER_MAX_TARGET_MS) {
+        targetMs = AUDIO_JITTER_MAX_TARGET_MS;
+    }
+
+    m_Channels = channels;
+    m_SampleRate = sampleRate;
+    m_Ring.Reset();
+    m_Buffering = true;
+    m_Phase = 0;
+    m_SmoothedFill = 0;
+    m_ConfiguredTarget = (uint32_t)(targetMs * sampleRate / 1000);
+    m_Target = m_ConfiguredTarget;
+    m_CorrectionPpm = 0;
+    m_CalmMinimum = AUDIO_JITTER_CAPACITY;
+    m_CalmFrames = 0;
+
+    m_Underruns.store(0, std::memory_order_relaxed);
+    m_FramesOverflowed.store(0, std::memory_order_relaxed);
+    m_FramesConcealed.store(0, std::memory_order_relaxed);
+    m_TargetMs.store(targetMs, std::memory_order_relaxed);
+    m_BufferedMs.store(0, std::memory_order_relaxed);
+    m_ReportedCorrectionPpm.store(0, std::memory_order_relaxed);
+}
+
+int AudioJitterBuffer::Write(const short* samples, int frames, bool concealed) {
+    uint32_t space = m_Ring.GetWriteAvailable() / m_Channels;
+
+    if (concealed) {
+        m_FramesConcealed.fetch_add(frames, std::memory_order_relaxed);
+    }
+
+    // The consumer holds the fill level at the target, so this only happens
+    // if it stopped reading altogether
+    if ((uint32_t)frames > space) {
+        m_FramesOverflowed.fetch_add(frames - space, std::memory_order_relaxed);
+        frames = space;
+    }
+
+    m_Ring.Write(samples, frames * m_Channels);
+    return frames;
+}
+
+void AudioJitterBuffer::FadeIn(short* output, int frames) {
+    int fadeFrames = m_SampleRate * AUDIO_JITTER_FADE_MS / 1000;
+
+    if (fadeFrames > frames) {
+        fadeFrames = frames;
+    }
+    for (int i = 0; i < fadeFrames; i++) {
+        for (int c = 0; c < m_Channels; c++) {
+            output[i * m_Channels + c] = (short)(output[i * m_Channels + c] * i / fadeFrames);
+        }
+    }
+}
+
+void AudioJitterBuffer::FadeOut(short* output, int frames) {
+    int fadeFrames = m_SampleRate * AUDIO_JITTER_FADE_MS / 1000;
+
+    if (fadeFrames > frames) {
+        fadeFrames = frames;
+    }
+    output += (frames - fadeFrames) * m_Channels;
+    for (int i = 0; i < fadeFrames; i++) {
+        for (int c = 0; c < m_Channels; c++) {
+            output[i * m_Channels + c] = (short)(output[i * m_Channels + c] * (fadeFrames - i) / fadeFrames);
+        }
+    }
+}
+
+void AudioJitterBuffer::UpdateTarget(uint32_t buffered) {
+    m_SmoothedFill += (buffered - m_SmoothedFill) / AUDIO_JITTER_SMOOTHING;
+
+    // Play faster while we're above the target and slower while we're below it
+    double errorMs = (m_SmoothedFill - m_Target) * 1000 / m_SampleRate;
+    m_CorrectionPpm = (int32_t)(errorMs * AUDIO_JITTER_PPM_PER_MS);
+    if (m_CorrectionPpm > AUDIO_JITTER_MAX_CORRECTION_PPM) {
+        m_CorrectionPpm = AUDIO_JITTER_MAX_CORRECTION_PPM;
+    }
+    else if (m_CorrectionPpm < -AUDIO_JITTER_MAX_CORRECTION_PPM) {
+        m_CorrectionPpm = -AUDIO_JITTER_MAX_CORRECTION_PPM;
+    }
+    m_ReportedCorrectionPpm.store(m_CorrectionPpm, std::memory_order_relaxed);
+    m_BufferedMs.store((uint32_t)(m_SmoothedFill * 1000 / m_SampleRate), std::memory_order_relaxed);
+
+    // If the buffer never came close to running dry for a while, give back
+    // some of the latency that earlier underruns added
+    if (buffered < m_CalmMinimum) {
+        m_CalmMinimum = buffered;
+    }
+    if (m_CalmFrames >= (uint32_t)(AUDIO_JITTER_CALM_MS / 1000 * m_SampleRate)) {
+        uint32_t decayFrames = AUDIO_JITTER_DECAY_STEP_MS * m_SampleRate / 1000;
+
+        if (m_Target > m_ConfiguredTarget && m_CalmMinimum >= 2 * decayFrames) {
+            m_Target = m_Target - decayFrames > m_ConfiguredTarget ? m_Target - decayFrames : m_ConfiguredTarget;
+            m_TargetMs.store(m_Target * 1000 / m_SampleRate, std::memory_order_relaxed);
+        }
+
+        m_CalmMinimum = AUDIO_JITTER_CAPACITY;
+        m_CalmFrames = 0;
+    }
+}
+
+void AudioJitterBuffer::Read(short* output, int frames) {
+    uint32_t available = m_Ring.GetReadAvailable() / m_Channels;
+    bool resumed = false;
+
+    if (m_Buffering) {
+        if (available < m_Target) {
+            memset(output, 0, frames * m_Channels * sizeof(short));
+            return;
+        }
+
+        m_Buffering = false;
+        m_Phase = 0;
+        m_SmoothedFill = available;
+        resumed = true;
+    }
+
+    // Interpolating the last frame needs the one after it too
+    double step = 1.0 + m_CorrectionPpm / 1000000.0;
+    uint32_t needed = (uint32_t)(m_Phase + frames * step) + 1;
+
+    if (available < needed) {
+        // Play out what's left and refill to a higher target before playing again
+        int playedFrames = available < (uint32_t)frames ? available : frames;
+        m_Ring.Read(output, playedFrames * m_Channels);
+        FadeOut(output, playedFrames);
+        memset(&output[playedFrames * m_Channels], 0, (frames - playedFrames) * m_Channels * sizeof(short));
+
+        m_Buffering = true;
+        m_Underruns.fetch_add(1, std::memory_order_relaxed);
+        m_Target += AUDIO_JITTER_UNDERRUN_STEP_MS * m_SampleRate / 1000;
+        if (m_Target > (uint32_t)(AUDIO_JITTER_MAX_TARGET_MS * m_SampleRate / 1000)) {
+            m_Target = AUDIO_JITTER_MAX_TARGET_MS * m_SampleRate / 1000;
+        }
+        m_TargetMs.store(m_Target * 1000 / m_SampleRate, std::memory_order_relaxed);
+        m_CalmMinimum = AUDIO_JITTER_CAPACITY;
+        m_CalmFrames = 0;
+        return;
+    }
+
+    // Resample linearly at the corrected rate
+    uint32_t consumed = 0;
+    double phase = m_Phase;
+    for (int i = 0; i < frames; i++) {
+        uint32_t current = consumed * m_Channels;
+        uint32_t next = current + m_Channels;
+
+        for (int c = 0; c < m_Channels; c++) {
+            short currentSample = m_Ring.Peek(current + c);
+            short nextSample = m_Ring.Peek(next + c);
+
+            output[i * m_Channels + c] = (short)(currentSample + (nextSample - currentSample) * phase);
+        }
+
+        phase += step;
+        while (phase >= 1.0) {
+            phase -= 1.0;
+            consumed++;
+        }
+    }
+    m_Phase = phase;
+
+    if (resumed) {
+        FadeIn(output, frames);
+    }
+
+    m_Ring.Consume(consumed * m_Channels);
+
+    m_CalmFrames += frames;
+    UpdateTarget(available - consumed);
+}
+
+void AudioJitterBuffer::GetStats(AUDIO_JITTER_STATS* stats) {
+    stats->underruns = m_Underruns.load(std::memory_order_relaxed);
+    stats->framesOverflowed = m_FramesOverflowed.load(std::memory_order_relaxed);
+    stats->framesConcealed = m_FramesConcealed.load(std::memory_order_relaxed);
+    stats->targetMs = m_TargetMs.load(std::memory_order_relaxed);
+    stats->bufferedMs = m_BufferedMs.load(std::memory_order_relaxed);
+    stats->correctionPpm = m_ReportedCorrectionPpm.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "spscring.hpp"
+
+#include <atomic>
+#include <stdint.h>
+
+// Audio latency the jitter buffer aims for unless JS picks another
+#define AUDIO_JITTER_DEFAULT_TARGET_MS 40
+
+// Bounds for the configured target. The adaptive target can grow past the
+// configured one after underruns, up to the maximum.
+#define AUDIO_JITTER_MIN_TARGET_MS 10
+#define AUDIO_JITTER_MAX_TARGET_MS 150
+
+#define AUDIO_JITTER_MAX_CHANNELS 2
+
+// Capacity in sample frames. This is a power of 2 with enough headroom above
+// the maximum target for a burst of late packets arriving at once.
+#define AUDIO_JITTER_CAPACITY 16384
+
+typedef struct _AUDIO_JITTER_STATS {
+    // Times the buffer ran dry and had to refill to the target before
+    // playing again
+    uint32_t underruns;
+
+    // Sample frames that were thrown away because the buffer was full
+    uint32_t framesOverflowed;
+
+    // Sample frames written in place of lost packets
+    uint32_t framesConcealed;
+
+    // Latency currently aimed for and the smoothed amount actually buffered
+    uint32_t targetMs;
+    uint32_t bufferedMs;
+
+    // Playback rate correction for drift between the host's and our audio
+    // clocks. Positive values play faster than real time to drain the buffer.
+    int32_t correctionPpm;
+} AUDIO_JITTER_STATS;
+
+// Sits between the Opus decoder and the audio device. Decoded samples are
+// written by one thread and read by the audio device callback on another;
+// each side must only ever be active on one thread at a time.
+//
+// The buffer is filled up to a target latency before playback starts. After
+// that, the consumer tracks the fill level and plays slightly faster or slower
+// than real time to hold it at the target, which compensates for the host's
+// sample clock drifting against ours. Underruns raise the target, and it's
+// lowered back towards the configured one while the buffer stays comfortably
+// full.
+class AudioJitterBuffer {
+    public:
+        AudioJitterBuffer();
+
+        // Must not be called while either side is active
+        void Reset(int sampleRate, int channels, int targetMs);
+
+        // Producer side. Queues interleaved samples and returns the number of
+        // frames that fit. concealed marks samples made up for lost packets.
+        int Write(const short* samples, int frames, bool concealed);
+
+        // Consumer side. Always fills output with frames sample frames,
+        // using silence when nothing is ready to play.
+        void Read(short* output, int frames);
+
+        // Safe to call from any thread. The counters are totals since Reset().
+        // Each field is read on its own, so they may be from slightly
+        // different moments.
+        void GetStats(AUDIO_JITTER_STATS* stats);
+
+    private:
+        void FadeIn(short* output, int frames);
+        void FadeOut(short* output, int frames);
+        void UpdateTarget(uint32_t buffered);
+
+        // Interleaved samples. Only whole frames are ever written or consumed.
+        SpscRing<short, AUDIO_JITTER_CAPACITY * AUDIO_JITTER_MAX_CHANNELS> m_Ring;
+        int m_Channels;
+        int m_SampleRate;
+
+        // Consumer state
+        bool m_Buffering;
+        double m_Phase;
+        double m_SmoothedFill;
+        uint32_t m_ConfiguredTarget;
+        uint32_t m_Target;
+        int32_t m_CorrectionPpm;
+
+        // Lowest fill level since the last underrun or change to the target
+        uint32_t m_CalmMinimum;
+        uint32_t m_CalmFrames;
+
+        // Stats are written by both sides and read by GetStats() on any thread
+        std::atomic<uint32_t> m_Underruns;
+        std::atomic<uint32_t> m_FramesOverflowed;
+        std::atomic<uint32_t> m_FramesConcealed;
+        std::atomic<uint32_t> m_TargetMs;
+        std::atomic<uint32_t> m_BufferedMs;
+        std::atomic<int32_t> m_ReportedCorrectionPpm;
+};
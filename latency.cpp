@@ -0,0 +1,111 @@
+#include "latency.hpp"
+
+#include <string.h>
+
+LatencyTracker::LatencyTracker() {
+    Reset();
+}
+
+void LatencyTracker::Reset() {
+    memset(m_Frames, 0, sizeof(m_Frames));
+    memset(m_Stats, 0, sizeof(m_Stats));
+    memset(m_TotalMs, 0, sizeof(m_TotalMs));
+}
+
+LatencyTracker::FrameRecord* LatencyTracker::GetRecord(uint32_t frameNumber) {
+    FrameRecord* record = &m_Frames[frameNumber % k_TrackedFrames];
+
+    // Frame numbers start at 1, so a zeroed record never matches
+    return record->frameNumber == frameNumber ? record : NULL;
+}
+
+void LatencyTracker::AddSample(int stage, uint64_t start, uint64_t end) {
+    LATENCY_STAGE_STATS* stats = &m_Stats[stage];
+    uint64_t timeMs = end > start ? end - start : 0;
+    int bucket = 0;
+
+    while ((timeMs >> bucket) != 0 && bucket < LATENCY_HISTOGRAM_BUCKETS - 1) {
+        bucket++;
+    }
+    stats->histogram[bucket]++;
+
+    stats->frames++;
+    if (timeMs > stats->maxMs) {
+        stats->maxMs = (uint32_t)timeMs;
+    }
+    m_TotalMs[stage] += timeMs;
+}
+
+void LatencyTracker::FrameSubmitted(PDECODE_UNIT decodeUnit, uint64_t now) {
+    FrameRecord* record = &m_Frames[(uint32_t)decodeUnit->frameNumber % k_TrackedFrames];
+
+    // Sliced frames are submitted more than once. The first slice marks the
+    // end of the receive stages and the start of decoding.
+    if (record->frameNumber == (uint32_t)decodeUnit->frameNumber) {
+        return;
+    }
+
+    record->receiveTime = decodeUnit->receiveTimeMs;
+    record->fecCompleteTime = decodeUnit->fecCompleteTimeMs;
+    record->enqueueTime = decodeUnit->enqueueTimeMs;
+    record->submitTime = now;
+    record->readyTime = 0;
+    record->frameNumber = decodeUnit->frameNumber;
+}
+
+void LatencyTracker::PictureReady(uint32_t frameNumber, uint64_t now) {
+    FrameRecord* record = GetRecord(frameNumber);
+
+    if (record != NULL) {
+        record->readyTime = now;
+    }
+}
+
+void LatencyTracker::PicturePresented(uint32_t frameNumber, uint64_t now) {
+    FrameRecord* record = GetRecord(frameNumber);
+
+    if (record == NULL || record->readyTime == 0) {
+        return;
+    }
+
+    AddSample(LATENCY_STAGE_NETWORK, record->receiveTime, record->fecCompleteTime);
+    AddSample(LATENCY_STAGE_DEPACKETIZE, record->fecCompleteTime, record->enqueueTime);
+    AddSample(LATENCY_STAGE_DECODE_QUEUE, record->enqueueTime, record->submitTime);
+    AddSample(LATENCY_STAGE_DECODE, record->submitTime, record->readyTime);
+    AddSample(LATENCY_STAGE_RENDER, record->readyTime, now);
+    AddSample(LATENCY_STAGE_TOTAL, record->receiveTime, now);
+
+    // Don't count this frame again if the picture is somehow presented twice
+    record->readyTime = 0;
+}
+
+void LatencyTracker::TakeStats(LATENCY_STAGE_STATS stats[LATENCY_STAGE_COUNT]) {
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        stats[i] = m_Stats[i];
+        if (m_Stats[i].frames != 0) {
+            stats[i].averageMs = (uint32_t)(m_TotalMs[i] / m_Stats[i].frames);
+        }
+    }
+
+    memset(m_Stats, 0, sizeof(m_Stats));
+    memset(m_TotalMs, 0, sizeof(m_TotalMs));
+}
+
+const char* LatencyTracker::GetStageName(int stage) {
+    switch (stage) {
+    case LATENCY_STAGE_NETWORK:
+        return "network";
+    case LATENCY_STAGE_DEPACKETIZE:
+        return "depacketize";
+    case LATENCY_STAGE_DECODE_QUEUE:
+        return "decodeQueue";
+    case LATENCY_STAGE_DECODE:
+        return "decode";
+    case LATENCY_STAGE_RENDER:
+        return "render";
+    case LATENCY_STAGE_TOTAL:
+        return "total";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Limelight.h>
+
+#include <stdint.h>
+
+// Stages a frame goes through on its way to the screen, each measured from
+// the end of the previous one
+enum LatencyStage {
+    // First packet received until the FEC queue is done with the frame
+    LATENCY_STAGE_NETWORK,
+
+    // FEC queue done until the depacketizer queues the decode unit
+    LATENCY_STAGE_DEPACKETIZE,
+
+    // Decode unit queued until it's submitted to us
+    LATENCY_STAGE_DECODE_QUEUE,
+
+    // Submitted until PictureReady()
+    LATENCY_STAGE_DECODE,
+
+    // PictureReady() until SwapBuffers() completes, including frame pacing
+    LATENCY_STAGE_RENDER,
+
+    // First packet received until SwapBuffers() completes
+    LATENCY_STAGE_TOTAL,
+
+    LATENCY_STAGE_COUNT
+};
+
+// Bucket 0 counts frames that took less than 1 ms, bucket i counts those that
+// took [2^(i-1), 2^i) ms and the last bucket counts everything slower.
+#define LATENCY_HISTOGRAM_BUCKETS 10
+
+typedef struct _LATENCY_STAGE_STATS {
+    uint32_t frames;
+    uint32_t averageMs;
+    uint32_t maxMs;
+    uint32_t histogram[LATENCY_HISTOGRAM_BUCKETS];
+} LATENCY_STAGE_STATS;
+
+// Follows frames from the first packet being received until they're on
+// screen. FrameSubmitted() is called on the decoder thread and everything
+// else on the main thread.
+class LatencyTracker {
+    public:
+        LatencyTracker();
+
+        void Reset();
+
+        void FrameSubmitted(PDECODE_UNIT decodeUnit, uint64_t now);
+        void PictureReady(uint32_t frameNumber, uint64_t now);
+        void PicturePresented(uint32_t frameNumber, uint64_t now);
+
+        // Returns the histograms since the last call and resets them
+        void TakeStats(LATENCY_STAGE_STATS stats[LATENCY_STAGE_COUNT]);
+
+        static const char* GetStageName(int stage);
+
+    private:
+        // Frames are tracked in a ring indexed by frame number. A record is
+        // only reused this many frames later, long after it's been presented
+        // or dropped.
+        static const int k_TrackedFrames = 64;
+
+        struct FrameRecord {
+            uint32_t frameNumber;
+            uint64_t receiveTime;
+            uint64_t fecCompleteTime;
+            uint64_t enqueueTime;
+            uint64_t submitTime;
+            uint64_t readyTime;
+        };
+
+        FrameRecord* GetRecord(uint32_t frameNumber);
+        void AddSample(int stage, uint64_t start, uint64_t end);
+
+        FrameRecord m_Frames[k_TrackedFrames];
+        LATENCY_STAGE_STATS m_Stats[LATENCY_STAGE_COUNT];
+        uint64_t m_TotalMs[LATENCY_STAGE_COUNT];
+};
@@ -22,6 +22,24 @@
 
 #define MSG_OPENURL "openUrl"
 
+// Sent by the NaCl module periodically while streaming, followed by a JSON object
+#define MSG_FEC_STATS "FecStats: "
+#define MSG_PACING_STATS "PacingStats: "
+#define MSG_LATENCY_STATS "LatencyStats: "
+#define MSG_AUDIO_STATS "AudioStats: "
+
+// Selects the frame pacing policy used by the next stream
+#define MSG_SET_FRAME_PACING "setFramePacing"
+// Sets the audio latency in milliseconds that the next stream's jitter buffer aims for
+#define MSG_SET_AUDIO_LATENCY "setAudioLatency"
+// Selects the audio channel layout requested for the next stream
+#define MSG_SET_AUDIO_CONFIGURATION "setAudioConfiguration"
+
+// Starts recording a trace, discarding the last one
+#define MSG_START_TRACE "startTrace"
+// Stops recording and resolves with the trace as Chrome trace event JSON
+#define MSG_STOP_TRACE "stopTrace"
+
 MoonlightInstance* g_Instance;
 
 class MoonlightModule : public pp::Module {
@@ -63,6 +81,90 @@ void MoonlightInstance::OnConnectionStopped(uint32_t error) {
     PostMessage(response);
 }
 
+void MoonlightInstance::ReportFecStatistics() {
+    FEC_STATISTICS stats;
+
+    LiGetFecStatistics(&stats);
+
+    std::string histogram;
+    for (int i = 0; i < FEC_RECONSTRUCTION_TIME_BUCKETS; i++) {
+        if (i != 0) {
+            histogram += ",";
+        }
+        histogram += std::to_string(stats.reconstructionTimeHistogram[i]);
+    }
+
+    pp::Var response(std::string(MSG_FEC_STATS) +
+        "{\"framesReceivedClean\":" + std::to_string(stats.framesReceivedClean) +
+        ",\"framesRecovered\":" + std::to_string(stats.framesRecovered) +
+        ",\"shardsRecovered\":" + std::to_string(stats.shardsRecovered) +
+        ",\"framesUnrecoverable\":" + std::to_string(stats.framesUnrecoverable) +
+        ",\"parityPacketsWasted\":" + std::to_string(stats.parityPacketsWasted) +
+        ",\"packetPoolHits\":" + std::to_string(stats.packetPoolHits) +
+        ",\"packetPoolMisses\":" + std::to_string(stats.packetPoolMisses) +
+        ",\"reconstructionTimeHistogram\":[" + histogram + "]}");
+    PostMessage(response);
+}
+
+void MoonlightInstance::ReportPacingStatistics() {
+    FRAME_PACER_STATS stats;
+
+    m_FramePacer.TakeStats(&stats);
+
+    pp::Var response(std::string(MSG_PACING_STATS) +
+        "{\"framesPresented\":" + std::to_string(stats.framesPresented) +
+        ",\"framesDropped\":" + std::to_string(stats.framesDropped) +
+        ",\"framesMissed\":" + std::to_string(stats.framesMissed) +
+        ",\"averagePresentLatencyMs\":" + std::to_string(stats.averagePresentLatencyMs) +
+        ",\"bufferedFrames\":" + std::to_string(stats.targetBufferedFrames) + "}");
+    PostMessage(response);
+}
+
+void MoonlightInstance::ReportAudioStatistics() {
+    AUDIO_JITTER_STATS stats;
+
+    m_AudioJitterBuffer.GetStats(&stats);
+
+    pp::Var response(std::string(MSG_AUDIO_STATS) +
+        "{\"underruns\":" + std::to_string(stats.underruns) +
+        ",\"framesOverflowed\":" + std::to_string(stats.framesOverflowed) +
+        ",\"framesConcealed\":" + std::to_string(stats.framesConcealed) +
+        ",\"targetMs\":" + std::to_string(stats.targetMs) +
+        ",\"bufferedMs\":" + std::to_string(stats.bufferedMs) +
+        ",\"correctionPpm\":" + std::to_string(stats.correctionPpm) + "}");
+    PostMessage(response);
+}
+
+void MoonlightInstance::ReportLatencyStatistics() {
+    LATENCY_STAGE_STATS stats[LATENCY_STAGE_COUNT];
+
+    m_LatencyTracker.TakeStats(stats);
+
+    std::string json = "{";
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        std::string histogram;
+        for (int j = 0; j < LATENCY_HISTOGRAM_BUCKETS; j++) {
+            if (j != 0) {
+                histogram += ",";
+            }
+            histogram += std::to_string(stats[i].histogram[j]);
+        }
+
+        if (i != 0) {
+            json += ",";
+        }
+        json += std::string("\"") + LatencyTracker::GetStageName(i) + "\":" +
+            "{\"frames\":" + std::to_string(stats[i].frames) +
+            ",\"averageMs\":" + std::to_string(stats[i].averageMs) +
+            ",\"maxMs\":" + std::to_string(stats[i].maxMs) +
+            ",\"histogram\":[" + histogram + "]}";
+    }
+    json += "}";
+
+    pp::Var response(std::string(MSG_LATENCY_STATS) + json);
+    PostMessage(response);
+}
+
 void MoonlightInstance::StopConnection() {
     pthread_t t;
     
@@ -102,10 +204,21 @@ void* MoonlightInstance::StopThreadFunc(void* context) {
 
 void* MoonlightInstance::InputThreadFunc(void* context) {
     MoonlightInstance* me = (MoonlightInstance*)context;
+    uint64_t lastStatsTime = LiGetMillis();
+    uint64_t lastAudioStatsTime = LiGetMillis();
 
     while (me->m_Running) {
         me->PollGamepads();
         me->ReportMouseMovement();
+
+        if (LiGetMillis() - lastStatsTime >= FEC_STATS_INTERVAL_MS) {
+            me->ReportFecStatistics();
+            lastStatsTime = LiGetMillis();
+        }
+        if (LiGetMillis() - lastAudioStatsTime >= AUDIO_STATS_INTERVAL_MS) {
+            me->ReportAudioStatistics();
+            lastAudioStatsTime = LiGetMillis();
+        }
         
         // Poll every 5 ms
         usleep(5 * 1000);
@@ -177,6 +290,16 @@ void MoonlightInstance::HandleMessage(const pp::Var& var_message) {
         HandlePair(callbackId, params);
     } else if (strcmp(method.c_str(), "STUN") == 0) {
         HandleSTUN(callbackId, params);
+    } else if (strcmp(method.c_str(), MSG_SET_FRAME_PACING) == 0) {
+        HandleSetFramePacing(callbackId, params);
+    } else if (strcmp(method.c_str(), MSG_SET_AUDIO_LATENCY) == 0) {
+        HandleSetAudioLatency(callbackId, params);
+    } else if (strcmp(method.c_str(), MSG_SET_AUDIO_CONFIGURATION) == 0) {
+        HandleSetAudioConfiguration(callbackId, params);
+    } else if (strcmp(method.c_str(), MSG_START_TRACE) == 0) {
+        HandleStartTrace(callbackId, params);
+    } else if (strcmp(method.c_str(), MSG_STOP_TRACE) == 0) {
+        HandleStopTrace(callbackId, params);
     } else {
         pp::Var response("Unhandled message received: " + method);
         PostMessage(response);
@@ -225,7 +348,7 @@ void MoonlightInstance::HandleStartStream(int32_t callbackId, pp::VarArray args)
     m_StreamConfig.height = stoi(height);
     m_StreamConfig.fps = stoi(fps);
     m_StreamConfig.bitrate = stoi(bitrate); // kilobits per second
-    m_StreamConfig.audioConfiguration = AUDIO_CONFIGURATION_STEREO;
+    m_StreamConfig.audioConfiguration = m_AudioConfiguration;
     m_StreamConfig.streamingRemotely = STREAM_CFG_AUTO;
     m_StreamConfig.packetSize = 1392;
     
@@ -266,6 +389,92 @@ void MoonlightInstance::HandleStopStream(int32_t callbackId, pp::VarArray args)
     PostMessage(ret);
 }
 
+void MoonlightInstance::HandleSetFramePacing(int32_t callbackId, pp::VarArray args) {
+    std::string policyName = args.Get(0).AsString();
+    FramePacingPolicy policy;
+    
+    pp::VarDictionary ret;
+    ret.Set("callbackId", pp::Var(callbackId));
+    if (FramePacer::ParsePolicy(policyName.c_str(), &policy)) {
+        // This takes effect when the next stream's decoder is set up
+        m_FramePacingPolicy = policy;
+        ret.Set("type", pp::Var("resolve"));
+    }
+    else {
+        ret.Set("type", pp::Var("reject"));
+    }
+    ret.Set("ret", pp::VarDictionary());
+    PostMessage(ret);
+}
+
+void MoonlightInstance::HandleSetAudioLatency(int32_t callbackId, pp::VarArray args) {
+    pp::Var latency = args.Get(0);
+    
+    pp::VarDictionary ret;
+    ret.Set("callbackId", pp::Var(callbackId));
+    if (latency.is_int() && latency.AsInt() >= AUDIO_JITTER_MIN_TARGET_MS &&
+            latency.AsInt() <= AUDIO_JITTER_MAX_TARGET_MS) {
+        // This takes effect when the next stream's audio renderer is initialized
+        m_AudioLatencyMs = latency.AsInt();
+        ret.Set("type", pp::Var("resolve"));
+    }
+    else {
+        ret.Set("type", pp::Var("reject"));
+    }
+    ret.Set("ret", pp::VarDictionary());
+    PostMessage(ret);
+}
+
+void MoonlightInstance::HandleSetAudioConfiguration(int32_t callbackId, pp::VarArray args) {
+    std::string configurationName = args.Get(0).AsString();
+    
+    pp::VarDictionary ret;
+    ret.Set("callbackId", pp::Var(callbackId));
+    ret.Set("type", pp::Var("resolve"));
+    if (configurationName == "stereo") {
+        m_AudioConfiguration = AUDIO_CONFIGURATION_STEREO;
+    }
+    else if (configurationName == "51Surround") {
+        // PPB_Audio only plays stereo, so the renderer downmixes this
+        m_AudioConfiguration = AUDIO_CONFIGURATION_51_SURROUND;
+    }
+    else {
+        ret.Set("type", pp::Var("reject"));
+    }
+    ret.Set("ret", pp::VarDictionary());
+    PostMessage(ret);
+}
+
+void MoonlightInstance::HandleStartTrace(int32_t callbackId, pp::VarArray args) {
+    LiTraceSetThreadName("Main");
+    LiTraceSetEnabled(1);
+    
+    pp::VarDictionary ret;
+    ret.Set("callbackId", pp::Var(callbackId));
+    ret.Set("type", pp::Var("resolve"));
+    ret.Set("ret", pp::VarDictionary());
+    PostMessage(ret);
+}
+
+void MoonlightInstance::HandleStopTrace(int32_t callbackId, pp::VarArray args) {
+    LiTraceSetEnabled(0);
+    
+    char* json = LiTraceDumpJson();
+    
+    pp::VarDictionary ret;
+    ret.Set("callbackId", pp::Var(callbackId));
+    if (json != NULL) {
+        ret.Set("type", pp::Var("resolve"));
+        ret.Set("ret", pp::Var(json));
+        free(json);
+    }
+    else {
+        ret.Set("type", pp::Var("reject"));
+        ret.Set("ret", pp::VarDictionary());
+    }
+    PostMessage(ret);
+}
+
 void MoonlightInstance::HandleOpenURL(int32_t callbackId, pp::VarArray args) {
     m_HttpThreadPool[m_HttpThreadPoolSequence++ % HTTP_HANDLER_THREADS]->message_loop().PostWork(
         m_CallbackFactory.NewCallback(&MoonlightInstance::NvHTTPRequest, callbackId, args));
@@ -41,11 +41,49 @@
 #include <assert.h>
 #include "rs.h"
 
+/*
+ * Split-nibble SIMD kernels. x86 kernels are compiled with per-function
+ * target attributes and selected at runtime, NEON is selected at compile
+ * time. Everything else (including Emscripten) uses the table lookup path.
+ */
+#if defined(__GNUC__) && !defined(__EMSCRIPTEN__) && (defined(__x86_64__) || defined(__i386__))
+#define RS_HAVE_X86_KERNELS
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RS_HAVE_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
 #ifdef _MSC_VER
 #define NEED_ALLOCA
 #define alloca(x) _alloca(x)
 #endif
 
+/*
+ * Large blocks are split across a small pool of worker threads. Platforms
+ * without pthreads (Windows, Emscripten builds without threads) always
+ * code on the calling thread.
+ */
+#if !defined(_WIN32) && (!defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__))
+#define RS_HAVE_WORKERS
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#endif
+
+/* worker threads used in addition to the calling thread */
+#ifndef RS_WORKER_THREADS
+#define RS_WORKER_THREADS 3
+#endif
+
+/* (input + output shards) * block size needed before we go parallel */
+#ifndef RS_PARALLEL_MIN_BYTES
+#define RS_PARALLEL_MIN_BYTES (128 * 1024)
+#endif
+
+/* byte ranges handed to workers start on this boundary */
+#define RS_PARALLEL_ALIGN 64
+
 typedef unsigned char gf;
 
 #define GF_BITS  8
@@ -81,6 +119,17 @@ static gf __declspec(align (256)) gf_mul_table[(GF_SIZE + 1)*(GF_SIZE + 1)];
 static gf gf_mul_table[(GF_SIZE + 1)*(GF_SIZE + 1)] __attribute__((aligned (256)));
 #endif
 
+/*
+ * gf_nibble_table[c][0][i] = c * i and gf_nibble_table[c][1][i] = c * (i << 4),
+ * so c * x = gf_nibble_table[c][0][x & 0xF] ^ gf_nibble_table[c][1][x >> 4].
+ * This is the 16-entry shuffle table layout used by the SIMD kernels.
+ */
+#ifdef _MSC_VER
+static gf __declspec(align (32)) gf_nibble_table[GF_SIZE + 1][2][16];
+#else
+static gf gf_nibble_table[GF_SIZE + 1][2][16] __attribute__((aligned (32)));
+#endif
+
 /*
  * modnn(x) computes x % GF_SIZE, where GF_SIZE is 2**GF_BITS - 1,
  * without a slow divide.
@@ -93,28 +142,177 @@ static inline gf modnn(int x) {
     return x;
 }
 
-static void addmul(gf *dst1, gf *src1, gf c, int sz) {
+/*
+ * dst ^= c * src and dst = c * src over sz bytes. The scalar versions also
+ * finish the tails left over by the vector kernels.
+ */
+typedef void (*gf_vec_fn)(gf *dst, gf *src, gf c, int sz);
+
+static void addmul_scalar(gf *dst1, gf *src1, gf c, int sz) {
     USE_GF_MULC;
-    if (c != 0) {
-        register gf *dst = dst1, *src = src1;
-        gf *lim = &dst[sz];
+    register gf *dst = dst1, *src = src1;
+    gf *lim = &dst[sz];
 
-        GF_MULC0(c);
-        for (; dst < lim; dst++, src++)
-            GF_ADDMULC(*dst, *src);
+    GF_MULC0(c);
+    for (; dst < lim; dst++, src++)
+        GF_ADDMULC(*dst, *src);
+}
+
+static void mul_scalar(gf *dst1, gf *src1, gf c, int sz) {
+    USE_GF_MULC;
+    register gf *dst = dst1, *src = src1;
+    gf *lim = &dst[sz];
+
+    GF_MULC0(c);
+    for (; dst < lim; dst++, src++)
+        GF_MULC(*dst , *src);
+}
+
+#ifdef RS_HAVE_X86_KERNELS
+__attribute__((target("ssse3")))
+static void addmul_ssse3(gf *dst, gf *src, gf c, int sz) {
+    const __m128i tlo = _mm_load_si128((const __m128i*)gf_nibble_table[c][0]);
+    const __m128i thi = _mm_load_si128((const __m128i*)gf_nibble_table[c][1]);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    int i;
+
+    for (i = 0; i + 16 <= sz; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)&src[i]);
+        __m128i lo = _mm_shuffle_epi8(tlo, _mm_and_si128(x, mask));
+        __m128i hi = _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        __m128i d = _mm_loadu_si128((const __m128i*)&dst[i]);
+        _mm_storeu_si128((__m128i*)&dst[i], _mm_xor_si128(d, _mm_xor_si128(lo, hi)));
+    }
+
+    addmul_scalar(&dst[i], &src[i], c, sz - i);
+}
+
+__attribute__((target("ssse3")))
+static void mul_ssse3(gf *dst, gf *src, gf c, int sz) {
+    const __m128i tlo = _mm_load_si128((const __m128i*)gf_nibble_table[c][0]);
+    const __m128i thi = _mm_load_si128((const __m128i*)gf_nibble_table[c][1]);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    int i;
+
+    for (i = 0; i + 16 <= sz; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)&src[i]);
+        __m128i lo = _mm_shuffle_epi8(tlo, _mm_and_si128(x, mask));
+        __m128i hi = _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        _mm_storeu_si128((__m128i*)&dst[i], _mm_xor_si128(lo, hi));
     }
+
+    mul_scalar(&dst[i], &src[i], c, sz - i);
+}
+
+__attribute__((target("avx2")))
+static void addmul_avx2(gf *dst, gf *src, gf c, int sz) {
+    /* vpshufb works per 128-bit lane, so both lanes get the same table */
+    const __m256i tlo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)gf_nibble_table[c][0]));
+    const __m256i thi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)gf_nibble_table[c][1]));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    int i;
+
+    for (i = 0; i + 32 <= sz; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)&src[i]);
+        __m256i lo = _mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask));
+        __m256i hi = _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+        __m256i d = _mm256_loadu_si256((const __m256i*)&dst[i]);
+        _mm256_storeu_si256((__m256i*)&dst[i], _mm256_xor_si256(d, _mm256_xor_si256(lo, hi)));
+    }
+
+    addmul_ssse3(&dst[i], &src[i], c, sz - i);
+}
+
+__attribute__((target("avx2")))
+static void mul_avx2(gf *dst, gf *src, gf c, int sz) {
+    const __m256i tlo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)gf_nibble_table[c][0]));
+    const __m256i thi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)gf_nibble_table[c][1]));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    int i;
+
+    for (i = 0; i + 32 <= sz; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)&src[i]);
+        __m256i lo = _mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask));
+        __m256i hi = _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+        _mm256_storeu_si256((__m256i*)&dst[i], _mm256_xor_si256(lo, hi));
+    }
+
+    mul_ssse3(&dst[i], &src[i], c, sz - i);
+}
+#endif
+
+#ifdef RS_HAVE_NEON_KERNELS
+static inline uint8x16_t gf_mul_neon(uint8x16_t x, const gf *tables) {
+    const uint8x16_t mask = vdupq_n_u8(0x0F);
+    uint8x16_t lo = vandq_u8(x, mask);
+    uint8x16_t hi = vshrq_n_u8(x, 4);
+#if defined(__aarch64__)
+    return veorq_u8(vqtbl1q_u8(vld1q_u8(tables), lo),
+                    vqtbl1q_u8(vld1q_u8(tables + 16), hi));
+#else
+    uint8x8x2_t tlo = { { vld1_u8(tables), vld1_u8(tables + 8) } };
+    uint8x8x2_t thi = { { vld1_u8(tables + 16), vld1_u8(tables + 24) } };
+    return veorq_u8(vcombine_u8(vtbl2_u8(tlo, vget_low_u8(lo)), vtbl2_u8(tlo, vget_high_u8(lo))),
+                    vcombine_u8(vtbl2_u8(thi, vget_low_u8(hi)), vtbl2_u8(thi, vget_high_u8(hi))));
+#endif
+}
+
+static void addmul_neon(gf *dst, gf *src, gf c, int sz) {
+    const gf *tables = &gf_nibble_table[c][0][0];
+    int i;
+
+    for (i = 0; i + 16 <= sz; i += 16)
+        vst1q_u8(&dst[i], veorq_u8(vld1q_u8(&dst[i]), gf_mul_neon(vld1q_u8(&src[i]), tables)));
+
+    addmul_scalar(&dst[i], &src[i], c, sz - i);
+}
+
+static void mul_neon(gf *dst, gf *src, gf c, int sz) {
+    const gf *tables = &gf_nibble_table[c][0][0];
+    int i;
+
+    for (i = 0; i + 16 <= sz; i += 16)
+        vst1q_u8(&dst[i], gf_mul_neon(vld1q_u8(&src[i]), tables));
+
+    mul_scalar(&dst[i], &src[i], c, sz - i);
+}
+#endif
+
+static gf_vec_fn addmul_impl = addmul_scalar;
+static gf_vec_fn mul_impl = mul_scalar;
+
+static void select_kernels(void) {
+#if defined(RS_HAVE_X86_KERNELS)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        addmul_impl = addmul_avx2;
+        mul_impl = mul_avx2;
+        return;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        addmul_impl = addmul_ssse3;
+        mul_impl = mul_ssse3;
+        return;
+    }
+#elif defined(RS_HAVE_NEON_KERNELS)
+    addmul_impl = addmul_neon;
+    mul_impl = mul_neon;
+    return;
+#endif
+    addmul_impl = addmul_scalar;
+    mul_impl = mul_scalar;
+}
+
+static void addmul(gf *dst1, gf *src1, gf c, int sz) {
+    if (c != 0)
+        addmul_impl(dst1, src1, c, sz);
 }
 
 static void mul(gf *dst1, gf *src1, gf c, int sz) {
-    USE_GF_MULC;
-    if (c != 0) {
-        register gf *dst = dst1, *src = src1;
-        gf *lim = &dst[sz];
-        GF_MULC0(c);
-        for (; dst < lim; dst++, src++)
-            GF_MULC(*dst , *src);
-    } else
-        memset(dst1, 0, c);
+    if (c != 0)
+        mul_impl(dst1, src1, c, sz);
+    else
+        memset(dst1, 0, sz);
 }
 
 /* y = a.dot(b) */
@@ -149,6 +347,13 @@ static void init_mul_table(void) {
 
     for (j=0; j< GF_SIZE+1; j++)
         gf_mul_table[j] = gf_mul_table[j<<8] = 0;
+
+    for (i=0; i< GF_SIZE+1; i++) {
+        for (j=0; j< 16; j++) {
+            gf_nibble_table[i][0][j] = gf_mul(i, j);
+            gf_nibble_table[i][1][j] = gf_mul(i, (j << 4));
+        }
+    }
 }
 
 /*
@@ -361,7 +566,7 @@ static gf* sub_matrix(gf* matrix, int rmin, int cmin, int rmax, int cmax,  int n
 }
 
 /* copy from golang rs version */
-static inline int code_some_shards(gf* matrixRows, gf** inputs, gf** outputs, int dataShards, int outputCount, int byteCount) {
+static void code_some_shards_serial(gf* matrixRows, gf** inputs, gf** outputs, int dataShards, int outputCount, int byteCount) {
     gf* in;
     int iRow, c;
     for (c = 0; c < dataShards; c++) {
@@ -373,13 +578,155 @@ static inline int code_some_shards(gf* matrixRows, gf** inputs, gf** outputs, in
                 addmul(outputs[iRow], in, matrixRows[iRow*dataShards+c], byteCount);
         }
     }
+}
+
+#ifdef RS_HAVE_WORKERS
+typedef struct _rs_job {
+    gf* matrixRows;
+    gf** inputs;
+    gf** outputs;
+    int dataShards;
+    int outputCount;
+    /* byte range of every shard handled by this job */
+    int start;
+    int end;
+} rs_job;
+
+static struct {
+    pthread_once_t once;
+    /* held by the thread that currently owns the workers */
+    pthread_mutex_t owner;
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    unsigned int generation;
+    int pending;
+    int nr_workers;
+    rs_job jobs[RS_WORKER_THREADS];
+} rs_pool = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+              PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void code_shard_range(rs_job* job) {
+    gf* inputs[DATA_SHARDS_MAX];
+    gf* outputs[DATA_SHARDS_MAX];
+    int i;
+
+    if (job->end <= job->start)
+        return;
+
+    for (i = 0; i < job->dataShards; i++)
+        inputs[i] = job->inputs[i] + job->start;
+    for (i = 0; i < job->outputCount; i++)
+        outputs[i] = job->outputs[i] + job->start;
+
+    code_some_shards_serial(job->matrixRows, inputs, outputs, job->dataShards, job->outputCount, job->end - job->start);
+}
+
+static void* rs_worker(void* arg) {
+    int id = (int)(intptr_t)arg;
+    unsigned int generation = 0;
+    rs_job job;
+
+    pthread_mutex_lock(&rs_pool.mutex);
+    for (;;) {
+        while (rs_pool.generation == generation)
+            pthread_cond_wait(&rs_pool.start_cond, &rs_pool.mutex);
+        generation = rs_pool.generation;
+        job = rs_pool.jobs[id];
+        pthread_mutex_unlock(&rs_pool.mutex);
+
+        code_shard_range(&job);
+
+        pthread_mutex_lock(&rs_pool.mutex);
+        if (--rs_pool.pending == 0)
+            pthread_cond_signal(&rs_pool.done_cond);
+    }
+
+    return NULL;
+}
+
+/* workers live for the rest of the process */
+static void rs_pool_init(void) {
+    pthread_t thread;
+    int nr_workers = RS_WORKER_THREADS;
+    int i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    /* extra threads only add switching overhead without a core to run on */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && cpus - 1 < nr_workers)
+        nr_workers = (int)(cpus - 1);
+#endif
 
+    for (i = 0; i < nr_workers; i++) {
+        if (pthread_create(&thread, NULL, rs_worker, (void*)(intptr_t)i) != 0)
+            break;
+        pthread_detach(thread);
+        rs_pool.nr_workers++;
+    }
+}
+
+/* returns 0 if the pool was busy or unavailable and nothing was coded */
+static int code_some_shards_parallel(gf* matrixRows, gf** inputs, gf** outputs, int dataShards, int outputCount, int byteCount) {
+    rs_job job;
+    int chunk, i;
+
+    pthread_once(&rs_pool.once, rs_pool_init);
+    if (rs_pool.nr_workers == 0 || pthread_mutex_trylock(&rs_pool.owner) != 0)
+        return 0;
+
+    /* every byte is coded independently, so any split gives identical output */
+    chunk = (byteCount + rs_pool.nr_workers) / (rs_pool.nr_workers + 1);
+    chunk = (chunk + RS_PARALLEL_ALIGN - 1) & ~(RS_PARALLEL_ALIGN - 1);
+
+    job.matrixRows = matrixRows;
+    job.inputs = inputs;
+    job.outputs = outputs;
+    job.dataShards = dataShards;
+    job.outputCount = outputCount;
+
+    pthread_mutex_lock(&rs_pool.mutex);
+    for (i = 0; i < rs_pool.nr_workers; i++) {
+        rs_pool.jobs[i] = job;
+        rs_pool.jobs[i].start = i * chunk < byteCount ? i * chunk : byteCount;
+        rs_pool.jobs[i].end = (i + 1) * chunk < byteCount ? (i + 1) * chunk : byteCount;
+    }
+    rs_pool.pending = rs_pool.nr_workers;
+    rs_pool.generation++;
+    pthread_cond_broadcast(&rs_pool.start_cond);
+    pthread_mutex_unlock(&rs_pool.mutex);
+
+    /* the calling thread takes the last chunk */
+    job.start = i * chunk < byteCount ? i * chunk : byteCount;
+    job.end = byteCount;
+    code_shard_range(&job);
+
+    pthread_mutex_lock(&rs_pool.mutex);
+    while (rs_pool.pending != 0)
+        pthread_cond_wait(&rs_pool.done_cond, &rs_pool.mutex);
+    pthread_mutex_unlock(&rs_pool.mutex);
+
+    pthread_mutex_unlock(&rs_pool.owner);
+    return 1;
+}
+#endif
+
+static int code_some_shards(gf* matrixRows, gf** inputs, gf** outputs, int dataShards, int outputCount, int byteCount) {
+#ifdef RS_HAVE_WORKERS
+    if ((long)(dataShards + outputCount) * byteCount >= RS_PARALLEL_MIN_BYTES &&
+        byteCount >= 2 * RS_PARALLEL_ALIGN &&
+        code_some_shards_parallel(matrixRows, inputs, outputs, dataShards, outputCount, byteCount))
+        return 0;
+#endif
+
+    code_some_shards_serial(matrixRows, inputs, outputs, dataShards, outputCount, byteCount);
     return 0;
 }
 
 void reed_solomon_init(void) {
     generate_gf();
     init_mul_table();
+    select_kernels();
 }
 
 reed_solomon* reed_solomon_new(int data_shards, int parity_shards) {
@@ -398,6 +745,8 @@ reed_solomon* reed_solomon_new(int data_shards, int parity_shards) {
         rs->shards = (data_shards + parity_shards);
         rs->m = NULL;
         rs->parity = NULL;
+        memset(rs->decode_cache, 0, sizeof(rs->decode_cache));
+        rs->decode_cache_clock = 0;
 
         if (rs->shards > DATA_SHARDS_MAX || data_shards <= 0 || parity_shards <= 0) {
             err = 1;
@@ -472,6 +821,8 @@ reed_solomon* reed_solomon_new(int data_shards, int parity_shards) {
 }
 
 void reed_solomon_release(reed_solomon* rs) {
+    int i;
+
     if (NULL != rs) {
         if (NULL != rs->m)
             free(rs->m);
@@ -479,10 +830,64 @@ void reed_solomon_release(reed_solomon* rs) {
         if (NULL != rs->parity)
             free(rs->parity);
 
+        for (i = 0; i < DECODE_CACHE_SIZE; i++) {
+            if (NULL != rs->decode_cache[i].rows)
+                free(rs->decode_cache[i].rows);
+        }
+
         free(rs);
     }
 }
 
+/*
+ * The decode matrix only depends on which shard rows are fed to the
+ * decoder, so it can be reused for every block with the same erasures.
+ * */
+static reed_solomon_decode_matrix* decode_cache_lookup(reed_solomon* rs, const unsigned char* inputs) {
+    int i;
+
+    for (i = 0; i < DECODE_CACHE_SIZE; i++) {
+        reed_solomon_decode_matrix* entry = &rs->decode_cache[i];
+        if (NULL != entry->rows && 0 == memcmp(entry->inputs, inputs, sizeof(entry->inputs))) {
+            entry->last_used = ++rs->decode_cache_clock;
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void decode_cache_insert(reed_solomon* rs, const unsigned char* inputs, gf* rows, int nr_outputs) {
+    reed_solomon_decode_matrix* victim = &rs->decode_cache[0];
+    int i;
+
+    /* take an empty slot if there is one, otherwise evict the least recently used */
+    for (i = 0; i < DECODE_CACHE_SIZE; i++) {
+        reed_solomon_decode_matrix* entry = &rs->decode_cache[i];
+        if (NULL == entry->rows) {
+            victim = entry;
+            break;
+        }
+        if (entry->last_used < victim->last_used)
+            victim = entry;
+    }
+
+    if (NULL != victim->rows && victim->nr_outputs != nr_outputs) {
+        free(victim->rows);
+        victim->rows = NULL;
+    }
+    if (NULL == victim->rows) {
+        victim->rows = (gf*)malloc(nr_outputs * rs->data_shards);
+        if (NULL == victim->rows)
+            return;
+    }
+
+    memcpy(victim->inputs, inputs, sizeof(victim->inputs));
+    memcpy(victim->rows, rows, nr_outputs * rs->data_shards);
+    victim->nr_outputs = nr_outputs;
+    victim->last_used = ++rs->decode_cache_clock;
+}
+
 /**
  * decode one shard
  * input:
@@ -498,6 +903,8 @@ static int reed_solomon_decode(reed_solomon* rs, unsigned char **data_blocks, in
     gf dataDecodeMatrix[DATA_SHARDS_MAX*DATA_SHARDS_MAX];
     unsigned char* subShards[DATA_SHARDS_MAX];
     unsigned char* outputs[DATA_SHARDS_MAX];
+    unsigned char inputs[(DATA_SHARDS_MAX + 7) / 8];
+    reed_solomon_decode_matrix* cached;
     gf* m = rs->m;
     int i, j, c, swap, subMatrixRow, dataShards, nos, nshards;
 
@@ -526,39 +933,55 @@ static int reed_solomon_decode(reed_solomon* rs, unsigned char **data_blocks, in
     nos = 0;
     nshards = 0;
     dataShards = rs->data_shards;
+    memset(inputs, 0, sizeof(inputs));
     for (i = 0; i < dataShards; i++) {
         if (j < nr_fec_blocks && i == erased_blocks[j])
             j++;
         else {
             /* this row is ok */
-            for (c = 0; c < dataShards; c++)
-                dataDecodeMatrix[subMatrixRow*dataShards + c] = m[i*dataShards + c];
-
+            inputs[i >> 3] |= 1 << (i & 7);
             subShards[subMatrixRow] = data_blocks[i];
             subMatrixRow++;
         }
     }
 
     for (i = 0; i < nr_fec_blocks && subMatrixRow < dataShards; i++) {
-        subShards[subMatrixRow] = dec_fec_blocks[i];
         j = dataShards + fec_block_nos[i];
-        for (c = 0; c < dataShards; c++)
-            dataDecodeMatrix[subMatrixRow*dataShards + c] = m[j*dataShards + c];
-
+        inputs[j >> 3] |= 1 << (j & 7);
+        subShards[subMatrixRow] = dec_fec_blocks[i];
         subMatrixRow++;
     }
 
     if (subMatrixRow < dataShards)
         return -1;
 
+    for (i = 0; i < nr_fec_blocks; i++)
+        outputs[i] = data_blocks[erased_blocks[i]];
+
+    /* repeat erasure patterns skip the matrix inversion entirely */
+    cached = decode_cache_lookup(rs, inputs);
+    if (NULL != cached && cached->nr_outputs == nr_fec_blocks)
+        return code_some_shards(cached->rows, subShards, outputs, dataShards, nr_fec_blocks, block_size);
+
+    subMatrixRow = 0;
+    for (i = 0; i < rs->shards; i++) {
+        if (inputs[i >> 3] & (1 << (i & 7))) {
+            for (c = 0; c < dataShards; c++)
+                dataDecodeMatrix[subMatrixRow*dataShards + c] = m[i*dataShards + c];
+
+            subMatrixRow++;
+        }
+    }
+
     invert_mat(dataDecodeMatrix, dataShards);
 
     for (i = 0; i < nr_fec_blocks; i++) {
         j = erased_blocks[i];
-        outputs[i] = data_blocks[j];
         memmove(dataDecodeMatrix+i*dataShards, dataDecodeMatrix+j*dataShards, dataShards);
     }
 
+    decode_cache_insert(rs, inputs, dataDecodeMatrix, nr_fec_blocks);
+
     return code_some_shards(dataDecodeMatrix, subShards, outputs, dataShards, nr_fec_blocks, block_size);
 }
 
@@ -639,3 +1062,68 @@ int reed_solomon_reconstruct(reed_solomon* rs, unsigned char** shards, unsigned
 
     return err;
 }
+
+void reed_solomon_fold_shard(reed_solomon* rs, unsigned char** accumulators, int shard, unsigned char* data, int block_size) {
+    int i;
+
+    for (i = 0; i < rs->parity_shards; i++)
+        addmul(accumulators[i], data, rs->parity[i*rs->data_shards + shard], block_size);
+}
+
+int reed_solomon_reconstruct_folded(reed_solomon* rs, unsigned char** shards, unsigned char* marks, unsigned char** accumulators, int block_size) {
+    gf syndromeMatrix[DATA_SHARDS_MAX*DATA_SHARDS_MAX];
+    unsigned char* syndromes[DATA_SHARDS_MAX];
+    unsigned char* outputs[DATA_SHARDS_MAX];
+    unsigned int erased_blocks[DATA_SHARDS_MAX];
+    unsigned int parity_rows[DATA_SHARDS_MAX];
+    int i, j, dn, pn;
+    int ds = rs->data_shards;
+    int ps = rs->parity_shards;
+
+    dn = 0;
+    for (i = 0; i < ds; i++) {
+        if (marks[i])
+            erased_blocks[dn++] = i;
+    }
+    if (dn == 0)
+        return 0;
+
+    pn = 0;
+    for (i = 0; i < ps && pn < dn; i++) {
+        if (!marks[ds + i]) {
+            parity_rows[pn] = i;
+            for (j = 0; j < dn; j++)
+                syndromeMatrix[pn*dn + j] = rs->parity[i*ds + erased_blocks[j]];
+            pn++;
+        }
+    }
+
+    if (pn < dn)
+        return -1;
+
+    /*
+     * the code is MDS, so any dn parity rows restricted to the dn erased
+     * columns form an invertible matrix
+     * */
+    if (invert_mat(syndromeMatrix, dn))
+        return -1;
+
+    /*
+     * each accumulator holds the parity contribution of the received data,
+     * so adding the received parity leaves only the erased shards' share:
+     * syndrome[j] = sum(parity[p_j][e_k] * data[e_k])
+     * */
+    for (i = 0; i < dn; i++) {
+        addmul(accumulators[parity_rows[i]], shards[ds + parity_rows[i]], 1, block_size);
+        syndromes[i] = accumulators[parity_rows[i]];
+        outputs[i] = shards[erased_blocks[i]];
+    }
+
+    code_some_shards(syndromeMatrix, syndromes, outputs, dn, dn, block_size);
+
+    /* adding the parity again takes it back out, so this can be retried */
+    for (i = 0; i < dn; i++)
+        addmul(accumulators[parity_rows[i]], shards[ds + parity_rows[i]], 1, block_size);
+
+    return 0;
+}
@@ -4,12 +4,26 @@
 /* use small value to save memory */
 #define DATA_SHARDS_MAX 255
 
+/* number of inverted decode matrices kept per reed_solomon instance */
+#define DECODE_CACHE_SIZE 8
+
+typedef struct _reed_solomon_decode_matrix {
+    /* bitmap of the shard rows that were used as decoder inputs */
+    unsigned char inputs[(DATA_SHARDS_MAX + 7) / 8];
+    int nr_outputs;
+    unsigned int last_used;
+    /* nr_outputs rows of data_shards coefficients, NULL if the slot is empty */
+    unsigned char* rows;
+} reed_solomon_decode_matrix;
+
 typedef struct _reed_solomon {
     int data_shards;
     int parity_shards;
     int shards;
     unsigned char* m;
     unsigned char* parity;
+    reed_solomon_decode_matrix decode_cache[DECODE_CACHE_SIZE];
+    unsigned int decode_cache_clock;
 } reed_solomon;
 
 /**
@@ -38,5 +52,21 @@ int reed_solomon_encode(reed_solomon* rs, unsigned char** shards, int nr_shards,
  * marks[nr_shards] marks as errors
  * */
 int reed_solomon_reconstruct(reed_solomon* rs, unsigned char** shards, unsigned char* marks, int nr_shards, int block_size);
+
+/**
+ * progressive decoding of a single block (nr_shards == rs->shards)
+ * fold each received data shard into the parity accumulators as it arrives,
+ * then recover the erased data shards with a small fix-up at the end
+ * input:
+ * accumulators[rs->parity_shards][block_size], zeroed before the first fold
+ * shard: index of the data shard being folded
+ * */
+void reed_solomon_fold_shard(reed_solomon* rs, unsigned char** accumulators, int shard, unsigned char* data, int block_size);
+
+/**
+ * every received data shard must have been folded exactly once
+ * marks[rs->shards] marks as errors, accumulators are left as they were
+ * */
+int reed_solomon_reconstruct_folded(reed_solomon* rs, unsigned char** shards, unsigned char* marks, unsigned char** accumulators, int block_size);
 #endif
 
@@ -0,0 +1,88 @@
+#include "AnnexB.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define ANB_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ANB_NEON
+#endif
+
+// Returns the offset of the first 00 00 XX sequence with minThirdByte <= XX <= 1.
+// Emulation prevention keeps 00 00 pairs rare inside NAL units, so we look for
+// those 16 bytes at a time and only check the third byte of each candidate.
+static int findZeroPair(const unsigned char* data, int length, int minThirdByte) {
+    int i = 0;
+
+#if defined(ANB_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+
+    // Each block reads 17 bytes and candidates need one more after that
+    for (; i + 18 <= length; i += 16) {
+        __m128i first = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&data[i]), zero);
+        __m128i second = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&data[i + 1]), zero);
+        int mask = _mm_movemask_epi8(_mm_and_si128(first, second));
+
+        while (mask != 0) {
+            int candidate = i + __builtin_ctz(mask);
+
+            if (data[candidate + 2] <= 1 && data[candidate + 2] >= minThirdByte) {
+                return candidate;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+#elif defined(ANB_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+
+    for (; i + 18 <= length; i += 16) {
+        uint8x16_t pairs = vandq_u8(vceqq_u8(vld1q_u8(&data[i]), zero),
+                                    vceqq_u8(vld1q_u8(&data[i + 1]), zero));
+        uint64x2_t lanes = vreinterpretq_u64_u8(pairs);
+
+        if ((vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) != 0) {
+            int candidate;
+
+            // NEON has no movemask, so just check this block byte by byte
+            for (candidate = i; candidate < i + 16; candidate++) {
+                if (data[candidate] == 0 && data[candidate + 1] == 0 &&
+                        data[candidate + 2] <= 1 && data[candidate + 2] >= minThirdByte) {
+                    return candidate;
+                }
+            }
+        }
+    }
+#endif
+
+    // Let memchr() skip ahead to each zero byte for the rest
+    while (i + 3 <= length) {
+        const unsigned char* zeroByte = memchr(&data[i], 0, length - 2 - i);
+        if (zeroByte == NULL) {
+            return -1;
+        }
+
+        i = (int)(zeroByte - data);
+        if (data[i + 1] != 0) {
+            i += 2;
+        }
+        else if (data[i + 2] <= 1 && data[i + 2] >= minThirdByte) {
+            return i;
+        }
+        else {
+            i++;
+        }
+    }
+
+    return -1;
+}
+
+int AnbFindStartCode(const unsigned char* data, int length) {
+    return findZeroPair(data, length, 1);
+}
+
+int AnbFindNalEnd(const unsigned char* data, int length) {
+    return findZeroPair(data, length, 0);
+}
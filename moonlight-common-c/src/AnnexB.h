@@ -0,0 +1,21 @@
+#pragma once
+
+// Annex B start code scanning shared by the depacketizer and the
+// bitstream parser. This header doesn't depend on the rest of
+// moonlight-common-c so it can be used outside of it.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns the offset of the first 00 00 01 start code prefix in the buffer
+// or -1 if there isn't one. A 4 byte start code is found at its second byte.
+int AnbFindStartCode(const unsigned char* data, int length);
+
+// Returns the offset of the first 00 00 00 or 00 00 01 sequence in the buffer,
+// which ends the NAL unit before it, or -1 if there isn't one.
+int AnbFindNalEnd(const unsigned char* data, int length);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,11 +3,13 @@
 #include "PlatformThreads.h"
 #include "LinkedBlockingQueue.h"
 #include "RtpReorderQueue.h"
+#include "BufferPool.h"
 
 static SOCKET rtpSocket = INVALID_SOCKET;
 
 static LINKED_BLOCKING_QUEUE packetQueue;
 static RTP_REORDER_QUEUE rtpReorderQueue;
+static BUFFER_POOL packetPool;
 
 static PLT_THREAD udpPingThread;
 static PLT_THREAD receiveThread;
@@ -17,9 +19,11 @@ static unsigned short lastSeq;
 
 static int receivedDataFromPeer;
 
-#define RTP_PORT 48000
+// Only touched by the receive thread once it's running
+static int decodeOnReceiveThread;
+static int averageDecodeTimeUs;
 
-#define MAX_PACKET_SIZE 1400
+#define RTP_PORT 48000
 
 // This is much larger than we should typically have buffered, but
 // it needs to be. We need a cushion in case our thread gets blocked
@@ -28,6 +32,21 @@ static int receivedDataFromPeer;
 
 #define SAMPLE_RATE 48000
 
+// Packets waiting for the decoder thread
+#define DECODER_QUEUE_BOUND 30
+
+// Enough for full reorder and decoder queues plus the packets being received and decoded
+#define AUDIO_PACKET_POOL_BUFFERS (RTPQ_DEFAULT_MAX_SIZE + DECODER_QUEUE_BOUND + 2)
+
+// Renderers with CAPABILITY_ADAPTIVE_SUBMIT are called from the receive thread
+// until decoding takes more than this share of each packet's duration on
+// average. Past that, decoding could hold up receiving, so it's moved to the
+// decoder thread for the rest of the stream.
+#define DIRECT_DECODE_BUDGET_PERCENT 25
+
+// Each decode time counts for 1/DECODE_TIME_SMOOTHING of the average
+#define DECODE_TIME_SMOOTHING 8
+
 static OPUS_MULTISTREAM_CONFIGURATION opusStereoConfig = {
     .sampleRate = SAMPLE_RATE,
     .channelCount = 2,
@@ -54,7 +73,7 @@ static OPUS_MULTISTREAM_CONFIGURATION opus51HighSurroundConfig = {
 
 typedef struct _QUEUED_AUDIO_PACKET {
     // data must remain at the front
-    char data[MAX_PACKET_SIZE];
+    char data[AUDIO_MAX_PACKET_SIZE];
 
     int size;
     union {
@@ -65,7 +84,10 @@ typedef struct _QUEUED_AUDIO_PACKET {
 
 // Initialize the audio stream
 void initializeAudioStream(void) {
-    LbqInitializeLinkedBlockingQueue(&packetQueue, 30);
+    if (BpInitializePool(&packetPool, sizeof(QUEUED_AUDIO_PACKET), AUDIO_PACKET_POOL_BUFFERS) != 0) {
+        Limelog("Audio packet pool allocation failed; using malloc()\n");
+    }
+    LbqInitializeLinkedBlockingQueue(&packetQueue, DECODER_QUEUE_BOUND);
     RtpqInitializeQueue(&rtpReorderQueue, RTPQ_DEFAULT_MAX_SIZE, RTPQ_DEFAULT_QUEUE_TIME);
     lastSeq = 0;
     receivedDataFromPeer = 0;
@@ -78,7 +100,7 @@ static void freePacketList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
         nextEntry = entry->flink;
 
         // The entry is stored within the data allocation
-        free(entry->data);
+        freeAudioPacketBuffer(entry->data);
 
         entry = nextEntry;
     }
@@ -86,8 +108,24 @@ static void freePacketList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
 
 // Tear down the audio stream once we're done with it
 void destroyAudioStream(void) {
+    unsigned int hits, misses;
+
     freePacketList(LbqDestroyLinkedBlockingQueue(&packetQueue));
     RtpqCleanupQueue(&rtpReorderQueue);
+
+    BpGetStatistics(&packetPool, &hits, &misses);
+    Limelog("Audio packet pool: %u hits, %u misses\n", hits, misses);
+    BpCleanupPool(&packetPool);
+}
+
+// Packet buffers hold a QUEUED_AUDIO_PACKET. Any malloc()ed pointer may be
+// passed to freeAudioPacketBuffer(), not just ones from the pool.
+void* allocateAudioPacketBuffer(void) {
+    return BpAllocateBuffer(&packetPool);
+}
+
+void freeAudioPacketBuffer(void* buffer) {
+    BpFreeBuffer(&packetPool, buffer);
 }
 
 static void UdpPingThreadProc(void* context) {
@@ -127,8 +165,11 @@ static int queuePacketToLbq(PQUEUED_AUDIO_PACKET* packet) {
         *packet = NULL;
     }
     else if (err == LBQ_BOUND_EXCEEDED) {
+        // Drop this packet along with the backlog
         Limelog("Audio packet queue overflow\n");
         freePacketList(LbqFlushQueueItems(&packetQueue));
+        freeAudioPacketBuffer(*packet);
+        *packet = NULL;
     }
     else if (err == LBQ_INTERRUPTED) {
         return 0;
@@ -137,19 +178,61 @@ static int queuePacketToLbq(PQUEUED_AUDIO_PACKET* packet) {
     return 1;
 }
 
-static void decodeInputData(PQUEUED_AUDIO_PACKET packet) {
+// Returns the number of packets passed to the renderer, including concealed ones
+static int decodeInputData(PQUEUED_AUDIO_PACKET packet) {
     PRTP_PACKET rtp;
+    int missingPackets;
+    int decodedPackets = 1;
 
     rtp = (PRTP_PACKET)&packet->data[0];
-    if (lastSeq != 0 && (unsigned short)(lastSeq + 1) != rtp->sequenceNumber) {
+    if (lastSeq != 0 && rtp->sequenceNumber != U16(lastSeq + 1)) {
         Limelog("Received OOS audio data (expected %d, but got %d)\n", lastSeq + 1, rtp->sequenceNumber);
 
-        AudioCallbacks.decodeAndPlaySample(NULL, 0);
+        // Let the renderer conceal each lost packet
+        missingPackets = RtpqGetLostPackets(lastSeq, rtp->sequenceNumber,
+                                            AUDIO_MAX_CONCEALED_DURATION_MS / AudioPacketDuration);
+        if (missingPackets > 0) {
+            TRACE_INSTANT("Audio packets lost", missingPackets);
+            decodedPackets += missingPackets;
+            while (missingPackets-- > 0) {
+                AudioCallbacks.decodeAndPlaySample(NULL, 0);
+            }
+        }
     }
 
     lastSeq = rtp->sequenceNumber;
 
     AudioCallbacks.decodeAndPlaySample((char*)(rtp + 1), packet->size - sizeof(*rtp));
+    return decodedPackets;
+}
+
+// Decodes a packet on the receive thread. For adaptive renderers, this also
+// hands decoding off to the decoder thread if it's getting too slow.
+static void decodeOnReceivePath(PQUEUED_AUDIO_PACKET packet) {
+    uint64_t startTimeUs;
+    int decodedPackets;
+    int decodeTimeUs;
+
+    if (AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) {
+        decodeInputData(packet);
+        return;
+    }
+
+    // A loss makes the renderer conceal each missing packet first. That's a
+    // one-off burst, so it's averaged per packet rather than counted as one
+    // slow decode.
+    startTimeUs = PltGetMicroseconds();
+    decodedPackets = decodeInputData(packet);
+    decodeTimeUs = (int)(PltGetMicroseconds() - startTimeUs) / decodedPackets;
+
+    averageDecodeTimeUs += (decodeTimeUs - averageDecodeTimeUs) / DECODE_TIME_SMOOTHING;
+    if (averageDecodeTimeUs > AudioPacketDuration * 1000 * DIRECT_DECODE_BUDGET_PERCENT / 100) {
+        // This is one-way. Everything decoded here so far happens before the
+        // first packet is queued, so the renderer never sees 2 threads at once.
+        Limelog("Audio decoding takes %d us per packet; moving it to the decoder thread\n", averageDecodeTimeUs);
+        TRACE_INSTANT("Audio decoding moved to decoder thread", averageDecodeTimeUs);
+        decodeOnReceiveThread = 0;
+    }
 }
 
 static void ReceiveThreadProc(void* context) {
@@ -172,7 +255,7 @@ static void ReceiveThreadProc(void* context) {
 
     while (!PltIsThreadInterrupted(&receiveThread)) {
         if (packet == NULL) {
-            packet = (PQUEUED_AUDIO_PACKET)malloc(sizeof(*packet));
+            packet = (PQUEUED_AUDIO_PACKET)allocateAudioPacketBuffer();
             if (packet == NULL) {
                 Limelog("Audio Receive: malloc() failed\n");
                 ListenerCallbacks.connectionTerminated(-1);
@@ -180,7 +263,7 @@ static void ReceiveThreadProc(void* context) {
             }
         }
 
-        packet->size = recvUdpSocket(rtpSocket, &packet->data[0], MAX_PACKET_SIZE, useSelect);
+        packet->size = recvUdpSocket(rtpSocket, &packet->data[0], AUDIO_MAX_PACKET_SIZE, useSelect);
         if (packet->size < 0) {
             Limelog("Audio Receive: recvUdpSocket() failed: %d\n", (int)LastSocketError());
             ListenerCallbacks.connectionTerminated(LastSocketFail());
@@ -195,13 +278,15 @@ static void ReceiveThreadProc(void* context) {
             continue;
         }
 
+        CAPTURE_DATAGRAM(CAPTURE_STREAM_AUDIO, packet->data, packet->size);
+
         if (packet->size < sizeof(RTP_PACKET)) {
             // Runt packet
             continue;
         }
 
         rtp = (PRTP_PACKET)&packet->data[0];
-        if (rtp->packetType != 97) {
+        if (rtp->packetType != AUDIO_PACKET_TYPE) {
             // Not audio
             continue;
         }
@@ -225,14 +310,14 @@ static void ReceiveThreadProc(void* context) {
 
         queueStatus = RtpqAddPacket(&rtpReorderQueue, (PRTP_PACKET)packet, &packet->q.rentry);
         if (RTPQ_HANDLE_NOW(queueStatus)) {
-            if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+            if (!decodeOnReceiveThread) {
                 if (!queuePacketToLbq(&packet)) {
                     // An exit signal was received
                     break;
                 }
             }
             else {
-                decodeInputData(packet);
+                decodeOnReceivePath(packet);
             }
         }
         else {
@@ -244,15 +329,15 @@ static void ReceiveThreadProc(void* context) {
             if (RTPQ_PACKET_READY(queueStatus)) {
                 // If packets are ready, pull them and send them to the decoder
                 while ((packet = (PQUEUED_AUDIO_PACKET)RtpqGetQueuedPacket(&rtpReorderQueue)) != NULL) {
-                    if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+                    if (!decodeOnReceiveThread) {
                         if (!queuePacketToLbq(&packet)) {
                             // An exit signal was received
                             break;
                         }
                     }
                     else {
-                        decodeInputData(packet);
-                        free(packet);
+                        decodeOnReceivePath(packet);
+                        freeAudioPacketBuffer(packet);
                     }
                 }
                 
@@ -265,7 +350,7 @@ static void ReceiveThreadProc(void* context) {
     }
     
     if (packet != NULL) {
-        free(packet);
+        freeAudioPacketBuffer(packet);
     }
 }
 
@@ -282,7 +367,7 @@ static void DecoderThreadProc(void* context) {
 
         decodeInputData(packet);
 
-        free(packet);
+        freeAudioPacketBuffer(packet);
     }
 }
 
@@ -341,6 +426,18 @@ int startAudioStream(void* audioContext, int arFlags) {
 
     chosenConfig.samplesPerFrame = 48 * AudioPacketDuration;
 
+    // A renderer that knows its decoder is slow starts out on the decoder thread
+    if (AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) {
+        decodeOnReceiveThread = 1;
+    }
+    else if (AudioCallbacks.capabilities & CAPABILITY_ADAPTIVE_SUBMIT) {
+        decodeOnReceiveThread = (AudioCallbacks.capabilities & CAPABILITY_SLOW_OPUS_DECODER) == 0;
+    }
+    else {
+        decodeOnReceiveThread = 0;
+    }
+    averageDecodeTimeUs = 0;
+
     err = AudioCallbacks.init(StreamConfig.audioConfiguration, &chosenConfig, audioContext, arFlags);
     if (err != 0) {
         return err;
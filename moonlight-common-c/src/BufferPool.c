@@ -0,0 +1,111 @@
+#include "BufferPool.h"
+
+// Keep pooled buffers aligned for the vectorized FEC kernels
+#define BUFFER_POOL_ALIGNMENT 16
+
+// If this fails, the pool is left empty and every allocation falls back to
+// malloc(), so callers may keep using it either way. An empty pool has no mutex.
+int BpInitializePool(PBUFFER_POOL pool, int bufferSize, int bufferCount) {
+    int err;
+    int i;
+
+    memset(pool, 0, sizeof(*pool));
+
+    pool->bufferSize = (bufferSize + BUFFER_POOL_ALIGNMENT - 1) & ~(BUFFER_POOL_ALIGNMENT - 1);
+
+    pool->slab = malloc((size_t)pool->bufferSize * bufferCount);
+    pool->freeList = malloc(sizeof(*pool->freeList) * bufferCount);
+    if (pool->slab == NULL || pool->freeList == NULL) {
+        err = -1;
+        goto Fail;
+    }
+
+    err = PltCreateMutex(&pool->mutex);
+    if (err != 0) {
+        goto Fail;
+    }
+
+    pool->bufferCount = bufferCount;
+
+    // Hand out buffers from the start of the slab first
+    for (i = 0; i < bufferCount; i++) {
+        pool->freeList[i] = &pool->slab[(size_t)(bufferCount - i - 1) * pool->bufferSize];
+    }
+    pool->freeCount = bufferCount;
+
+    return 0;
+
+Fail:
+    free(pool->slab);
+    free(pool->freeList);
+    pool->slab = NULL;
+    pool->freeList = NULL;
+    return err;
+}
+
+void BpCleanupPool(PBUFFER_POOL pool) {
+    // Every pooled buffer should have been returned by now
+    LC_ASSERT(pool->freeCount == pool->bufferCount);
+
+    if (pool->slab != NULL) {
+        PltDeleteMutex(&pool->mutex);
+    }
+    free(pool->slab);
+    free(pool->freeList);
+    pool->slab = NULL;
+    pool->freeList = NULL;
+}
+
+// Returns a buffer of at least bufferSize bytes. If the pool is exhausted,
+// this falls back to malloc() so callers never need to handle that case.
+void* BpAllocateBuffer(PBUFFER_POOL pool) {
+    void* buffer;
+
+    if (pool->slab == NULL) {
+        return malloc(pool->bufferSize);
+    }
+
+    PltLockMutex(&pool->mutex);
+    if (pool->freeCount > 0) {
+        buffer = pool->freeList[--pool->freeCount];
+        pool->hits++;
+        PltUnlockMutex(&pool->mutex);
+        return buffer;
+    }
+    pool->misses++;
+    PltUnlockMutex(&pool->mutex);
+
+    return malloc(pool->bufferSize);
+}
+
+// Accepts pooled buffers as well as any other malloc()ed pointer, so owners
+// of mixed buffer chains can free everything through the pool.
+void BpFreeBuffer(PBUFFER_POOL pool, void* buffer) {
+    char* ptr = (char*)buffer;
+
+    if (ptr >= pool->slab && ptr < pool->slab + (size_t)pool->bufferSize * pool->bufferCount) {
+        LC_ASSERT((ptr - pool->slab) % pool->bufferSize == 0);
+
+        PltLockMutex(&pool->mutex);
+        LC_ASSERT(pool->freeCount < pool->bufferCount);
+        pool->freeList[pool->freeCount++] = buffer;
+        PltUnlockMutex(&pool->mutex);
+    }
+    else {
+        free(buffer);
+    }
+}
+
+// Returns how many allocations were served from the pool and how many fell
+// back to malloc() because it was exhausted
+void BpGetStatistics(PBUFFER_POOL pool, unsigned int* hits, unsigned int* misses) {
+    if (pool->slab == NULL) {
+        *hits = *misses = 0;
+        return;
+    }
+
+    PltLockMutex(&pool->mutex);
+    *hits = pool->hits;
+    *misses = pool->misses;
+    PltUnlockMutex(&pool->mutex);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Platform.h"
+#include "PlatformThreads.h"
+
+typedef struct _BUFFER_POOL {
+    PLT_MUTEX mutex;
+
+    // All pooled buffers are carved out of this single allocation
+    char* slab;
+    int bufferSize;
+    int bufferCount;
+
+    // Stack of free buffers within the slab
+    void** freeList;
+    int freeCount;
+
+    // Allocations served from the slab vs. ones that fell back to malloc()
+    unsigned int hits;
+    unsigned int misses;
+} BUFFER_POOL, *PBUFFER_POOL;
+
+int BpInitializePool(PBUFFER_POOL pool, int bufferSize, int bufferCount);
+void BpCleanupPool(PBUFFER_POOL pool);
+void* BpAllocateBuffer(PBUFFER_POOL pool);
+void BpFreeBuffer(PBUFFER_POOL pool, void* buffer);
+void BpGetStatistics(PBUFFER_POOL pool, unsigned int* hits, unsigned int* misses);
@@ -0,0 +1,207 @@
+#include "Limelight-internal.h"
+#include "Capture.h"
+
+#if !defined(LC_WINDOWS) && !defined(__vita__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#define CAPTURE_SUPPORTED 1
+#endif
+
+volatile int CaptureActive;
+
+static char* captureFileName;
+
+#ifdef CAPTURE_SUPPORTED
+// The video and audio receive threads both record, so appending is
+// serialized. Starting and stopping happen while neither thread is running.
+static PLT_MUTEX captureLock;
+static int captureFd = -1;
+static char* chunk;
+static unsigned int chunkIndex;
+static unsigned int chunkOffset;
+static uint64_t startTimeNs;
+
+// Grows the file by a chunk and maps it in place of the current one
+static int mapNextChunk(void) {
+    void* mapping;
+    int flags = MAP_SHARED;
+
+    if (chunk != NULL) {
+        munmap(chunk, CAPTURE_CHUNK_SIZE);
+        chunk = NULL;
+        chunkIndex++;
+    }
+
+    if (ftruncate(captureFd, (off_t)(chunkIndex + 1) * CAPTURE_CHUNK_SIZE) < 0) {
+        return -1;
+    }
+
+#ifdef MAP_POPULATE
+    // Fault the pages in now rather than one at a time on the receive thread
+    flags |= MAP_POPULATE;
+#endif
+
+    mapping = mmap(NULL, CAPTURE_CHUNK_SIZE, PROT_READ | PROT_WRITE, flags,
+                   captureFd, (off_t)chunkIndex * CAPTURE_CHUNK_SIZE);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+
+    chunk = (char*)mapping;
+    chunkOffset = 0;
+    return 0;
+}
+
+int CapStartCapture(void) {
+    PCAPTURE_FILE_HEADER header;
+    int err;
+
+    if (captureFileName == NULL) {
+        return 0;
+    }
+
+    captureFd = open(captureFileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (captureFd < 0) {
+        Limelog("Unable to open capture file %s\n", captureFileName);
+        return -1;
+    }
+
+    chunk = NULL;
+    chunkIndex = 0;
+    if (mapNextChunk() != 0) {
+        Limelog("Unable to map capture file %s\n", captureFileName);
+        close(captureFd);
+        captureFd = -1;
+        return -1;
+    }
+
+    err = PltCreateMutex(&captureLock);
+    if (err != 0) {
+        munmap(chunk, CAPTURE_CHUNK_SIZE);
+        chunk = NULL;
+        close(captureFd);
+        captureFd = -1;
+        return err;
+    }
+
+    header = (PCAPTURE_FILE_HEADER)chunk;
+    memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+    header->version = CAPTURE_VERSION;
+    header->headerSize = (sizeof(*header) + CAPTURE_RECORD_ALIGNMENT - 1) & ~(CAPTURE_RECORD_ALIGNMENT - 1);
+    header->chunkSize = CAPTURE_CHUNK_SIZE;
+    header->packetSize = StreamConfig.packetSize;
+    header->videoFormat = NegotiatedVideoFormat;
+    header->width = StreamConfig.width;
+    header->height = StreamConfig.height;
+    header->fps = StreamConfig.fps;
+    header->audioConfiguration = StreamConfig.audioConfiguration;
+    header->audioPacketDuration = AudioPacketDuration;
+    memcpy(header->appVersionQuad, AppVersionQuad, sizeof(header->appVersionQuad));
+    chunkOffset = header->headerSize;
+
+    startTimeNs = PltGetNanoseconds();
+    CaptureActive = 1;
+    return 0;
+}
+
+void CapStopCapture(void) {
+    if (captureFd < 0) {
+        return;
+    }
+
+    CaptureActive = 0;
+
+    // Drop the unused end of the last chunk
+    if (chunk != NULL) {
+        munmap(chunk, CAPTURE_CHUNK_SIZE);
+        chunk = NULL;
+    }
+    if (ftruncate(captureFd, (off_t)chunkIndex * CAPTURE_CHUNK_SIZE + chunkOffset) < 0) {
+        Limelog("Unable to truncate capture file\n");
+    }
+    close(captureFd);
+    captureFd = -1;
+
+    PltDeleteMutex(&captureLock);
+}
+
+void CapRecordDatagram(int stream, const char* data, int length) {
+    PCAPTURE_RECORD_HEADER record;
+    unsigned int recordSize = (unsigned int)CAPTURE_RECORD_SIZE(length);
+    uint64_t now = PltGetNanoseconds();
+
+    LC_ASSERT(recordSize <= CAPTURE_CHUNK_SIZE);
+
+    PltLockMutex(&captureLock);
+
+    // Give up for the rest of the session if we can't get more space
+    if (chunk == NULL) {
+        PltUnlockMutex(&captureLock);
+        return;
+    }
+
+    if (recordSize > CAPTURE_CHUNK_SIZE - chunkOffset) {
+        if (CAPTURE_CHUNK_SIZE - chunkOffset >= sizeof(CAPTURE_RECORD_HEADER)) {
+            record = (PCAPTURE_RECORD_HEADER)&chunk[chunkOffset];
+            record->timeNs = 0;
+            record->length = CAPTURE_CHUNK_SIZE - chunkOffset - sizeof(CAPTURE_RECORD_HEADER);
+            record->stream = CAPTURE_STREAM_PADDING;
+            record->reserved = 0;
+        }
+
+        if (mapNextChunk() != 0) {
+            Limelog("Unable to grow capture file; recording stopped\n");
+            chunk = NULL;
+            PltUnlockMutex(&captureLock);
+            return;
+        }
+    }
+
+    record = (PCAPTURE_RECORD_HEADER)&chunk[chunkOffset];
+    record->timeNs = now - startTimeNs;
+    record->length = (uint32_t)length;
+    record->stream = (uint16_t)stream;
+    record->reserved = 0;
+    memcpy(record + 1, data, length);
+    chunkOffset += recordSize;
+
+    PltUnlockMutex(&captureLock);
+}
+#else
+int CapStartCapture(void) {
+    if (captureFileName != NULL) {
+        Limelog("Capture isn't supported on this platform\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void CapStopCapture(void) {
+}
+
+void CapRecordDatagram(int stream, const char* data, int length) {
+}
+#endif
+
+int LiSetCaptureFile(const char* fileName) {
+#ifndef CAPTURE_SUPPORTED
+    if (fileName != NULL) {
+        return -1;
+    }
+#endif
+
+    if (captureFileName != NULL) {
+        free(captureFileName);
+        captureFileName = NULL;
+    }
+
+    if (fileName != NULL) {
+        captureFileName = strdup(fileName);
+        if (captureFileName == NULL) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
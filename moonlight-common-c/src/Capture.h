@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Platform.h"
+
+// A capture file starts with a CAPTURE_FILE_HEADER, followed by records that
+// each hold one datagram exactly as it came off the socket. The file is
+// written through fixed size memory mapped chunks. Records never straddle a
+// chunk boundary; the space left at the end of a chunk is either too small
+// for a record header or is covered by a CAPTURE_STREAM_PADDING record.
+//
+// All fields are in the byte order of the machine that made the capture.
+#define CAPTURE_MAGIC "MLCAPTUR"
+#define CAPTURE_VERSION 1
+#define CAPTURE_CHUNK_SIZE (8 * 1024 * 1024)
+
+// Records start on 8 byte boundaries
+#define CAPTURE_RECORD_ALIGNMENT 8
+
+// A zeroed record header marks the end of the capture. The file is truncated
+// after the last record when the capture is stopped, so this is only seen if
+// the process died while recording.
+#define CAPTURE_STREAM_END 0
+#define CAPTURE_STREAM_VIDEO 1
+#define CAPTURE_STREAM_AUDIO 2
+#define CAPTURE_STREAM_PADDING 0xFF
+
+typedef struct _CAPTURE_FILE_HEADER {
+    char magic[8];
+    uint32_t version;
+
+    // Offset of the first record
+    uint32_t headerSize;
+    uint32_t chunkSize;
+
+    // What the depacketizer needs to know to replay the stream
+    int32_t packetSize;
+    int32_t videoFormat;
+    int32_t width;
+    int32_t height;
+    int32_t fps;
+    int32_t audioConfiguration;
+    int32_t audioPacketDuration;
+    int32_t appVersionQuad[4];
+} CAPTURE_FILE_HEADER, *PCAPTURE_FILE_HEADER;
+
+typedef struct _CAPTURE_RECORD_HEADER {
+    // Receive time relative to the start of the capture
+    uint64_t timeNs;
+
+    // Length of the datagram following this header. Padding records have the
+    // length of the padding instead.
+    uint32_t length;
+
+    uint16_t stream;
+    uint16_t reserved;
+} CAPTURE_RECORD_HEADER, *PCAPTURE_RECORD_HEADER;
+
+#define CAPTURE_RECORD_SIZE(length) \
+    ((sizeof(CAPTURE_RECORD_HEADER) + (length) + CAPTURE_RECORD_ALIGNMENT - 1) & ~(CAPTURE_RECORD_ALIGNMENT - 1))
+
+extern volatile int CaptureActive;
+
+// Starts recording to the file set by LiSetCaptureFile(), if any. The stream
+// configuration must have been negotiated already.
+int CapStartCapture(void);
+void CapStopCapture(void);
+
+void CapRecordDatagram(int stream, const char* data, int length);
+
+// Only costs a load and a branch while nothing is being recorded
+#define CAPTURE_DATAGRAM(stream, data, length) \
+    do { \
+        if (CaptureActive) { \
+            CapRecordDatagram(stream, data, length); \
+        } \
+    } while (0)
@@ -77,6 +77,10 @@ void LiStopConnection(void) {
         stage--;
         Limelog("done\n");
     }
+
+    // Both receive threads are stopped by now
+    CapStopCapture();
+
     if (stage == STAGE_CONTROL_STREAM_START) {
         Limelog("Stopping control stream...");
         stopControlStream();
@@ -316,6 +320,11 @@ int LiStartConnection(PSERVER_INFORMATION serverInfo, PSTREAM_CONFIGURATION stre
     ListenerCallbacks.stageComplete(STAGE_CONTROL_STREAM_START);
     Limelog("done\n");
 
+    // Recording is best effort, so the stream goes on without it
+    if (CapStartCapture() != 0) {
+        Limelog("Unable to start capture\n");
+    }
+
     Limelog("Starting video stream...");
     ListenerCallbacks.stageStarting(STAGE_VIDEO_STREAM_START);
     err = startVideoStream(renderContext, drFlags);
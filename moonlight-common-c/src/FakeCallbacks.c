@@ -70,6 +70,10 @@ void fixupMissingCallbacks(PDECODER_RENDERER_CALLBACKS* drCallbacks, PAUDIO_REND
         if ((*drCallbacks)->submitDecodeUnit == NULL) {
             (*drCallbacks)->submitDecodeUnit = fakeDrSubmitDecodeUnit;
         }
+        if ((*drCallbacks)->submitSliceUnit == NULL) {
+            // Slices can't be submitted without somewhere to send them
+            (*drCallbacks)->capabilities &= ~CAPABILITY_SLICE_SUBMIT;
+        }
     }
 
     if (*arCallbacks == NULL) {
@@ -6,6 +6,8 @@
 #include "PlatformThreads.h"
 #include "Video.h"
 #include "RtpFecQueue.h"
+#include "Trace.h"
+#include "Capture.h"
 
 #include <enet/enet.h>
 
@@ -39,6 +41,15 @@ extern int AudioPacketDuration;
 
 #define UDP_RECV_POLL_TIMEOUT_MS 100
 
+// Audio datagrams are RTP packets of this type and at most this size
+#define AUDIO_PACKET_TYPE 97
+#define AUDIO_MAX_PACKET_SIZE 1400
+
+// Longest gap that the audio renderer is asked to conceal. Past this, the
+// stream was interrupted rather than lossy and the renderer's buffer has run
+// dry anyway, so there's nothing to smooth over.
+#define AUDIO_MAX_CONCEALED_DURATION_MS 100
+
 // At this value or above, we will request high quality audio unless CAPABILITY_SLOW_OPUS_DECODER
 // is set on the audio renderer.
 #define HIGH_AUDIO_BITRATE_THRESHOLD 15000
@@ -72,16 +83,22 @@ int performRtspHandshake(void);
 void initializeVideoDepacketizer(int pktSize);
 void destroyVideoDepacketizer(void);
 void queueRtpPacket(PRTPFEC_QUEUE_ENTRY queueEntry);
+void queueBorrowedRtpPacket(PRTPFEC_QUEUE_ENTRY queueEntry);
+void abortRtpFrame(void);
 void stopVideoDepacketizer(void);
 void requestDecoderRefresh(void);
 
 void initializeVideoStream(void);
 void destroyVideoStream(void);
+void* allocateVideoPacketBuffer(void);
+void freeVideoPacketBuffer(void* buffer);
 int startVideoStream(void* rendererContext, int drFlags);
 void stopVideoStream(void);
 
 void initializeAudioStream(void);
 void destroyAudioStream(void);
+void* allocateAudioPacketBuffer(void);
+void freeAudioPacketBuffer(void* buffer);
 int startAudioStream(void* audioContext, int arFlags);
 void stopAudioStream(void);
 
@@ -145,6 +145,13 @@ typedef struct _DECODE_UNIT {
     // long prior to display.
     unsigned int presentationTimeMs;
 
+    // Time when the FEC queue finished with the last packet of this decode unit and
+    // when the depacketizer queued it for the decoder. These share the epoch of
+    // receiveTimeMs, so together they split receive latency into network, FEC and
+    // decode queue stages.
+    unsigned long long fecCompleteTimeMs;
+    unsigned long long enqueueTimeMs;
+
     // Length of the entire buffer chain in bytes
     int fullLength;
 
@@ -205,6 +212,31 @@ typedef struct _DECODE_UNIT {
 // number of slices per frame. This capability is only valid on video renderers.
 #define CAPABILITY_SLICES_PER_FRAME(x) (((unsigned char)(x)) << 24)
 
+// If set in the video renderer capabilities field, this flag specifies that the renderer
+// can start decoding a P-frame before all of it has arrived. Each slice is passed to the
+// submitSliceUnit callback as soon as its packets are contiguous, instead of waiting for
+// the whole frame. IDR frames are still submitted whole through submitDecodeUnit. This
+// should be combined with CAPABILITY_SLICES_PER_FRAME() and is only valid on video renderers.
+#define CAPABILITY_SLICE_SUBMIT 0x20
+
+// If set in the video renderer capabilities field, this flag specifies that the renderer
+// wants each decode unit assembled into a single contiguous buffer. The buffer list is
+// still provided (with codec configuration NALUs as separate entries on IDR frames), but
+// the entries point into one allocation in order, so bufferList->data holds all fullLength
+// bytes of the decode unit and can be passed to the decoder without copying. The data is
+// only valid until the submit callback returns, unless the renderer keeps it by returning
+// DR_RETAIN_BUFFER. This flag is only valid on video renderers.
+#define CAPABILITY_CONTIGUOUS_DECODE_UNIT 0x40
+
+// If set in the audio renderer capabilities field, this flag will cause audio data to be
+// submitted directly from the receive thread while decoding keeps up, like CAPABILITY_DIRECT_SUBMIT.
+// Once decoding takes more than a quarter of each packet's duration on average, it moves to a
+// separate decoder thread for the rest of the stream. Combined with CAPABILITY_SLOW_OPUS_DECODER,
+// decoding starts out on the decoder thread. The renderer is never called from both threads at
+// once, but it must not block. This flag is ignored if CAPABILITY_DIRECT_SUBMIT is also set and
+// is only valid on audio renderers.
+#define CAPABILITY_ADAPTIVE_SUBMIT 0x80
+
 // This callback is invoked to provide details about the video stream and allow configuration of the decoder.
 // Returns 0 on success, non-zero on failure.
 typedef int(*DecoderRendererSetup)(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags);
@@ -224,8 +256,27 @@ typedef void(*DecoderRendererCleanup)(void);
 // it must return DR_NEED_IDR to generate a keyframe.
 #define DR_OK 0
 #define DR_NEED_IDR -1
+
+// If CAPABILITY_CONTIGUOUS_DECODE_UNIT is set, the decoder may return DR_RETAIN_BUFFER
+// instead of DR_OK to keep the decode unit's buffer list after the callback returns, so
+// the data doesn't have to be copied. The decode unit itself is still freed, so the
+// decoder must save its bufferList and pass it to LiReleaseDecodeUnitBuffer() once
+// it's done with it. Every retained buffer must be released before the cleanup
+// callback returns.
+#define DR_RETAIN_BUFFER 1
 typedef int(*DecoderRendererSubmitDecodeUnit)(PDECODE_UNIT decodeUnit);
 
+// This callback provides one or more complete slice NALUs of a P-frame to the decoder
+// when CAPABILITY_SLICE_SUBMIT is set. The decode unit describes just these slices
+// (fullLength is the length of this unit, not the frame). The first unit of each frame
+// has SLICE_FLAG_FIRST set and the final unit has SLICE_FLAG_LAST set. If a frame is lost
+// after some of its slices were submitted, no SLICE_FLAG_LAST unit will arrive for it and
+// the next SLICE_FLAG_FIRST unit (or whole decode unit) begins a new frame. Return values
+// are the same as DecoderRendererSubmitDecodeUnit.
+#define SLICE_FLAG_FIRST 0x1
+#define SLICE_FLAG_LAST  0x2
+typedef int(*DecoderRendererSubmitSliceUnit)(PDECODE_UNIT sliceUnit, int sliceFlags);
+
 typedef struct _DECODER_RENDERER_CALLBACKS {
     DecoderRendererSetup setup;
     DecoderRendererStart start;
@@ -233,6 +284,7 @@ typedef struct _DECODER_RENDERER_CALLBACKS {
     DecoderRendererCleanup cleanup;
     DecoderRendererSubmitDecodeUnit submitDecodeUnit;
     int capabilities;
+    DecoderRendererSubmitSliceUnit submitSliceUnit;
 } DECODER_RENDERER_CALLBACKS, *PDECODER_RENDERER_CALLBACKS;
 
 // Use this function to zero the video callbacks when allocated on the stack or heap
@@ -276,6 +328,9 @@ typedef void(*AudioRendererStop)(void);
 typedef void(*AudioRendererCleanup)(void);
 
 // This callback provides Opus audio data to be decoded and played. sampleLength is in bytes.
+// It's called with NULL sampleData once for each packet that was lost. The next call with data
+// is for the packet that followed the lost ones, so a renderer that defers concealing the last
+// lost packet can recover it from that packet's in-band FEC data instead.
 typedef void(*AudioRendererDecodeAndPlaySample)(char* sampleData, int sampleLength);
 
 typedef struct _AUDIO_RENDERER_CALLBACKS {
@@ -474,6 +529,10 @@ uint64_t LiGetMillis(void);
 // network byte order.
 int LiFindExternalAddressIP4(const char* stunServer, unsigned short stunPort, unsigned int* wanAddr);
 
+// Frees the buffer list of a decode unit that the decoder kept by returning
+// DR_RETAIN_BUFFER. This may be called from any thread.
+void LiReleaseDecodeUnitBuffer(PLENTRY bufferList);
+
 // Returns the number of queued video frames ready for delivery. Only relevant
 // if CAPABILITY_DIRECT_SUBMIT is not set for the video renderer.
 int LiGetPendingVideoFrames(void);
@@ -488,6 +547,86 @@ int LiGetPendingAudioFrames(void);
 // negotiated audio frame duration.
 int LiGetPendingAudioDuration(void);
 
+// Records every video and audio datagram received by the following connections
+// to fileName, overwriting it each time. Pass NULL to stop recording. The capture
+// can be fed back through the depacketizer offline with tools/replay. Returns 0
+// on success or -1 if capture isn't supported on this platform. This must not be
+// called while a connection is active.
+int LiSetCaptureFile(const char* fileName);
+
+// Number of buckets in the FEC reconstruction time histogram. Bucket 0 counts
+// reconstructions that took less than 1 microsecond, bucket i counts those that
+// took [2^(i-1), 2^i) microseconds and the last bucket counts everything slower.
+#define FEC_RECONSTRUCTION_TIME_BUCKETS 16
+
+typedef struct _FEC_STATISTICS {
+    // Frames that arrived with all of their data packets
+    unsigned int framesReceivedClean;
+
+    // Frames that were completed by FEC recovery
+    unsigned int framesRecovered;
+
+    // Data packets that were rebuilt from parity packets
+    unsigned int shardsRecovered;
+
+    // Frames that were dropped because too few packets arrived in time
+    unsigned int framesUnrecoverable;
+
+    // Parity packets that arrived but weren't needed to complete their frame
+    unsigned int parityPacketsWasted;
+
+    // Time spent reconstructing each recovered frame
+    unsigned int reconstructionTimeHistogram[FEC_RECONSTRUCTION_TIME_BUCKETS];
+
+    // Video packet buffers that came from the preallocated pool, and ones
+    // that had to be allocated because the pool was empty
+    unsigned int packetPoolHits;
+    unsigned int packetPoolMisses;
+} FEC_STATISTICS, *PFEC_STATISTICS;
+
+// Copies the FEC counters for the current (or last) streaming session. The
+// counters are reset when the video stream is initialized. This may be called
+// from any thread, but counters may be updated while they're being copied.
+void LiGetFecStatistics(PFEC_STATISTICS stats);
+
+// Event tracing. While enabled, each thread records events into its own ring
+// of the last LI_TRACE_RING_SIZE events without taking any locks. Tracing is
+// off by default and the recording functions return immediately until it's
+// enabled. Event names must be string literals (or otherwise outlive the trace)
+// since only the pointer is recorded.
+#define LI_TRACE_RING_SIZE 8192
+
+// Enabling the tracer discards everything recorded so far. Disabling it keeps
+// the recorded events around for LiTraceDumpJson().
+void LiTraceSetEnabled(int enabled);
+int LiTraceIsEnabled(void);
+
+// Names the calling thread in the trace. Threads created by this library are
+// named automatically.
+void LiTraceSetThreadName(const char* name);
+
+// Marks the start and end of a span on the calling thread. Spans on a thread
+// must nest properly.
+void LiTraceBegin(const char* name, long long arg);
+void LiTraceEnd(const char* name, long long arg);
+
+// Spans that may start and end on different threads or overlap with others.
+// The begin and end of each span are matched by name and id.
+void LiTraceAsyncBegin(const char* name, long long id);
+void LiTraceAsyncEnd(const char* name, long long id);
+
+// Records a single point in time
+void LiTraceInstant(const char* name, long long arg);
+
+// Records the current value of a counter
+void LiTraceCounter(const char* name, long long value);
+
+// Returns the recorded events in the Chrome trace event JSON format, which can be
+// loaded into chrome://tracing or Perfetto. The string must be freed with free().
+// Returns NULL if out of memory. Events recorded while this is running may be
+// missing or garbled, so tracing should be disabled first.
+char* LiTraceDumpJson(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -90,6 +90,8 @@ void* ThreadProc(void* context) {
     pthread_setname_np(pthread_self(), ctx->name);
 #endif
 
+    LiTraceSetThreadName(ctx->name);
+
     ctx->entry(ctx->context);
 
 #if defined(__vita__)
@@ -373,6 +375,42 @@ uint64_t PltGetMillis(void) {
 #endif
 }
 
+uint64_t PltGetMicroseconds(void) {
+#if defined(LC_WINDOWS)
+    LARGE_INTEGER counter, frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (counter.QuadPart / frequency.QuadPart) * 1000000 +
+        (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#elif HAVE_CLOCK_GETTIME
+    struct timespec tv;
+    
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    
+    return ((uint64_t)tv.tv_sec * 1000000) + (tv.tv_nsec / 1000);
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return ((uint64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+#endif
+}
+
+uint64_t PltGetNanoseconds(void) {
+#if HAVE_CLOCK_GETTIME && !defined(LC_WINDOWS)
+    struct timespec tv;
+
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+
+    return ((uint64_t)tv.tv_sec * 1000000000) + tv.tv_nsec;
+#else
+    return PltGetMicroseconds() * 1000;
+#endif
+}
+
 int initializePlatform(void) {
     int err;
 
@@ -65,3 +65,5 @@ int initializePlatform(void);
 void cleanupPlatform(void);
 
 uint64_t PltGetMillis(void);
+uint64_t PltGetMicroseconds(void);
+uint64_t PltGetNanoseconds(void);
@@ -2,143 +2,303 @@
 #include "RtpFecQueue.h"
 #include "rs.h"
 
-void RtpfInitializeQueue(PRTP_FEC_QUEUE queue) {
+// How far ahead of the first missing packet in a frame a packet can arrive
+// before we stop treating the gap as reordering and prepare to recover it
+#define RTPF_REORDER_TOLERANCE 8
+
+// How long a completed frame waits on an earlier frame that we haven't seen
+// any packets for before giving up on the earlier frame
+#define RTPF_MISSING_FRAME_WAIT_MS 5
+
+void RtpfInitializeQueue(PRTP_FEC_QUEUE queue, int frameWindow, int earlySubmit) {
     reed_solomon_init();
     memset(queue, 0, sizeof(*queue));
-    
-    queue->currentFrameNumber = UINT16_MAX;
+
+    if (frameWindow < 1) {
+        frameWindow = 1;
+    }
+    else if (frameWindow > RTPF_MAX_FRAME_WINDOW) {
+        frameWindow = RTPF_MAX_FRAME_WINDOW;
+    }
+    queue->frameWindow = frameWindow;
+    queue->earlySubmit = earlySubmit;
+}
+
+// Frees any packets left in the ring
+static void purgeRing(PRTPF_FRAME_STATE frame) {
+    int i;
+
+    for (i = 0; i < frame->bufferRingSize && frame->bufferSize > 0; i++) {
+        if (frame->bufferRing[i] != NULL) {
+            freeVideoPacketBuffer(frame->bufferRing[i]->packet);
+            frame->bufferRing[i] = NULL;
+            frame->bufferSize--;
+        }
+    }
+
+    LC_ASSERT(frame->bufferSize == 0);
+}
+
+// Makes sure the ring can hold the given number of packets. The ring must be empty.
+static int growRing(PRTPF_FRAME_STATE frame, int packets) {
+    PRTPFEC_QUEUE_ENTRY* ring;
+    int size;
+
+    LC_ASSERT(frame->bufferSize == 0);
+
+    if (packets <= frame->bufferRingSize) {
+        return 0;
+    }
+
+    size = frame->bufferRingSize != 0 ? frame->bufferRingSize : 64;
+    while (size < packets) {
+        size *= 2;
+    }
+
+    ring = calloc(size, sizeof(*ring));
+    if (ring == NULL) {
+        return -1;
+    }
+
+    free(frame->bufferRing);
+    frame->bufferRing = ring;
+    frame->bufferRingSize = size;
+    return 0;
 }
 
 void RtpfCleanupQueue(PRTP_FEC_QUEUE queue) {
-    while (queue->bufferHead != NULL) {
-        PRTPFEC_QUEUE_ENTRY entry = queue->bufferHead;
-        queue->bufferHead = entry->next;
-        free(entry->packet);
+    int i;
+
+    for (i = 0; i < RTPF_MAX_FRAME_WINDOW; i++) {
+        PRTPF_FRAME_STATE frame = &queue->frames[i];
+
+        purgeRing(frame);
+        free(frame->bufferRing);
+        frame->bufferRing = NULL;
+        frame->bufferRingSize = 0;
+
+        free(frame->fecAccumulatorBuffer);
+        frame->fecAccumulatorBuffer = NULL;
+        frame->fecAccumulatorBufferSize = 0;
+
+        frame->active = 0;
+    }
+    queue->activeFrames = 0;
+
+    for (i = 0; i < RTPF_RS_CACHE_SIZE; i++) {
+        reed_solomon_release(queue->rsCache[i].rs);
+        queue->rsCache[i].rs = NULL;
     }
 }
 
+// Returns a cached Reed-Solomon coder for this frame geometry, creating one
+// (and evicting the least recently used coder) if we haven't seen it before.
+// The coder stays owned by the cache.
+static reed_solomon* getReedSolomon(PRTP_FEC_QUEUE queue, int dataShards, int parityShards) {
+    PRTPF_RS_CACHE_ENTRY victim = &queue->rsCache[0];
+    int i;
+
+    for (i = 0; i < RTPF_RS_CACHE_SIZE; i++) {
+        PRTPF_RS_CACHE_ENTRY cacheEntry = &queue->rsCache[i];
+
+        if (cacheEntry->rs != NULL &&
+                cacheEntry->dataShards == dataShards &&
+                cacheEntry->parityShards == parityShards) {
+            cacheEntry->lastUsed = ++queue->rsCacheClock;
+            return cacheEntry->rs;
+        }
+
+        if (victim->rs != NULL && (cacheEntry->rs == NULL || cacheEntry->lastUsed < victim->lastUsed)) {
+            victim = cacheEntry;
+        }
+    }
+
+    reed_solomon* rs = reed_solomon_new(dataShards, parityShards);
+    if (rs == NULL) {
+        return NULL;
+    }
+
+    reed_solomon_release(victim->rs);
+    victim->rs = rs;
+    victim->dataShards = dataShards;
+    victim->parityShards = parityShards;
+    victim->lastUsed = ++queue->rsCacheClock;
+
+    return rs;
+}
+
 // newEntry is contained within the packet buffer so we free the whole entry by freeing entry->packet
-static int queuePacket(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY newEntry, int head, PRTP_PACKET packet, int length, int isParity) {
-    PRTPFEC_QUEUE_ENTRY entry;
-    
-    LC_ASSERT(!isBefore16(packet->sequenceNumber, queue->nextContiguousSequenceNumber));
+static int queuePacket(PRTPF_FRAME_STATE frame, PRTPFEC_QUEUE_ENTRY newEntry, PRTP_PACKET packet, int length, int isParity) {
+    int index = U16(packet->sequenceNumber - frame->bufferLowestSequenceNumber);
+
+    LC_ASSERT(!isBefore16(packet->sequenceNumber, frame->nextContiguousSequenceNumber));
 
-    // If the packet is in order, we can take the fast path and avoid having
-    // to loop through the whole list. If we get an out of order or missing
-    // packet, the fast path will stop working and we'll use the loop instead.
-    if (packet->sequenceNumber == queue->nextContiguousSequenceNumber) {
-        queue->nextContiguousSequenceNumber = U16(packet->sequenceNumber + 1);
+    if (index >= frame->bufferRingSize) {
+        // Bogus FEC info or we couldn't grow the ring for this frame
+        return 0;
     }
-    else {
-        // Check for duplicates
-        entry = queue->bufferHead;
-        while (entry != NULL) {
-            if (entry->packet->sequenceNumber == packet->sequenceNumber) {
-                return 0;
-            }
 
-            entry = entry->next;
-        }
+    // Check for duplicates
+    if (frame->bufferRing[index] != NULL) {
+        return 0;
     }
 
     newEntry->packet = packet;
     newEntry->length = length;
     newEntry->isParity = isParity;
-    newEntry->prev = NULL;
-    newEntry->next = NULL;
 
     // 90 KHz video clock
     newEntry->presentationTimeMs = packet->timestamp / 90;
 
-    if (queue->bufferHead == NULL) {
-        LC_ASSERT(queue->bufferSize == 0);
-        queue->bufferHead = queue->bufferTail = newEntry;
+    frame->bufferRing[index] = newEntry;
+    frame->bufferSize++;
+
+    // Move past this packet and any reordered ones that were waiting behind it
+    if (packet->sequenceNumber == frame->nextContiguousSequenceNumber) {
+        do {
+            frame->nextContiguousSequenceNumber = U16(frame->nextContiguousSequenceNumber + 1);
+            index++;
+        } while (index < frame->bufferRingSize && frame->bufferRing[index] != NULL);
     }
-    else if (head) {
-        LC_ASSERT(queue->bufferSize > 0);
-        PRTPFEC_QUEUE_ENTRY oldHead = queue->bufferHead;
-        newEntry->next = oldHead;
-        LC_ASSERT(oldHead->prev == NULL);
-        oldHead->prev = newEntry;
-        queue->bufferHead = newEntry;
+
+    return 1;
+}
+
+// Folds a received data packet into the parity accumulators
+static void foldDataPacket(PRTPF_FRAME_STATE frame, reed_solomon* rs, PRTPFEC_QUEUE_ENTRY entry) {
+    int receiveSize = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
+    int index = U16(entry->packet->sequenceNumber - frame->bufferLowestSequenceNumber);
+
+    // FEC is computed over zero-padded packets
+    if (entry->length < receiveSize) {
+        memset(&((unsigned char*)entry->packet)[entry->length], 0, receiveSize - entry->length);
     }
-    else {
-        LC_ASSERT(queue->bufferSize > 0);
-        PRTPFEC_QUEUE_ENTRY oldTail = queue->bufferTail;
-        newEntry->prev = oldTail;
-        LC_ASSERT(oldTail->next == NULL);
-        oldTail->next = newEntry;
-        queue->bufferTail = newEntry;
+
+    reed_solomon_fold_shard(rs, frame->fecAccumulators, index, (unsigned char*)entry->packet, receiveSize);
+}
+
+// Switches the current frame to progressive recovery and catches up on the data
+// packets we've already received. Returns 0 on success.
+static int startProgressiveRecovery(PRTP_FEC_QUEUE queue, PRTPF_FRAME_STATE frame) {
+    int receiveSize = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
+    int accumulatorSize = frame->bufferParityPackets * receiveSize;
+    PRTPFEC_QUEUE_ENTRY entry;
+    reed_solomon* rs;
+    int i;
+
+    rs = getReedSolomon(queue, frame->bufferDataPackets, frame->bufferParityPackets);
+    if (rs == NULL) {
+        return -1;
     }
-    queue->bufferSize++;
 
-    return 1;
+    if (frame->fecAccumulatorBufferSize < accumulatorSize) {
+        unsigned char* buffer = malloc(accumulatorSize);
+        if (buffer == NULL) {
+            return -1;
+        }
+
+        free(frame->fecAccumulatorBuffer);
+        frame->fecAccumulatorBuffer = buffer;
+        frame->fecAccumulatorBufferSize = accumulatorSize;
+    }
+
+    memset(frame->fecAccumulatorBuffer, 0, accumulatorSize);
+    for (i = 0; i < frame->bufferParityPackets; i++) {
+        frame->fecAccumulators[i] = &frame->fecAccumulatorBuffer[i * receiveSize];
+    }
+
+    for (i = 0; i < frame->bufferDataPackets; i++) {
+        entry = frame->bufferRing[i];
+        if (entry != NULL) {
+            foldDataPacket(frame, rs, entry);
+        }
+    }
+
+    frame->progressiveRecovery = 1;
+    return 0;
+}
+
+static void recordReconstructionTime(PRTP_FEC_QUEUE queue, uint64_t timeUs) {
+    int bucket = 0;
+
+    while (timeUs != 0 && bucket < FEC_RECONSTRUCTION_TIME_BUCKETS - 1) {
+        timeUs >>= 1;
+        bucket++;
+    }
+
+    queue->stats.reconstructionTimeHistogram[bucket]++;
 }
 
 #define PACKET_RECOVERY_FAILURE()                     \
     ret = -1;                                         \
     Limelog("FEC recovery returned corrupt packet %d" \
-            " (frame %d)", rtpPacket->sequenceNumber, \
-            queue->currentFrameNumber);               \
-    free(packets[i]);                                 \
+            " (frame %u)", rtpPacket->sequenceNumber, \
+            frame->frameNumber);               \
+    freeVideoPacketBuffer(packets[i]);                \
     continue
 
 // Returns 0 if the frame is completely constructed
-static int reconstructFrame(PRTP_FEC_QUEUE queue) {
-    int totalPackets = U16(queue->bufferHighestSequenceNumber - queue->bufferLowestSequenceNumber) + 1;
+static int reconstructFrame(PRTP_FEC_QUEUE queue, PRTPF_FRAME_STATE frame) {
+    int totalPackets = U16(frame->bufferHighestSequenceNumber - frame->bufferLowestSequenceNumber) + 1;
     int ret;
     
-    if (queue->bufferSize < queue->bufferDataPackets) {
+    if (frame->bufferSize < frame->bufferDataPackets) {
         // Not enough data to recover yet
         return -1;
     }
     
-    if (queue->receivedBufferDataPackets == queue->bufferDataPackets) {
+    if (frame->receivedBufferDataPackets == frame->bufferDataPackets) {
         // We've received a full frame with no need for FEC.
         return 0;
     }
 
-    reed_solomon* rs = NULL;
-    unsigned char** packets = malloc(totalPackets * sizeof(unsigned char*));
-    unsigned char* marks = malloc(totalPackets * sizeof(unsigned char));
-    if (packets == NULL || marks == NULL) {
-        ret = -2;
-        goto cleanup;
-    }
-    
-    rs = reed_solomon_new(queue->bufferDataPackets, queue->bufferParityPackets);
+    // Shard counts are capped at DATA_SHARDS_MAX by reed_solomon_new(), so once
+    // we have a coder for this frame the shard arrays can live on the stack.
+    reed_solomon* rs = getReedSolomon(queue, frame->bufferDataPackets, frame->bufferParityPackets);
+    unsigned char* packets[DATA_SHARDS_MAX];
+    unsigned char marks[DATA_SHARDS_MAX];
     
     // This could happen in an OOM condition, but it could also mean the FEC data
     // that we fed to reed_solomon_new() is bogus, so we'll assert to get a better look.
     LC_ASSERT(rs != NULL);
     if (rs == NULL) {
-        ret = -3;
-        goto cleanup;
+        return -3;
+    }
+    LC_ASSERT(totalPackets <= DATA_SHARDS_MAX);
+    if (totalPackets > DATA_SHARDS_MAX) {
+        return -3;
     }
     
+    memset(packets, 0, sizeof(packets[0]) * totalPackets);
     memset(marks, 1, sizeof(char) * (totalPackets));
     
     int receiveSize = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
-    int packetBufferSize = receiveSize + sizeof(RTPFEC_QUEUE_ENTRY);
+    PRTP_PACKET templatePacket = NULL;
+    int i;
+
+    for (i = 0; i < totalPackets; i++) {
+        PRTPFEC_QUEUE_ENTRY entry = frame->bufferRing[i];
+        if (entry == NULL) {
+            continue;
+        }
 
-    PRTPFEC_QUEUE_ENTRY entry = queue->bufferHead;
-    while (entry != NULL) {
-        int index = U16(entry->packet->sequenceNumber - queue->bufferLowestSequenceNumber);
-        packets[index] = (unsigned char*) entry->packet;
-        marks[index] = 0;
+        packets[i] = (unsigned char*) entry->packet;
+        marks[i] = 0;
         
         //Set padding to zero
         if (entry->length < receiveSize) {
-            memset(&packets[index][entry->length], 0, receiveSize - entry->length);
+            memset(&packets[i][entry->length], 0, receiveSize - entry->length);
         }
 
-        entry = entry->next;
+        // Recovered packets take their RTP header fields from a received one
+        if (templatePacket == NULL) {
+            templatePacket = entry->packet;
+        }
     }
 
-    int i;
     for (i = 0; i < totalPackets; i++) {
         if (marks[i]) {
-            packets[i] = malloc(packetBufferSize);
+            packets[i] = allocateVideoPacketBuffer();
             if (packets[i] == NULL) {
                 ret = -4;
                 goto cleanup_packets;
@@ -146,7 +306,22 @@ static int reconstructFrame(PRTP_FEC_QUEUE queue) {
         }
     }
     
-    ret = reed_solomon_reconstruct(rs, packets, marks, totalPackets, receiveSize);
+    uint64_t startTimeUs = PltGetMicroseconds();
+    TRACE_BEGIN("FEC reconstruct", frame->frameNumber);
+    if (frame->progressiveRecovery) {
+        // Only the missing shards are left to solve for
+        ret = reed_solomon_reconstruct_folded(rs, packets, marks, frame->fecAccumulators, receiveSize);
+        if (ret != 0) {
+            // Every packet is still in the ring, so anything after this can
+            // fall back to recovering the frame from scratch
+            frame->progressiveRecovery = 0;
+        }
+    }
+    else {
+        ret = reed_solomon_reconstruct(rs, packets, marks, totalPackets, receiveSize);
+    }
+    TRACE_END("FEC reconstruct", frame->frameNumber);
+    recordReconstructionTime(queue, PltGetMicroseconds() - startTimeUs);
     
     // We should always provide enough parity to recover the missing data successfully.
     // If this fails, something is probably wrong with our FEC state.
@@ -156,13 +331,13 @@ cleanup_packets:
     for (i = 0; i < totalPackets; i++) {
         if (marks[i]) {
             // Only submit frame data, not FEC packets
-            if (ret == 0 && i < queue->bufferDataPackets) {
+            if (ret == 0 && i < frame->bufferDataPackets) {
                 PRTPFEC_QUEUE_ENTRY queueEntry = (PRTPFEC_QUEUE_ENTRY)&packets[i][receiveSize];
                 PRTP_PACKET rtpPacket = (PRTP_PACKET) packets[i];
-                rtpPacket->sequenceNumber = U16(i + queue->bufferLowestSequenceNumber);
-                rtpPacket->header = queue->bufferHead->packet->header;
-                rtpPacket->timestamp = queue->bufferHead->packet->timestamp;
-                rtpPacket->ssrc = queue->bufferHead->packet->ssrc;
+                rtpPacket->sequenceNumber = U16(i + frame->bufferLowestSequenceNumber);
+                rtpPacket->header = templatePacket->header;
+                rtpPacket->timestamp = templatePacket->timestamp;
+                rtpPacket->ssrc = templatePacket->ssrc;
                 
                 int dataOffset = sizeof(*rtpPacket);
                 if (rtpPacket->header & FLAG_EXTENSION) {
@@ -170,7 +345,7 @@ cleanup_packets:
                 }
 
                 PNV_VIDEO_PACKET nvPacket = (PNV_VIDEO_PACKET)(((char*)rtpPacket) + dataOffset);
-                nvPacket->frameIndex = queue->currentFrameNumber;
+                nvPacket->frameIndex = frame->frameNumber;
 
                 // Do some rudamentary checks to see that the recovered packet is sane.
                 // In some cases (4K 30 FPS 80 Mbps), we seem to get some odd failures
@@ -180,10 +355,10 @@ cleanup_packets:
                 if (i == 0 && !(nvPacket->flags & FLAG_SOF)) {
                     PACKET_RECOVERY_FAILURE();
                 }
-                if (i == queue->bufferDataPackets - 1 && !(nvPacket->flags & FLAG_EOF)) {
+                if (i == frame->bufferDataPackets - 1 && !(nvPacket->flags & FLAG_EOF)) {
                     PACKET_RECOVERY_FAILURE();
                 }
-                if (i > 0 && i < queue->bufferDataPackets - 1 && !(nvPacket->flags & FLAG_CONTAINS_PIC_DATA)) {
+                if (i > 0 && i < frame->bufferDataPackets - 1 && !(nvPacket->flags & FLAG_CONTAINS_PIC_DATA)) {
                     PACKET_RECOVERY_FAILURE();
                 }
                 if (nvPacket->flags & ~(FLAG_SOF | FLAG_EOF | FLAG_CONTAINS_PIC_DATA)) {
@@ -195,115 +370,207 @@ cleanup_packets:
                 // discarded by decoders. It's not safe to strip all zero padding because
                 // it may be a legitimate part of the H.264 bytestream.
 
-                LC_ASSERT(isBefore16(rtpPacket->sequenceNumber, queue->bufferFirstParitySequenceNumber));
-                queuePacket(queue, queueEntry, 0, rtpPacket, StreamConfig.packetSize + dataOffset, 0);
+                LC_ASSERT(isBefore16(rtpPacket->sequenceNumber, frame->bufferFirstParitySequenceNumber));
+                queuePacket(frame, queueEntry, rtpPacket, StreamConfig.packetSize + dataOffset, 0);
             } else if (packets[i] != NULL) {
-                free(packets[i]);
+                freeVideoPacketBuffer(packets[i]);
             }
         }
     }
+    
+    return ret;
+}
+
+static void submitCompletedFrame(PRTPF_FRAME_STATE frame) {
+    uint64_t fecCompleteTimeMs = PltGetMillis();
+    int i;
+
+    // The ring is in sequence number order, so this is a single pass
+    for (i = 0; i < frame->bufferRingSize && frame->bufferSize > 0; i++) {
+        PRTPFEC_QUEUE_ENTRY entry = frame->bufferRing[i];
+        if (entry == NULL) {
+            continue;
+        }
+
+        frame->bufferRing[i] = NULL;
+        frame->bufferSize--;
 
-cleanup:
-    reed_solomon_release(rs);
+        // Never return parity packets, and the depacketizer already has copies
+        // of any data packets that were submitted early
+        if (entry->isParity || i < frame->submittedDataPackets) {
+            freeVideoPacketBuffer(entry->packet);
+            continue;
+        }
 
-    if (packets != NULL)
-        free(packets);
+        // To avoid having to sample the system time for each packet, we cheat
+        // and use the first packet's receive time for all packets. This ends up
+        // actually being better for the measurements that the depacketizer does,
+        // since it properly handles out of order packets.
+        LC_ASSERT(frame->bufferFirstRecvTimeMs != 0);
+        entry->receiveTimeMs = frame->bufferFirstRecvTimeMs;
+        entry->fecCompleteTimeMs = fecCompleteTimeMs;
 
-    if (marks != NULL)
-        free(marks);
-    
-    return ret;
+        // Submit this packet for decoding. It will own freeing the entry now.
+        queueRtpPacket(entry);
+    }
 }
 
-static void removeEntry(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY entry) {
-    LC_ASSERT(entry != NULL);
-    LC_ASSERT(queue->bufferSize > 0);
-    LC_ASSERT(queue->bufferHead != NULL);
-    LC_ASSERT(queue->bufferTail != NULL);
+static PRTPF_FRAME_STATE getFrameState(PRTP_FEC_QUEUE queue, unsigned int frameNumber) {
+    return &queue->frames[U16(frameNumber) % RTPF_MAX_FRAME_WINDOW];
+}
 
-    if (queue->bufferHead == entry) {
-        queue->bufferHead = entry->next;
+// Passes the contiguous data packets at the start of the oldest frame on to
+// the depacketizer without waiting for the rest of the frame. The depacketizer
+// copies what it needs, so the packets stay in the ring in case the rest of
+// the frame has to be recovered.
+static void submitEarlyPackets(PRTP_FEC_QUEUE queue) {
+    PRTPF_FRAME_STATE frame = getFrameState(queue, queue->currentFrameNumber);
+    uint64_t fecCompleteTimeMs = 0;
+
+    if (!queue->earlySubmit || !frame->active || frame->completed ||
+            frame->frameNumber != queue->currentFrameNumber) {
+        return;
     }
-    if (queue->bufferTail == entry) {
-        queue->bufferTail = entry->prev;
+
+    while (frame->submittedDataPackets < frame->bufferDataPackets &&
+           frame->submittedDataPackets < frame->bufferRingSize) {
+        PRTPFEC_QUEUE_ENTRY entry = frame->bufferRing[frame->submittedDataPackets];
+        if (entry == NULL) {
+            break;
+        }
+
+        frame->submittedDataPackets++;
+
+        LC_ASSERT(frame->bufferFirstRecvTimeMs != 0);
+        entry->receiveTimeMs = frame->bufferFirstRecvTimeMs;
+
+        // Nothing needs recovering before these packets, so their part of
+        // the frame is complete as far as FEC is concerned
+        if (fecCompleteTimeMs == 0) {
+            fecCompleteTimeMs = PltGetMillis();
+        }
+        entry->fecCompleteTimeMs = fecCompleteTimeMs;
+
+        queueBorrowedRtpPacket(entry);
     }
+}
+
+// Returns 1 if the oldest frame hasn't received a single packet and a newer
+// frame has been complete for long enough that we shouldn't hold it back
+static int isOldestFrameMissing(PRTP_FEC_QUEUE queue) {
+    int i;
 
-    if (entry->prev != NULL) {
-        entry->prev->next = entry->next;
+    if (getFrameState(queue, queue->currentFrameNumber)->active) {
+        return 0;
     }
-    if (entry->next != NULL) {
-        entry->next->prev = entry->prev;
+
+    for (i = 1; i < queue->frameWindow; i++) {
+        PRTPF_FRAME_STATE frame = getFrameState(queue, queue->currentFrameNumber + i);
+
+        if (frame->active) {
+            LC_ASSERT(frame->frameNumber == queue->currentFrameNumber + i);
+            return frame->completed &&
+                PltGetMillis() - frame->completedTimeMs >= RTPF_MISSING_FRAME_WAIT_MS;
+        }
     }
-    queue->bufferSize--;
+
+    return 0;
 }
 
-static void submitCompletedFrame(PRTP_FEC_QUEUE queue) {
-    unsigned int nextSeqNum = queue->bufferLowestSequenceNumber;
+// Submits completed frames at the head of the window, stopping at the first
+// frame that's still waiting on packets
+static void submitReadyFrames(PRTP_FEC_QUEUE queue) {
+    while (queue->activeFrames > 0) {
+        PRTPF_FRAME_STATE frame = getFrameState(queue, queue->currentFrameNumber);
 
-    while (queue->bufferSize > 0) {
-        PRTPFEC_QUEUE_ENTRY entry = queue->bufferHead;
+        if (isOldestFrameMissing(queue)) {
+            // Nothing to drop, just move the window along
+            queue->currentFrameNumber++;
+            continue;
+        }
+        else if (!frame->active || !frame->completed) {
+            break;
+        }
 
-        unsigned int lowestRtpSequenceNumber = entry->packet->sequenceNumber;
+        LC_ASSERT(frame->frameNumber == queue->currentFrameNumber);
 
-        while (entry != NULL) {
-            // We should never encounter a packet that's lower than our next seq num
-            LC_ASSERT(!isBefore16(entry->packet->sequenceNumber, nextSeqNum));
+        // Submit the frame data to the depacketizer
+        submitCompletedFrame(frame);
 
-            // Never return parity packets
-            if (entry->isParity) {
-                PRTPFEC_QUEUE_ENTRY parityEntry = entry;
+        // submitCompletedFrame() should have consumed all data
+        LC_ASSERT(frame->bufferSize == 0);
 
-                // Skip this entry
-                entry = parityEntry->next;
+        frame->active = 0;
+        queue->activeFrames--;
 
-                // Remove this entry
-                removeEntry(queue, parityEntry);
+        // Ignore any more packets for this frame
+        queue->currentFrameNumber++;
+    }
 
-                // Free the entry and packet
-                free(parityEntry->packet);
+    // The new oldest frame may already have packets we can pass on
+    submitEarlyPackets(queue);
+}
 
-                continue;
-            }
+// Gives up on the oldest frame in the window to make room for a newer one
+static void dropOldestFrame(PRTP_FEC_QUEUE queue) {
+    PRTPF_FRAME_STATE frame = getFrameState(queue, queue->currentFrameNumber);
 
-            // Check for the next packet in sequence. This will be O(1) for non-reordered packet streams.
-            if (entry->packet->sequenceNumber == nextSeqNum) {
-                removeEntry(queue, entry);
-                entry->prev = entry->next = NULL;
-
-                // To avoid having to sample the system time for each packet, we cheat
-                // and use the first packet's receive time for all packets. This ends up
-                // actually being better for the measurements that the depacketizer does,
-                // since it properly handles out of order packets.
-                LC_ASSERT(queue->bufferFirstRecvTimeMs != 0);
-                entry->receiveTimeMs = queue->bufferFirstRecvTimeMs;
-
-                // Submit this packet for decoding. It will own freeing the entry now.
-                queueRtpPacket(entry);
-                break;
-            }
-            else if (isBefore16(entry->packet->sequenceNumber, lowestRtpSequenceNumber)) {
-                lowestRtpSequenceNumber = entry->packet->sequenceNumber;
-            }
+    if (frame->active) {
+        LC_ASSERT(frame->frameNumber == queue->currentFrameNumber);
+        LC_ASSERT(!frame->completed);
 
-            entry = entry->next;
-        }
+        queue->stats.framesUnrecoverable++;
 
-        if (entry == NULL) {
-            // Start at the lowest we found last enumeration
-            nextSeqNum = lowestRtpSequenceNumber;
-        }
-        else {
-            // We found this packet so move on to the next one in sequence
-            nextSeqNum = U16(nextSeqNum + 1);
+        Limelog("Unrecoverable frame %u: %d+%d=%d received < %d needed\n",
+                frame->frameNumber, frame->receivedBufferDataPackets,
+                frame->bufferSize - frame->receivedBufferDataPackets,
+                frame->bufferSize,
+                frame->bufferDataPackets);
+
+        // The depacketizer has part of this frame already
+        if (frame->submittedDataPackets > 0) {
+            abortRtpFrame();
         }
+
+        // Discard any unsubmitted buffers from this frame
+        purgeRing(frame);
+
+        frame->active = 0;
+        queue->activeFrames--;
     }
+
+    queue->currentFrameNumber++;
+
+    // Later frames may have been waiting on this one
+    submitReadyFrames(queue);
 }
 
-int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
-    if (isBefore16(packet->sequenceNumber, queue->nextContiguousSequenceNumber)) {
-        // Reject packets behind our current buffer window
-        return RTPF_RET_REJECTED;
+static void beginFrame(PRTPF_FRAME_STATE frame, PRTP_PACKET packet, PNV_VIDEO_PACKET nvPacket, int fecIndex) {
+    LC_ASSERT(frame->bufferSize == 0);
+
+    frame->active = 1;
+    frame->completed = 0;
+    frame->frameNumber = nvPacket->frameIndex;
+
+    frame->bufferFirstRecvTimeMs = PltGetMillis();
+    frame->bufferLowestSequenceNumber = U16(packet->sequenceNumber - fecIndex);
+    frame->nextContiguousSequenceNumber = frame->bufferLowestSequenceNumber;
+    frame->receivedBufferDataPackets = 0;
+    frame->bufferDataPackets = (nvPacket->fecInfo & 0xFFC00000) >> 22;
+    frame->fecPercentage = (nvPacket->fecInfo & 0xFF0) >> 4;
+    frame->bufferParityPackets = (frame->bufferDataPackets * frame->fecPercentage + 99) / 100;
+    frame->bufferFirstParitySequenceNumber = U16(frame->bufferLowestSequenceNumber + frame->bufferDataPackets);
+    frame->bufferHighestSequenceNumber = U16(frame->bufferFirstParitySequenceNumber + frame->bufferParityPackets - 1);
+    frame->submittedDataPackets = 0;
+    frame->progressiveRecovery = 0;
+
+    if (growRing(frame, U16(frame->bufferHighestSequenceNumber - frame->bufferLowestSequenceNumber) + 1) != 0) {
+        Limelog("Failed to grow FEC queue for frame %u\n", frame->frameNumber);
     }
+}
+
+int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
+    PRTPF_FRAME_STATE frame;
 
     int dataOffset = sizeof(*packet);
     if (packet->header & FLAG_EXTENSION) {
@@ -312,79 +579,114 @@ int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_
 
     PNV_VIDEO_PACKET nvPacket = (PNV_VIDEO_PACKET)(((char*)packet) + dataOffset);
     
+    int fecIndex = (nvPacket->fecInfo & 0x3FF000) >> 12;
+    int isParity = fecIndex >= (int)((nvPacket->fecInfo & 0xFFC00000) >> 22);
+
+    if (!queue->receivedFirstPacket) {
+        // Start the window at the first frame we see
+        queue->currentFrameNumber = nvPacket->frameIndex;
+        queue->receivedFirstPacket = 1;
+    }
+
     if (isBefore16(nvPacket->frameIndex, queue->currentFrameNumber)) {
         // Reject frames behind our current frame number
+        if (isParity) {
+            queue->stats.parityPacketsWasted++;
+        }
         return RTPF_RET_REJECTED;
     }
 
-    int fecIndex = (nvPacket->fecInfo & 0x3FF000) >> 12;
-    
-    // Reinitialize the queue if it's empty after a frame delivery or
-    // if we can't finish a frame before receiving the next one.
-    if (queue->bufferSize == 0 || queue->currentFrameNumber != nvPacket->frameIndex) {
-        if (queue->currentFrameNumber != nvPacket->frameIndex && queue->bufferSize != 0) {
-            Limelog("Unrecoverable frame %d: %d+%d=%d received < %d needed\n",
-                    queue->currentFrameNumber, queue->receivedBufferDataPackets,
-                    queue->bufferSize - queue->receivedBufferDataPackets,
-                    queue->bufferSize,
-                    queue->bufferDataPackets);
+    // Make room for this frame by giving up on older frames that we
+    // can't finish before receiving packets this far ahead of them.
+    while (!isBefore16(nvPacket->frameIndex, queue->currentFrameNumber + queue->frameWindow)) {
+        if (queue->activeFrames == 0) {
+            // Nothing is in flight, so just restart the window here
+            queue->currentFrameNumber = nvPacket->frameIndex;
+            break;
         }
-        
-        queue->currentFrameNumber = nvPacket->frameIndex;
-        
-        // Discard any unsubmitted buffers from the previous frame
-        while (queue->bufferHead != NULL) {
-            PRTPFEC_QUEUE_ENTRY entry = queue->bufferHead;
-            queue->bufferHead = entry->next;
-            free(entry->packet);
+
+        dropOldestFrame(queue);
+    }
+
+    frame = getFrameState(queue, nvPacket->frameIndex);
+    if (!frame->active) {
+        beginFrame(frame, packet, nvPacket, fecIndex);
+        queue->activeFrames++;
+    }
+    else if (frame->completed) {
+        // We already have everything we need for this frame
+        if (isParity) {
+            queue->stats.parityPacketsWasted++;
         }
-        
-        queue->bufferTail = NULL;
-        queue->bufferSize = 0;
-        
-        queue->bufferFirstRecvTimeMs = PltGetMillis();
-        queue->bufferLowestSequenceNumber = U16(packet->sequenceNumber - fecIndex);
-        queue->nextContiguousSequenceNumber = queue->bufferLowestSequenceNumber;
-        queue->receivedBufferDataPackets = 0;
-        queue->bufferDataPackets = (nvPacket->fecInfo & 0xFFC00000) >> 22;
-        queue->fecPercentage = (nvPacket->fecInfo & 0xFF0) >> 4;
-        queue->bufferParityPackets = (queue->bufferDataPackets * queue->fecPercentage + 99) / 100;
-        queue->bufferFirstParitySequenceNumber = U16(queue->bufferLowestSequenceNumber + queue->bufferDataPackets);
-        queue->bufferHighestSequenceNumber = U16(queue->bufferFirstParitySequenceNumber + queue->bufferParityPackets - 1);
-    } else if (isBefore16(queue->bufferHighestSequenceNumber, packet->sequenceNumber)) {
+        return RTPF_RET_REJECTED;
+    }
+    else if (isBefore16(packet->sequenceNumber, frame->nextContiguousSequenceNumber)) {
+        // Reject packets behind our current buffer window
+        return RTPF_RET_REJECTED;
+    }
+    else if (isBefore16(frame->bufferHighestSequenceNumber, packet->sequenceNumber)) {
         // In rare cases, we get extra parity packets. It's rare enough that it's probably
         // not worth handling, so we'll just drop them.
         return RTPF_RET_REJECTED;
     }
 
-    LC_ASSERT(!queue->fecPercentage || U16(packet->sequenceNumber - fecIndex) == queue->bufferLowestSequenceNumber);
-    LC_ASSERT((nvPacket->fecInfo & 0xFF0) >> 4 == queue->fecPercentage);
-    LC_ASSERT((nvPacket->fecInfo & 0xFFC00000) >> 22 == queue->bufferDataPackets);
+    LC_ASSERT(frame->frameNumber == nvPacket->frameIndex);
+    LC_ASSERT(!frame->fecPercentage || U16(packet->sequenceNumber - fecIndex) == frame->bufferLowestSequenceNumber);
+    LC_ASSERT((nvPacket->fecInfo & 0xFF0) >> 4 == frame->fecPercentage);
+    LC_ASSERT((nvPacket->fecInfo & 0xFFC00000) >> 22 == frame->bufferDataPackets);
 
-    if (!queuePacket(queue, packetEntry, 0, packet, length, !isBefore16(packet->sequenceNumber, queue->bufferFirstParitySequenceNumber))) {
+    if (!queuePacket(frame, packetEntry, packet, length, !isBefore16(packet->sequenceNumber, frame->bufferFirstParitySequenceNumber))) {
         return RTPF_RET_REJECTED;
     }
     else {
-        if (isBefore16(packet->sequenceNumber, queue->bufferFirstParitySequenceNumber)) {
-            queue->receivedBufferDataPackets++;
+        if (isBefore16(packet->sequenceNumber, frame->bufferFirstParitySequenceNumber)) {
+            frame->receivedBufferDataPackets++;
+
+            if (frame->progressiveRecovery) {
+                reed_solomon* rs = getReedSolomon(queue, frame->bufferDataPackets, frame->bufferParityPackets);
+                if (rs != NULL) {
+                    foldDataPacket(frame, rs, packetEntry);
+                }
+                else {
+                    // Recover the frame from scratch at the end instead
+                    frame->progressiveRecovery = 0;
+                }
+            }
+        }
+
+        // Spread the recovery work over the rest of the frame once we know
+        // we'll need it, instead of doing it all on the last packet. A gap is
+        // only treated as loss once packets arrive well past it or the data
+        // is over and still has holes, so reordering doesn't start it.
+        if (!frame->progressiveRecovery && frame->bufferParityPackets > 0 &&
+                isBefore16(frame->nextContiguousSequenceNumber, frame->bufferFirstParitySequenceNumber) &&
+                (isBefore16(U16(frame->nextContiguousSequenceNumber + RTPF_REORDER_TOLERANCE), packet->sequenceNumber) ||
+                 !isBefore16(packet->sequenceNumber, U16(frame->bufferFirstParitySequenceNumber - 1)))) {
+            startProgressiveRecovery(queue, frame);
         }
         
-        // Try to submit this frame. If we haven't received enough packets,
+        int missingDataPackets = frame->bufferDataPackets - frame->receivedBufferDataPackets;
+        int receivedParityPackets = frame->bufferSize - frame->receivedBufferDataPackets;
+
+        // Try to finish this frame. If we haven't received enough packets,
         // this will fail and we'll keep waiting.
-        if (reconstructFrame(queue) == 0) {
-            // Submit the frame data to the depacketizer
-            submitCompletedFrame(queue);
-            
-            // submitCompletedFrame() should have consumed all data
-            LC_ASSERT(queue->bufferHead == NULL);
-            LC_ASSERT(queue->bufferTail == NULL);
-            LC_ASSERT(queue->bufferSize == 0);
-            
-            // Ignore any more packets for this frame
-            queue->currentFrameNumber++;
+        if (reconstructFrame(queue, frame) == 0) {
+            if (missingDataPackets == 0) {
+                queue->stats.framesReceivedClean++;
+            }
+            else {
+                queue->stats.framesRecovered++;
+                queue->stats.shardsRecovered += missingDataPackets;
+            }
+            queue->stats.parityPacketsWasted += receivedParityPackets - missingDataPackets;
+
+            // Hold on to it until every frame before it is submitted or dropped
+            frame->completed = 1;
+            frame->completedTimeMs = PltGetMillis();
         }
 
+        submitReadyFrames(queue);
+
         return RTPF_RET_QUEUED;
     }
 }
-
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Video.h"
+#include "rs.h"
 
 typedef struct _RTPFEC_QUEUE_ENTRY {
     PRTP_PACKET packet;
@@ -9,13 +10,40 @@ typedef struct _RTPFEC_QUEUE_ENTRY {
     unsigned long long receiveTimeMs;
     unsigned int presentationTimeMs;
 
-    struct _RTPFEC_QUEUE_ENTRY* next;
-    struct _RTPFEC_QUEUE_ENTRY* prev;
+    // Set when the packet is passed on to the depacketizer
+    unsigned long long fecCompleteTimeMs;
 } RTPFEC_QUEUE_ENTRY, *PRTPFEC_QUEUE_ENTRY;
 
-typedef struct _RTP_FEC_QUEUE {
-    PRTPFEC_QUEUE_ENTRY bufferHead;
-    PRTPFEC_QUEUE_ENTRY bufferTail;
+// Number of Reed-Solomon coders (one per data/parity shard count) kept alive
+// across frames so recovery doesn't rebuild the coding matrix each time.
+#define RTPF_RS_CACHE_SIZE 16
+
+typedef struct _RTPF_RS_CACHE_ENTRY {
+    int dataShards;
+    int parityShards;
+    unsigned int lastUsed;
+    reed_solomon* rs;
+} RTPF_RS_CACHE_ENTRY, *PRTPF_RS_CACHE_ENTRY;
+
+// Maximum number of frames that can be in flight in the FEC queue at once
+#define RTPF_MAX_FRAME_WINDOW 4
+
+typedef struct _RTPF_FRAME_STATE {
+    // Set while this slot holds packets for frameNumber
+    int active;
+
+    // Set once the frame is complete but an earlier frame is still pending
+    int completed;
+    unsigned long long completedTimeMs;
+
+    // Full 32-bit frame index, which recovered packets are stamped with
+    unsigned int frameNumber;
+
+    // Entries for this frame, indexed by their sequence number's
+    // offset from bufferLowestSequenceNumber. The ring size is a power of
+    // two that's grown at frame start to cover every packet in the frame.
+    PRTPFEC_QUEUE_ENTRY* bufferRing;
+    int bufferRingSize;
     unsigned long long bufferFirstRecvTimeMs;
     int bufferSize;
     int bufferLowestSequenceNumber;
@@ -27,13 +55,51 @@ typedef struct _RTP_FEC_QUEUE {
     int fecPercentage;
     int nextContiguousSequenceNumber;
 
-    int currentFrameNumber;
+    // Number of data packets at the start of the frame that were handed to
+    // the depacketizer before the frame was complete (early submission).
+    // They stay in the ring until the frame is done with.
+    int submittedDataPackets;
+
+    // Progressive recovery state. Once we see loss in a frame, received
+    // data shards are folded into per-parity accumulators as they arrive
+    // so the final recovery only has to solve for the missing shards.
+    int progressiveRecovery;
+    unsigned char* fecAccumulatorBuffer;
+    int fecAccumulatorBufferSize;
+    unsigned char* fecAccumulators[DATA_SHARDS_MAX];
+} RTPF_FRAME_STATE, *PRTPF_FRAME_STATE;
+
+typedef struct _RTP_FEC_QUEUE {
+    // Frames are kept in slot (frameNumber % RTPF_MAX_FRAME_WINDOW). Late packets
+    // for an older frame can still complete it until a frame arrives that is
+    // frameWindow or more frames ahead of it.
+    RTPF_FRAME_STATE frames[RTPF_MAX_FRAME_WINDOW];
+    int frameWindow;
+    int activeFrames;
+
+    // Oldest frame that hasn't been submitted or dropped yet. Frames are
+    // always submitted to the depacketizer in order. This starts at the
+    // frame of the first packet we receive. Frame numbers are kept as full
+    // 32-bit frame indexes, but only their low 16 bits pick the frame slot
+    // and are compared against the window.
+    int receivedFirstPacket;
+    unsigned int currentFrameNumber;
+
+    // If set, contiguous data packets of the oldest frame are passed on as
+    // they arrive so the depacketizer can submit slices before the frame is
+    // complete. The queue keeps its own copies for recovery.
+    int earlySubmit;
+
+    RTPF_RS_CACHE_ENTRY rsCache[RTPF_RS_CACHE_SIZE];
+    unsigned int rsCacheClock;
+
+    FEC_STATISTICS stats;
 } RTP_FEC_QUEUE, *PRTP_FEC_QUEUE;
 
 #define RTPF_RET_QUEUED    0
 #define RTPF_RET_REJECTED  1
 
-void RtpfInitializeQueue(PRTP_FEC_QUEUE queue);
+void RtpfInitializeQueue(PRTP_FEC_QUEUE queue, int frameWindow, int earlySubmit);
 void RtpfCleanupQueue(PRTP_FEC_QUEUE queue);
 int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry);
 void RtpfSubmitQueuedPackets(PRTP_FEC_QUEUE queue);
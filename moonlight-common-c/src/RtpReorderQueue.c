@@ -13,7 +13,7 @@ void RtpqCleanupQueue(PRTP_REORDER_QUEUE queue) {
     while (queue->queueHead != NULL) {
         PRTP_QUEUE_ENTRY entry = queue->queueHead;
         queue->queueHead = entry->next;
-        free(entry->packet);
+        freeAudioPacketBuffer(entry->packet);
     }
 }
 
@@ -253,4 +253,17 @@ PRTP_PACKET RtpqGetQueuedPacket(PRTP_REORDER_QUEUE queue) {
     // the caller will call again until it receives null
 
     return queuedEntry->packet;
+}
+
+// Returns how many packets were lost between lastSeq and seq, up to maxLost.
+// The queue only moves forward, so a packet that looks older than lastSeq is
+// a late duplicate and nothing was lost.
+int RtpqGetLostPackets(unsigned short lastSeq, unsigned short seq, int maxLost) {
+    unsigned short missingPackets = U16(seq - lastSeq - 1);
+
+    if (missingPackets >= 0x8000) {
+        return 0;
+    }
+
+    return missingPackets > maxLost ? maxLost : missingPackets;
 }
\ No newline at end of file
@@ -38,4 +38,5 @@ typedef struct _RTP_REORDER_QUEUE {
 void RtpqInitializeQueue(PRTP_REORDER_QUEUE queue, int maxSize, int maxQueueTimeMs);
 void RtpqCleanupQueue(PRTP_REORDER_QUEUE queue);
 int RtpqAddPacket(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, PRTP_QUEUE_ENTRY packetEntry);
-PRTP_PACKET RtpqGetQueuedPacket(PRTP_REORDER_QUEUE queue);
\ No newline at end of file
+PRTP_PACKET RtpqGetQueuedPacket(PRTP_REORDER_QUEUE queue);
+int RtpqGetLostPackets(unsigned short lastSeq, unsigned short seq, int maxLost);
\ No newline at end of file
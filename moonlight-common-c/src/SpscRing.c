@@ -0,0 +1,176 @@
+#include "SpscRing.h"
+
+// Indices are only ever accessed through these. Everything is sequentially
+// consistent since the consumer's sleep check relies on the producer's tail
+// store and consumerWaiting load being ordered (and vice versa).
+#if defined(LC_WINDOWS)
+static unsigned int loadIndex(unsigned int* index) {
+    unsigned int value;
+
+    MemoryBarrier();
+    value = *(volatile unsigned int*)index;
+    MemoryBarrier();
+    return value;
+}
+
+static void storeIndex(unsigned int* index, unsigned int value) {
+    InterlockedExchange((volatile LONG*)index, (LONG)value);
+}
+
+static int compareExchangeIndex(unsigned int* index, unsigned int* expected, unsigned int desired) {
+    unsigned int previous = (unsigned int)InterlockedCompareExchange((volatile LONG*)index, (LONG)desired, (LONG)*expected);
+    if (previous == *expected) {
+        return 1;
+    }
+
+    *expected = previous;
+    return 0;
+}
+#else
+static unsigned int loadIndex(unsigned int* index) {
+    return __atomic_load_n(index, __ATOMIC_SEQ_CST);
+}
+
+static void storeIndex(unsigned int* index, unsigned int value) {
+    __atomic_store_n(index, value, __ATOMIC_SEQ_CST);
+}
+
+static int compareExchangeIndex(unsigned int* index, unsigned int* expected, unsigned int desired) {
+    return __atomic_compare_exchange_n(index, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#endif
+
+// SPSC ring init. slotCount must be a power of two.
+int SpscInitializeRing(PSPSC_RING ring, int slotCount, int slotSize) {
+    int err;
+
+    LC_ASSERT(slotCount > 0 && (slotCount & (slotCount - 1)) == 0);
+
+    memset(ring, 0, sizeof(*ring));
+
+    ring->slots = (char*)malloc((size_t)slotCount * slotSize);
+    if (ring->slots == NULL) {
+        return -1;
+    }
+
+    err = PltCreateEvent(&ring->containsDataEvent);
+    if (err != 0) {
+        free(ring->slots);
+        ring->slots = NULL;
+        return err;
+    }
+
+    ring->slotSize = slotSize;
+    ring->slotMask = (unsigned int)slotCount - 1;
+
+    return 0;
+}
+
+// Destroy the ring. All slots must have been polled and released first.
+void SpscDestroyRing(PSPSC_RING ring) {
+    LC_ASSERT(ring->releaseIndex == ring->tail);
+
+    PltCloseEvent(&ring->containsDataEvent);
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+// Producer side. Returns the next slot to fill or NULL if the ring is full.
+void* SpscGetFreeSlot(PSPSC_RING ring) {
+    unsigned int tail = ring->tail;
+
+    if (tail - loadIndex(&ring->releaseIndex) > ring->slotMask) {
+        return NULL;
+    }
+
+    return ring->slots + (size_t)(tail & ring->slotMask) * ring->slotSize;
+}
+
+// Producer side. Publishes the slot returned by the last SpscGetFreeSlot() call.
+void SpscCommitSlot(PSPSC_RING ring) {
+    storeIndex(&ring->tail, ring->tail + 1);
+
+    if (loadIndex(&ring->consumerWaiting)) {
+        PltSetEvent(&ring->containsDataEvent);
+    }
+}
+
+// Consumer side. Returns SPSC_FLUSHED for slots committed before the last
+// flush, which must still be released by the caller.
+int SpscPollSlot(PSPSC_RING ring, void** slot) {
+    unsigned int readIndex = ring->readIndex;
+
+    if (readIndex == loadIndex(&ring->tail)) {
+        return SPSC_NO_ELEMENT;
+    }
+
+    *slot = ring->slots + (size_t)(readIndex & ring->slotMask) * ring->slotSize;
+    storeIndex(&ring->readIndex, readIndex + 1);
+
+    if ((int)(loadIndex(&ring->flushIndex) - readIndex) > 0) {
+        return SPSC_FLUSHED;
+    }
+
+    return SPSC_SUCCESS;
+}
+
+int SpscWaitForSlot(PSPSC_RING ring, void** slot) {
+    int err;
+
+    for (;;) {
+        if (loadIndex(&ring->shutdown)) {
+            return SPSC_INTERRUPTED;
+        }
+
+        err = SpscPollSlot(ring, slot);
+        if (err != SPSC_NO_ELEMENT) {
+            return err;
+        }
+
+        // Tell the producer to wake us up, then check again in case
+        // a slot was committed before it could see that.
+        PltClearEvent(&ring->containsDataEvent);
+        storeIndex(&ring->consumerWaiting, 1);
+
+        err = SpscPollSlot(ring, slot);
+        if (err == SPSC_NO_ELEMENT && !loadIndex(&ring->shutdown)) {
+            if (PltWaitForEvent(&ring->containsDataEvent) != PLT_WAIT_SUCCESS) {
+                storeIndex(&ring->consumerWaiting, 0);
+                return SPSC_INTERRUPTED;
+            }
+        }
+
+        storeIndex(&ring->consumerWaiting, 0);
+
+        if (err != SPSC_NO_ELEMENT) {
+            return err;
+        }
+    }
+}
+
+// Consumer side. Frees the oldest slot returned by SpscPollSlot() or SpscWaitForSlot().
+void SpscReleaseSlot(PSPSC_RING ring) {
+    LC_ASSERT(ring->releaseIndex != ring->readIndex);
+
+    storeIndex(&ring->releaseIndex, ring->releaseIndex + 1);
+}
+
+// Marks everything committed so far as flushed. The consumer sees those slots
+// as SPSC_FLUSHED, so this may be called from any thread.
+void SpscFlushRing(PSPSC_RING ring) {
+    unsigned int target = loadIndex(&ring->tail);
+    unsigned int current = loadIndex(&ring->flushIndex);
+
+    while ((int)(target - current) > 0 &&
+           !compareExchangeIndex(&ring->flushIndex, &current, target));
+}
+
+void SpscSignalRingShutdown(PSPSC_RING ring) {
+    storeIndex(&ring->shutdown, 1);
+    PltSetEvent(&ring->containsDataEvent);
+}
+
+// Number of committed slots that the consumer hasn't picked up yet
+int SpscGetItemCount(PSPSC_RING ring) {
+    return (int)(loadIndex(&ring->tail) - loadIndex(&ring->readIndex));
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Platform.h"
+#include "PlatformThreads.h"
+
+#define SPSC_SUCCESS 0
+#define SPSC_INTERRUPTED 1
+#define SPSC_NO_ELEMENT 2
+#define SPSC_FLUSHED 3
+
+// Keeps the producer and consumer indices on separate cache lines
+#define SPSC_CACHE_LINE_SIZE 64
+
+// Bounded single-producer/single-consumer ring of preallocated slots. The
+// producer fills the slot returned by SpscGetFreeSlot() and publishes it with
+// SpscCommitSlot(). The consumer gets slots in order and hands each one back
+// with SpscReleaseSlot() once it's done with it, so a slot can be held while
+// it's being processed without copying it out of the ring.
+//
+// Neither side takes a lock. The event is only signalled when the consumer
+// has gone to sleep on an empty ring.
+typedef struct _SPSC_RING {
+    // Written by the producer only
+    unsigned int tail;
+    char producerPad[SPSC_CACHE_LINE_SIZE - sizeof(unsigned int)];
+
+    // Written by the consumer only
+    unsigned int readIndex;
+    unsigned int releaseIndex;
+    unsigned int consumerWaiting;
+    char consumerPad[SPSC_CACHE_LINE_SIZE - 3 * sizeof(unsigned int)];
+
+    // Slots before this index are returned as SPSC_FLUSHED. It only moves
+    // forward and may be advanced from any thread.
+    unsigned int flushIndex;
+    unsigned int shutdown;
+
+    PLT_EVENT containsDataEvent;
+    char* slots;
+    int slotSize;
+    unsigned int slotMask;
+} SPSC_RING, *PSPSC_RING;
+
+int SpscInitializeRing(PSPSC_RING ring, int slotCount, int slotSize);
+void SpscDestroyRing(PSPSC_RING ring);
+void* SpscGetFreeSlot(PSPSC_RING ring);
+void SpscCommitSlot(PSPSC_RING ring);
+int SpscWaitForSlot(PSPSC_RING ring, void** slot);
+int SpscPollSlot(PSPSC_RING ring, void** slot);
+void SpscReleaseSlot(PSPSC_RING ring);
+void SpscFlushRing(PSPSC_RING ring);
+void SpscSignalRingShutdown(PSPSC_RING ring);
+int SpscGetItemCount(PSPSC_RING ring);
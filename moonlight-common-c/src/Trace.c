@@ -0,0 +1,327 @@
+#include "Trace.h"
+
+#include <stdarg.h>
+
+// Each thread claims a ring the first time it records an event after the
+// tracer is enabled. Claiming is a single atomic increment, so nothing on
+// the recording path ever takes a lock.
+#if defined(LC_WINDOWS)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+
+static unsigned int loadAcquire(unsigned int* value) {
+    unsigned int result = *(volatile unsigned int*)value;
+    MemoryBarrier();
+    return result;
+}
+
+static void storeRelease(unsigned int* value, unsigned int newValue) {
+    MemoryBarrier();
+    *(volatile unsigned int*)value = newValue;
+}
+
+static unsigned int fetchIncrement(unsigned int* value) {
+    return (unsigned int)InterlockedIncrement((volatile LONG*)value) - 1;
+}
+
+static PTRACE_RING loadRingAcquire(PTRACE_RING* ring) {
+    PTRACE_RING result = *(PTRACE_RING volatile*)ring;
+    MemoryBarrier();
+    return result;
+}
+
+static void storeRingRelease(PTRACE_RING* ring, PTRACE_RING newRing) {
+    InterlockedExchangePointer((PVOID volatile*)ring, newRing);
+}
+#else
+#define TRACE_THREAD_LOCAL __thread
+
+static unsigned int loadAcquire(unsigned int* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned int* value, unsigned int newValue) {
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+}
+
+static unsigned int fetchIncrement(unsigned int* value) {
+    return __atomic_fetch_add(value, 1, __ATOMIC_ACQ_REL);
+}
+
+static PTRACE_RING loadRingAcquire(PTRACE_RING* ring) {
+    return __atomic_load_n(ring, __ATOMIC_ACQUIRE);
+}
+
+static void storeRingRelease(PTRACE_RING* ring, PTRACE_RING newRing) {
+    __atomic_store_n(ring, newRing, __ATOMIC_RELEASE);
+}
+#endif
+
+volatile int TraceEnabled;
+
+// Bumped each time the tracer is enabled so threads know to claim a new ring
+static unsigned int traceGeneration;
+
+// Rings are allocated on first use and reused by whichever thread claims
+// the same slot after the tracer is enabled again
+static PTRACE_RING ringStorage[TRACE_MAX_THREADS];
+
+// Rings claimed since the tracer was last enabled, which are the ones dumped
+static PTRACE_RING activeRings[TRACE_MAX_THREADS];
+static unsigned int activeRingCount;
+
+static TRACE_THREAD_LOCAL PTRACE_RING threadRing;
+static TRACE_THREAD_LOCAL unsigned int threadRingGeneration;
+static TRACE_THREAD_LOCAL const char* threadName;
+
+static PTRACE_RING claimRing(unsigned int generation) {
+    unsigned int slot;
+    PTRACE_RING ring;
+
+    // Don't retry for every event if we can't get one
+    threadRingGeneration = generation;
+    threadRing = NULL;
+
+    slot = fetchIncrement(&activeRingCount);
+    if (slot >= TRACE_MAX_THREADS) {
+        return NULL;
+    }
+
+    ring = ringStorage[slot];
+    if (ring == NULL) {
+        ring = (PTRACE_RING)malloc(sizeof(*ring));
+        if (ring == NULL) {
+            return NULL;
+        }
+        ringStorage[slot] = ring;
+    }
+
+    ring->head = 0;
+    ring->threadId = (int)slot + 1;
+    ring->threadName = threadName;
+    storeRingRelease(&activeRings[slot], ring);
+
+    threadRing = ring;
+    return ring;
+}
+
+void TraceRecordEvent(int phase, const char* name, long long arg) {
+    unsigned int generation = loadAcquire(&traceGeneration);
+    PTRACE_RING ring = threadRing;
+    PTRACE_RECORD record;
+
+    if (threadRingGeneration != generation) {
+        ring = claimRing(generation);
+    }
+    if (ring == NULL) {
+        return;
+    }
+
+    record = &ring->records[ring->head % LI_TRACE_RING_SIZE];
+    record->timeNs = PltGetNanoseconds();
+    record->name = name;
+    record->arg = arg;
+    record->phase = phase;
+
+    // Publish the record to LiTraceDumpJson()
+    storeRelease(&ring->head, ring->head + 1);
+}
+
+// Enabling while other threads are recording may lose the events they're in
+// the middle of recording, but never anything recorded afterwards.
+void LiTraceSetEnabled(int enabled) {
+    int i;
+
+    if (enabled && !TraceEnabled) {
+        for (i = 0; i < TRACE_MAX_THREADS; i++) {
+            storeRingRelease(&activeRings[i], NULL);
+        }
+        storeRelease(&activeRingCount, 0);
+        storeRelease(&traceGeneration, traceGeneration + 1);
+    }
+
+    TraceEnabled = enabled ? 1 : 0;
+}
+
+int LiTraceIsEnabled(void) {
+    return TraceEnabled;
+}
+
+void LiTraceSetThreadName(const char* name) {
+    threadName = name;
+
+    if (threadRing != NULL && threadRingGeneration == loadAcquire(&traceGeneration)) {
+        threadRing->threadName = name;
+    }
+}
+
+void LiTraceBegin(const char* name, long long arg) {
+    TRACE_EVENT(TRACE_PHASE_BEGIN, name, arg);
+}
+
+void LiTraceEnd(const char* name, long long arg) {
+    TRACE_EVENT(TRACE_PHASE_END, name, arg);
+}
+
+void LiTraceAsyncBegin(const char* name, long long id) {
+    TRACE_EVENT(TRACE_PHASE_ASYNC_BEGIN, name, id);
+}
+
+void LiTraceAsyncEnd(const char* name, long long id) {
+    TRACE_EVENT(TRACE_PHASE_ASYNC_END, name, id);
+}
+
+void LiTraceInstant(const char* name, long long arg) {
+    TRACE_EVENT(TRACE_PHASE_INSTANT, name, arg);
+}
+
+void LiTraceCounter(const char* name, long long value) {
+    TRACE_EVENT(TRACE_PHASE_COUNTER, name, value);
+}
+
+typedef struct _JSON_BUFFER {
+    char* data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} JSON_BUFFER, *PJSON_BUFFER;
+
+static void appendJson(PJSON_BUFFER buffer, const char* format, ...) {
+    va_list args;
+    int length;
+
+    while (!buffer->failed) {
+        va_start(args, format);
+        length = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+        va_end(args);
+
+        if (length < 0) {
+            buffer->failed = 1;
+        }
+        else if ((size_t)length < buffer->capacity - buffer->length) {
+            buffer->length += length;
+            return;
+        }
+        else {
+            size_t capacity = buffer->capacity * 2;
+            char* data;
+
+            if (capacity < buffer->length + length + 1) {
+                capacity = buffer->length + length + 1;
+            }
+
+            data = (char*)realloc(buffer->data, capacity);
+            if (data == NULL) {
+                buffer->failed = 1;
+            }
+            else {
+                buffer->data = data;
+                buffer->capacity = capacity;
+            }
+        }
+    }
+}
+
+static void appendJsonString(PJSON_BUFFER buffer, const char* string) {
+    const char* c;
+
+    for (c = string; *c != 0; c++) {
+        if (*c == '"' || *c == '\\' || (unsigned char)*c < 0x20) {
+            break;
+        }
+    }
+
+    // Names are almost always plain literals that can go in as they are
+    if (*c == 0) {
+        appendJson(buffer, "\"%s\"", string);
+        return;
+    }
+
+    appendJson(buffer, "\"");
+    for (c = string; *c != 0; c++) {
+        if (*c == '"' || *c == '\\') {
+            appendJson(buffer, "\\%c", *c);
+        }
+        else if ((unsigned char)*c < 0x20) {
+            appendJson(buffer, "\\u%04x", (unsigned char)*c);
+        }
+        else {
+            appendJson(buffer, "%c", *c);
+        }
+    }
+    appendJson(buffer, "\"");
+}
+
+static void appendRecord(PJSON_BUFFER buffer, PTRACE_RING ring, PTRACE_RECORD record, int first) {
+    appendJson(buffer, "%s\n{\"name\":", first ? "" : ",");
+    appendJsonString(buffer, record->name);
+    appendJson(buffer, ",\"cat\":\"moonlight\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%d",
+               record->phase,
+               (unsigned long long)(record->timeNs / 1000),
+               (unsigned int)(record->timeNs % 1000),
+               ring->threadId);
+
+    switch (record->phase) {
+    case TRACE_PHASE_ASYNC_BEGIN:
+    case TRACE_PHASE_ASYNC_END:
+        appendJson(buffer, ",\"id\":%lld}", record->arg);
+        break;
+    case TRACE_PHASE_COUNTER:
+        appendJson(buffer, ",\"args\":{\"value\":%lld}}", record->arg);
+        break;
+    case TRACE_PHASE_INSTANT:
+        appendJson(buffer, ",\"s\":\"t\",\"args\":{\"arg\":%lld}}", record->arg);
+        break;
+    default:
+        appendJson(buffer, ",\"args\":{\"arg\":%lld}}", record->arg);
+        break;
+    }
+}
+
+char* LiTraceDumpJson(void) {
+    JSON_BUFFER buffer;
+    unsigned int ringCount;
+    unsigned int i;
+    int first = 1;
+
+    memset(&buffer, 0, sizeof(buffer));
+    appendJson(&buffer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    ringCount = loadAcquire(&activeRingCount);
+    if (ringCount > TRACE_MAX_THREADS) {
+        ringCount = TRACE_MAX_THREADS;
+    }
+
+    for (i = 0; i < ringCount; i++) {
+        PTRACE_RING ring = loadRingAcquire(&activeRings[i]);
+        unsigned int head, index;
+
+        // The thread may still be setting up its ring
+        if (ring == NULL) {
+            continue;
+        }
+
+        if (ring->threadName != NULL) {
+            appendJson(&buffer, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                       first ? "" : ",", ring->threadId);
+            appendJsonString(&buffer, ring->threadName);
+            appendJson(&buffer, "}}");
+            first = 0;
+        }
+
+        head = loadAcquire(&ring->head);
+        index = head > LI_TRACE_RING_SIZE ? head - LI_TRACE_RING_SIZE : 0;
+        for (; index != head; index++) {
+            appendRecord(&buffer, ring, &ring->records[index % LI_TRACE_RING_SIZE], first);
+            first = 0;
+        }
+    }
+
+    appendJson(&buffer, "\n]}\n");
+
+    if (buffer.failed) {
+        free(buffer.data);
+        return NULL;
+    }
+
+    return buffer.data;
+}
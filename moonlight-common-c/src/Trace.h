@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Platform.h"
+
+// Upper bound on threads that can record events between two enables of the
+// tracer. Events from any further threads are dropped.
+#define TRACE_MAX_THREADS 32
+
+// Chrome trace event phases
+#define TRACE_PHASE_BEGIN 'B'
+#define TRACE_PHASE_END 'E'
+#define TRACE_PHASE_ASYNC_BEGIN 'b'
+#define TRACE_PHASE_ASYNC_END 'e'
+#define TRACE_PHASE_INSTANT 'i'
+#define TRACE_PHASE_COUNTER 'C'
+
+typedef struct _TRACE_RECORD {
+    uint64_t timeNs;
+    const char* name;
+    long long arg;
+    int phase;
+} TRACE_RECORD, *PTRACE_RECORD;
+
+// Only the owning thread writes to a ring. head counts every record ever
+// written, so the newest record is at (head - 1) % LI_TRACE_RING_SIZE.
+typedef struct _TRACE_RING {
+    unsigned int head;
+    int threadId;
+    const char* threadName;
+    TRACE_RECORD records[LI_TRACE_RING_SIZE];
+} TRACE_RING, *PTRACE_RING;
+
+extern volatile int TraceEnabled;
+
+void TraceRecordEvent(int phase, const char* name, long long arg);
+
+// Wrappers for hot paths in this library. They only cost a load and a branch
+// while tracing is disabled.
+#define TRACE_EVENT(phase, name, arg) \
+    do { \
+        if (TraceEnabled) { \
+            TraceRecordEvent(phase, name, arg); \
+        } \
+    } while (0)
+
+#define TRACE_BEGIN(name, arg) TRACE_EVENT(TRACE_PHASE_BEGIN, name, arg)
+#define TRACE_END(name, arg) TRACE_EVENT(TRACE_PHASE_END, name, arg)
+#define TRACE_INSTANT(name, arg) TRACE_EVENT(TRACE_PHASE_INSTANT, name, arg)
+#define TRACE_COUNTER(name, value) TRACE_EVENT(TRACE_PHASE_COUNTER, name, value)
@@ -2,9 +2,20 @@
 
 #include "LinkedBlockingQueue.h"
 
+// Number of frames the FEC queue keeps in flight. Late parity for a frame
+// can still recover it until a frame this many frames newer shows up.
+#define RTP_FEC_FRAME_WINDOW 3
+
+// Enough packet buffers for a few large frames in the FEC queue and
+// depacketizer. Beyond this, allocations fall back to malloc().
+#define VIDEO_PACKET_POOL_BUFFERS 1024
+
 typedef struct _QUEUED_DECODE_UNIT {
     DECODE_UNIT decodeUnit;
-    LINKED_BLOCKING_QUEUE_ENTRY entry;
+
+    // Set for slice units, which are submitted with their SLICE_FLAG_* values
+    int isSliceUnit;
+    int sliceFlags;
 } QUEUED_DECODE_UNIT, *PQUEUED_DECODE_UNIT;
 
 void completeQueuedDecodeUnit(PQUEUED_DECODE_UNIT qdu, int drStatus);
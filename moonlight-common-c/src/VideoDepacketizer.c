@@ -1,7 +1,8 @@
 #include "Platform.h"
 #include "Limelight-internal.h"
-#include "LinkedBlockingQueue.h"
+#include "SpscRing.h"
 #include "Video.h"
+#include "AnnexB.h"
 
 static PLENTRY nalChainHead;
 static PLENTRY nalChainTail;
@@ -16,15 +17,22 @@ static int decodingFrame;
 static int strictIdrFrameWait;
 static unsigned long long firstPacketReceiveTime;
 static unsigned int firstPacketPresentationTime;
+static unsigned long long lastPacketFecCompleteTime;
 static int dropStatePending;
 static int idrFrameProcessed;
+static int sliceSubmitEnabled;
+static int slicesSubmitted;
 
 #define DR_CLEANUP -1000
 
 #define CONSECUTIVE_DROP_LIMIT 120
 static unsigned int consecutiveFrameDrops;
 
-static LINKED_BLOCKING_QUEUE decodeUnitQueue;
+// The receive thread is the only producer and the decoder thread the only
+// consumer, so queued decode units live in preallocated ring slots. One slot
+// is held by the decoder while it decodes, leaving 15 for queued frames.
+#define DECODE_UNIT_RING_SIZE 16
+static SPSC_RING decodeUnitRing;
 
 typedef struct _BUFFER_DESC {
     char* data;
@@ -37,9 +45,34 @@ typedef struct _LENTRY_INTERNAL {
     void* allocPtr;
 } LENTRY_INTERNAL, *PLENTRY_INTERNAL;
 
+// Contiguous decode units are copied into one of these instead of chaining packet
+// buffers. Separate entries are only needed for codec configuration NALUs, so
+// picture data just extends the last entry. If we run out of entries, the rest
+// of the frame is merged into the last one.
+#define FRAME_BUFFER_MAX_ENTRIES 8
+#define FRAME_BUFFER_INITIAL_SIZE (128 * 1024)
+
+// Frame buffers are recycled up to the depth of the decode unit queue
+#define FRAME_BUFFER_POOL_SIZE DECODE_UNIT_RING_SIZE
+
+typedef struct _FRAME_BUFFER {
+    struct _FRAME_BUFFER* next;
+    char* data;
+    int capacity;
+    int length;
+    int entryCount;
+    LENTRY_INTERNAL entries[FRAME_BUFFER_MAX_ENTRIES];
+} FRAME_BUFFER, *PFRAME_BUFFER;
+
+static int contiguousDecodeUnits;
+static PFRAME_BUFFER currentFrameBuffer;
+static PFRAME_BUFFER frameBufferFreeList;
+static int frameBufferFreeCount;
+static PLT_MUTEX frameBufferLock;
+
 // Init
 void initializeVideoDepacketizer(int pktSize) {
-    LbqInitializeLinkedBlockingQueue(&decodeUnitQueue, 15);
+    SpscInitializeRing(&decodeUnitRing, DECODE_UNIT_RING_SIZE, sizeof(QUEUED_DECODE_UNIT));
 
     nextFrameNumber = 1;
     startFrameNumber = 0;
@@ -49,22 +82,97 @@ void initializeVideoDepacketizer(int pktSize) {
     decodingFrame = 0;
     firstPacketReceiveTime = 0;
     firstPacketPresentationTime = 0;
+    lastPacketFecCompleteTime = 0;
     dropStatePending = 0;
     idrFrameProcessed = 0;
     strictIdrFrameWait = !isReferenceFrameInvalidationEnabled();
+    sliceSubmitEnabled = (VideoCallbacks.capabilities & CAPABILITY_SLICE_SUBMIT) != 0;
+    slicesSubmitted = 0;
+
+    contiguousDecodeUnits = (VideoCallbacks.capabilities & CAPABILITY_CONTIGUOUS_DECODE_UNIT) != 0;
+    currentFrameBuffer = NULL;
+    frameBufferFreeList = NULL;
+    frameBufferFreeCount = 0;
+    PltCreateMutex(&frameBufferLock);
 }
 
-// Free the NAL chain
-static void cleanupFrameState(void) {
+// Returns a recycled frame buffer or allocates a new one
+static PFRAME_BUFFER allocateFrameBuffer(void) {
+    PFRAME_BUFFER frameBuffer;
+
+    PltLockMutex(&frameBufferLock);
+    frameBuffer = frameBufferFreeList;
+    if (frameBuffer != NULL) {
+        frameBufferFreeList = frameBuffer->next;
+        frameBufferFreeCount--;
+    }
+    PltUnlockMutex(&frameBufferLock);
+
+    if (frameBuffer == NULL) {
+        frameBuffer = (PFRAME_BUFFER)malloc(sizeof(*frameBuffer));
+        if (frameBuffer == NULL) {
+            return NULL;
+        }
+
+        frameBuffer->data = (char*)malloc(FRAME_BUFFER_INITIAL_SIZE);
+        if (frameBuffer->data == NULL) {
+            free(frameBuffer);
+            return NULL;
+        }
+        frameBuffer->capacity = FRAME_BUFFER_INITIAL_SIZE;
+    }
+
+    frameBuffer->next = NULL;
+    frameBuffer->length = 0;
+    frameBuffer->entryCount = 0;
+    return frameBuffer;
+}
+
+// Returns a frame buffer to the free list. This is called from the decoder thread
+// when decode units are completed and from whichever thread the decoder releases
+// retained buffers on, so the free list is protected by a lock.
+static void freeFrameBuffer(PFRAME_BUFFER frameBuffer) {
+    PltLockMutex(&frameBufferLock);
+    if (frameBufferFreeCount < FRAME_BUFFER_POOL_SIZE) {
+        frameBuffer->next = frameBufferFreeList;
+        frameBufferFreeList = frameBuffer;
+        frameBufferFreeCount++;
+        frameBuffer = NULL;
+    }
+    PltUnlockMutex(&frameBufferLock);
+
+    if (frameBuffer != NULL) {
+        free(frameBuffer->data);
+        free(frameBuffer);
+    }
+}
+
+// Free a chain of buffers that belonged to a decode unit
+static void freeNalChain(PLENTRY chain) {
     PLENTRY_INTERNAL lastEntry;
 
-    while (nalChainHead != NULL) {
-        lastEntry = (PLENTRY_INTERNAL)nalChainHead;
-        nalChainHead = lastEntry->entry.next;
-        free(lastEntry->allocPtr);
+    if (contiguousDecodeUnits) {
+        // Every entry lives in the same frame buffer
+        if (chain != NULL) {
+            freeFrameBuffer((PFRAME_BUFFER)((PLENTRY_INTERNAL)chain)->allocPtr);
+        }
+        return;
+    }
+
+    while (chain != NULL) {
+        lastEntry = (PLENTRY_INTERNAL)chain;
+        chain = lastEntry->entry.next;
+        freeVideoPacketBuffer(lastEntry->allocPtr);
     }
+}
+
+// Free the NAL chain
+static void cleanupFrameState(void) {
+    freeNalChain(nalChainHead);
 
+    nalChainHead = NULL;
     nalChainTail = NULL;
+    currentFrameBuffer = NULL;
 
     nalChainDataLength = 0;
 }
@@ -101,28 +209,29 @@ static void dropFrameState(void) {
     cleanupFrameState();
 }
 
-// Cleanup the list of decode units
-static void freeDecodeUnitList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
-    PLINKED_BLOCKING_QUEUE_ENTRY nextEntry;
-
-    while (entry != NULL) {
-        nextEntry = entry->flink;
-
-        // Complete this with a failure status
-        completeQueuedDecodeUnit((PQUEUED_DECODE_UNIT)entry->data, DR_CLEANUP);
-
-        entry = nextEntry;
-    }
-}
-
 void stopVideoDepacketizer(void) {
-    LbqSignalQueueShutdown(&decodeUnitQueue);
+    SpscSignalRingShutdown(&decodeUnitRing);
 }
 
 // Cleanup video depacketizer and free malloced memory
 void destroyVideoDepacketizer(void) {
-    freeDecodeUnitList(LbqDestroyLinkedBlockingQueue(&decodeUnitQueue));
+    PQUEUED_DECODE_UNIT qdu;
+
+    // Complete anything left in the ring with a failure status
+    while (SpscPollSlot(&decodeUnitRing, (void**)&qdu) != SPSC_NO_ELEMENT) {
+        completeQueuedDecodeUnit(qdu, DR_CLEANUP);
+    }
+    SpscDestroyRing(&decodeUnitRing);
     cleanupFrameState();
+
+    while (frameBufferFreeList != NULL) {
+        PFRAME_BUFFER frameBuffer = frameBufferFreeList;
+        frameBufferFreeList = frameBuffer->next;
+        free(frameBuffer->data);
+        free(frameBuffer);
+    }
+    frameBufferFreeCount = 0;
+    PltDeleteMutex(&frameBufferLock);
 }
 
 // Returns 1 if candidate is a frame start and 0 otherwise
@@ -135,11 +244,6 @@ static int isSeqAnnexBStart(PBUFFER_DESC candidate) {
     return (candidate->data[candidate->offset + candidate->length - 1] == 1);
 }
 
-// Returns 1 if candidate is padding and 0 otherwise
-static int isSeqPadding(PBUFFER_DESC candidate) {
-    return (candidate->data[candidate->offset + candidate->length - 1] == 0);
-}
-
 // Returns 1 on success, 0 otherwise
 static int getSpecialSeq(PBUFFER_DESC current, PBUFFER_DESC candidate) {
     if (current->length < 3) {
@@ -179,38 +283,49 @@ static int getSpecialSeq(PBUFFER_DESC current, PBUFFER_DESC candidate) {
 
 // Get the first decode unit available
 int getNextQueuedDecodeUnit(PQUEUED_DECODE_UNIT* qdu) {
-    int err = LbqWaitForQueueElement(&decodeUnitQueue, (void**)qdu);
-    if (err == LBQ_SUCCESS) {
-        return 1;
-    }
-    else {
-        return 0;
+    int err;
+
+    for (;;) {
+        err = SpscWaitForSlot(&decodeUnitRing, (void**)qdu);
+        if (err == SPSC_SUCCESS) {
+            return 1;
+        }
+        else if (err == SPSC_FLUSHED) {
+            // Queued before the last flush, so complete this with a failure status
+            completeQueuedDecodeUnit(*qdu, DR_CLEANUP);
+        }
+        else {
+            return 0;
+        }
     }
 }
 
 // Cleanup a decode unit by freeing the buffer chain and the holder
 void completeQueuedDecodeUnit(PQUEUED_DECODE_UNIT qdu, int drStatus) {
-    PLENTRY_INTERNAL lastEntry;
-
     if (drStatus == DR_NEED_IDR) {
         Limelog("Requesting IDR frame on behalf of DR\n");
         requestDecoderRefresh();
     }
-    else if (drStatus == DR_OK && qdu->decodeUnit.frameType == FRAME_TYPE_IDR) {
+    else if ((drStatus == DR_OK || drStatus == DR_RETAIN_BUFFER) &&
+             qdu->decodeUnit.frameType == FRAME_TYPE_IDR) {
         // Remember that the IDR frame was processed. We can now use
         // reference frame invalidation.
         idrFrameProcessed = 1;
     }
 
-    while (qdu->decodeUnit.bufferList != NULL) {
-        lastEntry = (PLENTRY_INTERNAL)qdu->decodeUnit.bufferList;
-        qdu->decodeUnit.bufferList = lastEntry->entry.next;
-        free(lastEntry->allocPtr);
+    // The decoder frees the buffer list itself if it kept it
+    if (drStatus == DR_RETAIN_BUFFER) {
+        LC_ASSERT(contiguousDecodeUnits);
+    }
+    else {
+        freeNalChain(qdu->decodeUnit.bufferList);
     }
+    qdu->decodeUnit.bufferList = NULL;
 
-    // We will have stack-allocated entries iff we have a direct-submit decoder
+    // We will have stack-allocated entries iff we have a direct-submit decoder.
+    // Otherwise this is the oldest slot the decoder thread took from the ring.
     if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-        free(qdu);
+        SpscReleaseSlot(&decodeUnitRing);
     }
 }
 
@@ -244,64 +359,91 @@ static int isIdrFrameStart(PBUFFER_DESC buffer) {
          specialSeq.data[specialSeq.offset + specialSeq.length] == 0x40); // H265 VPS
 }
 
-// Reassemble the frame with the given frame number
-static void reassembleFrame(int frameNumber) {
-    if (nalChainHead != NULL) {
-        QUEUED_DECODE_UNIT qduDS;
-        PQUEUED_DECODE_UNIT qdu;
-
-        // Use a stack allocation if we won't be queuing this
-        if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-            qdu = (PQUEUED_DECODE_UNIT)malloc(sizeof(*qdu));
-        }
-        else {
-            qdu = &qduDS;
-        }
-
-        if (qdu != NULL) {
-            qdu->decodeUnit.bufferList = nalChainHead;
-            qdu->decodeUnit.fullLength = nalChainDataLength;
-            qdu->decodeUnit.frameNumber = frameNumber;
-            qdu->decodeUnit.receiveTimeMs = firstPacketReceiveTime;
-            qdu->decodeUnit.presentationTimeMs = firstPacketPresentationTime;
+// Hands the current NAL chain to the decoder as a whole frame or, if isSliceUnit
+// is set, as a slice unit with the given SLICE_FLAG_* values. Returns 1 if the
+// chain was submitted.
+static int submitNalChain(int frameNumber, int isSliceUnit, int sliceFlags) {
+    QUEUED_DECODE_UNIT qduDS;
+    PQUEUED_DECODE_UNIT qdu;
 
-            // IDR frames will have leading CSD buffers
-            if (nalChainHead->bufferType != BUFFER_TYPE_PICDATA) {
-                qdu->decodeUnit.frameType = FRAME_TYPE_IDR;
+    // Use a stack allocation if we won't be queuing this
+    if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+        qdu = (PQUEUED_DECODE_UNIT)SpscGetFreeSlot(&decodeUnitRing);
+        if (qdu == NULL) {
+            Limelog("Video decode unit queue overflow\n");
+
+            // Clear frame state and wait for an IDR
+            if (decodingFrame) {
+                // We're partway through a sliced frame, so the rest of it
+                // will be dropped when it ends.
+                cleanupFrameState();
+                waitingForIdrFrame = 1;
             }
             else {
-                qdu->decodeUnit.frameType = FRAME_TYPE_PFRAME;
+                dropFrameState();
             }
 
-            nalChainHead = nalChainTail = NULL;
-            nalChainDataLength = 0;
+            // Flush the decode unit queue. The decoder thread completes
+            // the flushed decode units as it gets to them.
+            TRACE_INSTANT("Decode unit queue overflow", frameNumber);
+            SpscFlushRing(&decodeUnitRing);
+
+            // FIXME: Get proper bounds to use reference frame invalidation
+            requestIdrOnDemand();
+            return 0;
+        }
+    }
+    else {
+        qdu = &qduDS;
+    }
 
-            if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-                if (LbqOfferQueueItem(&decodeUnitQueue, qdu, &qdu->entry) == LBQ_BOUND_EXCEEDED) {
-                    Limelog("Video decode unit queue overflow\n");
+    qdu->decodeUnit.bufferList = nalChainHead;
+    qdu->decodeUnit.fullLength = nalChainDataLength;
+    qdu->decodeUnit.frameNumber = frameNumber;
+    qdu->decodeUnit.receiveTimeMs = firstPacketReceiveTime;
+    qdu->decodeUnit.presentationTimeMs = firstPacketPresentationTime;
+    qdu->decodeUnit.fecCompleteTimeMs = lastPacketFecCompleteTime;
+    qdu->decodeUnit.enqueueTimeMs = PltGetMillis();
+    qdu->isSliceUnit = isSliceUnit;
+    qdu->sliceFlags = sliceFlags;
+
+    // IDR frames will have leading CSD buffers
+    if (nalChainHead->bufferType != BUFFER_TYPE_PICDATA) {
+        qdu->decodeUnit.frameType = FRAME_TYPE_IDR;
+    }
+    else {
+        qdu->decodeUnit.frameType = FRAME_TYPE_PFRAME;
+    }
 
-                    // Clear frame state and wait for an IDR
-                    nalChainHead = qdu->decodeUnit.bufferList;
-                    nalChainDataLength = qdu->decodeUnit.fullLength;
-                    dropFrameState();
+    nalChainHead = nalChainTail = NULL;
+    nalChainDataLength = 0;
+    currentFrameBuffer = NULL;
 
-                    // Free the DU
-                    free(qdu);
+    if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+        SpscCommitSlot(&decodeUnitRing);
+        TRACE_COUNTER("Queued decode units", SpscGetItemCount(&decodeUnitRing));
+    }
+    else {
+        int ret;
 
-                    // Flush the decode unit queue
-                    freeDecodeUnitList(LbqFlushQueueItems(&decodeUnitQueue));
+        if (isSliceUnit) {
+            ret = VideoCallbacks.submitSliceUnit(&qdu->decodeUnit, sliceFlags);
+        }
+        else {
+            ret = VideoCallbacks.submitDecodeUnit(&qdu->decodeUnit);
+        }
 
-                    // FIXME: Get proper bounds to use reference frame invalidation
-                    requestIdrOnDemand();
-                    return;
-                }
-            }
-            else {
-                int ret = VideoCallbacks.submitDecodeUnit(&qdu->decodeUnit);
+        completeQueuedDecodeUnit(qdu, ret);
+    }
 
-                completeQueuedDecodeUnit(qdu, ret);
-            }
+    return 1;
+}
 
+// Reassemble the frame with the given frame number, or submit whatever is
+// left of it if we've already submitted some of its slices
+static void reassembleFrame(int frameNumber) {
+    if (nalChainHead != NULL) {
+        if (submitNalChain(frameNumber, slicesSubmitted != 0, SLICE_FLAG_LAST)) {
             // Notify the control connection
             connectionReceivedCompleteFrame(frameNumber);
 
@@ -347,11 +489,128 @@ static int getBufferFlags(char* data, int length) {
     }
 }
 
+// Makes sure the frame buffer can hold another length bytes
+static int growFrameBuffer(PFRAME_BUFFER frameBuffer, int length) {
+    char* data;
+    int capacity;
+    int i;
+
+    if (frameBuffer->length + length <= frameBuffer->capacity) {
+        return 0;
+    }
+
+    capacity = frameBuffer->capacity;
+    while (capacity < frameBuffer->length + length) {
+        capacity *= 2;
+    }
+
+    data = (char*)realloc(frameBuffer->data, capacity);
+    if (data == NULL) {
+        return -1;
+    }
+
+    // Entries point into the old allocation
+    for (i = 0; i < frameBuffer->entryCount; i++) {
+        frameBuffer->entries[i].entry.data = data + (frameBuffer->entries[i].entry.data - frameBuffer->data);
+    }
+
+    frameBuffer->data = data;
+    frameBuffer->capacity = capacity;
+    return 0;
+}
+
+// Appends a fragment to the current frame buffer for a contiguous decode unit
+// Gives up on the frame being received when we have nowhere to put the rest
+// of it. A truncated frame would corrupt the picture until the next IDR frame
+// anyway, so we drop it and ask for one now.
+static void abortContiguousFrame(PFRAME_BUFFER frameBuffer) {
+    Limelog("Out of memory for frame %d\n", nextFrameNumber);
+
+    if (frameBuffer != NULL && frameBuffer->entryCount == 0) {
+        // It isn't in the NAL chain yet, so dropping the frame state won't free it
+        freeFrameBuffer(frameBuffer);
+    }
+
+    abortRtpFrame();
+
+    waitingForIdrFrame = 1;
+    requestIdrOnDemand();
+}
+
+static void queueContiguousFragment(char* data, int offset, int length) {
+    PFRAME_BUFFER frameBuffer = currentFrameBuffer;
+    PLENTRY_INTERNAL entry;
+    char* fragment;
+    int bufferType;
+
+    if (!decodingFrame) {
+        // We gave up on this frame earlier in the packet
+        return;
+    }
+
+    if (frameBuffer == NULL) {
+        // This is the first fragment in the decode unit
+        LC_ASSERT(nalChainHead == NULL);
+        frameBuffer = allocateFrameBuffer();
+        if (frameBuffer == NULL) {
+            abortContiguousFrame(NULL);
+            return;
+        }
+        currentFrameBuffer = frameBuffer;
+    }
+
+    if (growFrameBuffer(frameBuffer, length) != 0) {
+        abortContiguousFrame(frameBuffer);
+        return;
+    }
+
+    fragment = &frameBuffer->data[frameBuffer->length];
+    memcpy(fragment, &data[offset], length);
+    frameBuffer->length += length;
+    nalChainDataLength += length;
+
+    bufferType = getBufferFlags(fragment, length);
+
+    if (frameBuffer->entryCount != 0) {
+        entry = &frameBuffer->entries[frameBuffer->entryCount - 1];
+
+        // Picture data continues the previous picture data entry
+        if ((bufferType == BUFFER_TYPE_PICDATA && entry->entry.bufferType == BUFFER_TYPE_PICDATA) ||
+                frameBuffer->entryCount == FRAME_BUFFER_MAX_ENTRIES) {
+            entry->entry.length += length;
+            return;
+        }
+    }
+
+    entry = &frameBuffer->entries[frameBuffer->entryCount++];
+    entry->entry.next = NULL;
+    entry->entry.data = fragment;
+    entry->entry.length = length;
+    entry->entry.bufferType = bufferType;
+    entry->allocPtr = frameBuffer;
+
+    if (nalChainTail == NULL) {
+        LC_ASSERT(nalChainHead == NULL);
+        nalChainHead = nalChainTail = (PLENTRY)entry;
+    }
+    else {
+        LC_ASSERT(nalChainHead != NULL);
+        nalChainTail->next = (PLENTRY)entry;
+        nalChainTail = nalChainTail->next;
+    }
+}
+
 // As an optimization, we can cast the existing packet buffer to a PLENTRY and avoid
 // a malloc() and a memcpy() of the packet data.
 static void queueFragment(PLENTRY_INTERNAL* existingEntry, char* data, int offset, int length) {
     PLENTRY_INTERNAL entry;
 
+    if (contiguousDecodeUnits) {
+        // The data is copied out, so the caller keeps the packet buffer
+        queueContiguousFragment(data, offset, length);
+        return;
+    }
+
     if (existingEntry == NULL || *existingEntry == NULL) {
         entry = (PLENTRY_INTERNAL)malloc(sizeof(*entry) + length);
     }
@@ -397,6 +656,88 @@ static void queueFragment(PLENTRY_INTERNAL* existingEntry, char* data, int offse
     }
 }
 
+// Returns the offset of the last Annex B start code in the buffer (including
+// the leading zero of a 4 byte start code) or -1 if there isn't one
+static int findLastStartCode(char* data, int length) {
+    int last = -1;
+    int offset = 0;
+    int next;
+
+    while ((next = AnbFindStartCode((unsigned char*)&data[offset], length - offset)) >= 0) {
+        last = offset + next;
+        offset = last + 3;
+    }
+
+    if (last > 0 && data[last - 1] == 0) {
+        last--;
+    }
+
+    return last;
+}
+
+// Returns 1 if the NAL chain holds the start of a P-frame slice that can be
+// submitted before the rest of the frame arrives
+static int canSubmitSlice(void) {
+    return sliceSubmitEnabled && !waitingForIdrFrame && !dropStatePending &&
+        nalChainHead != NULL && nalChainHead->bufferType == BUFFER_TYPE_PICDATA;
+}
+
+// Queues picture data like queueFragment(), but first submits the slices that
+// end in this packet when the renderer accepts partial frames. A start code
+// split across two packets isn't seen here, so those two slices are just
+// submitted together later.
+static void queueSliceFragment(PLENTRY_INTERNAL* existingEntry, char* data, int offset, int length, int frameNumber) {
+    int sliceStart = findLastStartCode(&data[offset], length);
+
+    if (sliceStart >= 0 && canSubmitSlice()) {
+        if (sliceStart > 0) {
+            // The packet buffer belongs to the next slice, so the end
+            // of the previous slice is copied out of it.
+            queueFragment(NULL, data, offset, sliceStart);
+            offset += sliceStart;
+            length -= sliceStart;
+
+            if (!decodingFrame) {
+                // We had to give up on the frame
+                return;
+            }
+        }
+
+        if (submitNalChain(frameNumber, 1, slicesSubmitted == 0 ? SLICE_FLAG_FIRST : 0)) {
+            slicesSubmitted++;
+        }
+    }
+
+    queueFragment(existingEntry, data, offset, length);
+}
+
+// Advances currentPos to the next special sequence that should end the current
+// NAL. Padding only ends video NALs, so anything else runs to the next start code.
+static void skipToNalEnd(PBUFFER_DESC currentPos, int decodingVideo) {
+    unsigned char* data = (unsigned char*)&currentPos->data[currentPos->offset];
+    int end;
+
+    if (decodingVideo) {
+        end = AnbFindNalEnd(data, currentPos->length);
+    }
+    else {
+        end = AnbFindStartCode(data, currentPos->length);
+
+        // Stop at the leading zero of a 4 byte start code
+        if (end > 0 && data[end - 1] == 0) {
+            end--;
+        }
+    }
+
+    if (end < 0) {
+        // This NAL runs to the end of the packet
+        end = currentPos->length;
+    }
+
+    currentPos->offset += end;
+    currentPos->length -= end;
+}
+
 // Process an RTP Payload using the slow path that handles multiple NALUs per packet
 static void processRtpPayloadSlow(PBUFFER_DESC currentPos, PLENTRY_INTERNAL* existingEntry) {
     BUFFER_DESC specialSeq;
@@ -447,18 +788,7 @@ static void processRtpPayloadSlow(PBUFFER_DESC currentPos, PLENTRY_INTERNAL* exi
         }
 
         // Move to the next special sequence
-        while (currentPos->length != 0) {
-            // Check if this should end the current NAL
-            if (getSpecialSeq(currentPos, &specialSeq)) {
-                if (decodingVideo || !isSeqPadding(&specialSeq)) {
-                    break;
-                }
-            }
-
-            // This byte is part of the NAL data
-            currentPos->offset++;
-            currentPos->length--;
-        }
+        skipToNalEnd(currentPos, decodingVideo);
 
         if (decodingVideo) {
             // To minimize copies, we'll use allocate for SPS, PPS, and VPS to allow
@@ -476,7 +806,7 @@ void requestDecoderRefresh(void) {
     waitingForIdrFrame = 1;
     
     // Flush the decode unit queue
-    freeDecodeUnitList(LbqFlushQueueItems(&decodeUnitQueue));
+    SpscFlushRing(&decodeUnitRing);
     
     // Request the receive thread drop its state
     // on the next call. We can't do it here because
@@ -509,9 +839,6 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length,
     unsigned int firstPacket;
     unsigned int streamPacketIndex;
 
-    // Mask the top 8 bits from the SPI
-    videoPacket->streamPacketIndex >>= 8;
-    videoPacket->streamPacketIndex &= 0xFFFFFF;
 
     currentPos.data = (char*)(videoPacket + 1);
     currentPos.offset = 0;
@@ -523,7 +850,9 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length,
 
     LC_ASSERT((flags & ~(FLAG_SOF | FLAG_EOF | FLAG_CONTAINS_PIC_DATA)) == 0);
 
-    streamPacketIndex = videoPacket->streamPacketIndex;
+    // Mask the top 8 bits from the SPI. The packet isn't modified, since the
+    // FEC queue may still need it for recovery.
+    streamPacketIndex = (videoPacket->streamPacketIndex >> 8) & 0xFFFFFF;
     
     // Drop packets from a previously corrupt frame
     if (isBefore32(frameIndex, nextFrameNumber)) {
@@ -567,6 +896,7 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length,
 
         // We're now decoding a frame
         decodingFrame = 1;
+        slicesSubmitted = 0;
         firstPacketReceiveTime = receiveTimeMs;
         firstPacketPresentationTime = presentationTimeMs;
     }
@@ -625,11 +955,20 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length,
         // SPS and PPS prefix is padded between NALs, so we must decode it with the slow path
         processRtpPayloadSlow(&currentPos, existingEntry);
     }
+    else if (sliceSubmitEnabled)
+    {
+        queueSliceFragment(existingEntry, currentPos.data, currentPos.offset, currentPos.length, frameIndex);
+    }
     else
     {
         queueFragment(existingEntry, currentPos.data, currentPos.offset, currentPos.length);
     }
 
+    if (!decodingFrame) {
+        // The frame was dropped while we were queueing this packet
+        return;
+    }
+
     if (flags & FLAG_EOF) {
         // Move on to the next frame
         decodingFrame = 0;
@@ -677,38 +1016,76 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length,
     }
 }
 
-// Add an RTP Packet to the queue
-void queueRtpPacket(PRTPFEC_QUEUE_ENTRY queueEntryPtr) {
+static void processRtpPacket(PRTPFEC_QUEUE_ENTRY queueEntryPtr, int borrowed) {
     int dataOffset;
     RTPFEC_QUEUE_ENTRY queueEntry = *queueEntryPtr;
+    PLENTRY_INTERNAL existingEntry;
 
     LC_ASSERT(!queueEntry.isParity);
     LC_ASSERT(queueEntry.receiveTimeMs != 0);
+    LC_ASSERT(queueEntry.fecCompleteTimeMs != 0);
+
+    lastPacketFecCompleteTime = queueEntry.fecCompleteTimeMs;
 
     dataOffset = sizeof(*queueEntry.packet);
     if (queueEntry.packet->header & FLAG_EXTENSION) {
         dataOffset += 4; // 2 additional fields
     }
 
-    // Reuse the memory reserved for the RTPFEC_QUEUE_ENTRY to store the LENTRY_INTERNAL
-    // now that we're in the depacketizer. We saved a copy of the real FEC queue entry
-    // on the stack here so we can safely modify this memory in place.
-    LC_ASSERT(sizeof(LENTRY_INTERNAL) <= sizeof(RTPFEC_QUEUE_ENTRY));
-    PLENTRY_INTERNAL existingEntry = (PLENTRY_INTERNAL)queueEntryPtr;
-    existingEntry->allocPtr = queueEntry.packet;
+    if (borrowed) {
+        // Anything we keep has to be copied out
+        existingEntry = NULL;
+    }
+    else {
+        // Reuse the memory reserved for the RTPFEC_QUEUE_ENTRY to store the LENTRY_INTERNAL
+        // now that we're in the depacketizer. We saved a copy of the real FEC queue entry
+        // on the stack here so we can safely modify this memory in place.
+        LC_ASSERT(sizeof(LENTRY_INTERNAL) <= sizeof(RTPFEC_QUEUE_ENTRY));
+        existingEntry = (PLENTRY_INTERNAL)queueEntryPtr;
+        existingEntry->allocPtr = queueEntry.packet;
+    }
 
     processRtpPayload((PNV_VIDEO_PACKET)(((char*)queueEntry.packet) + dataOffset),
                       queueEntry.length - dataOffset,
                       queueEntry.receiveTimeMs,
                       queueEntry.presentationTimeMs,
-                      &existingEntry);
+                      borrowed ? NULL : &existingEntry);
 
     if (existingEntry != NULL) {
         // processRtpPayload didn't want this packet, so just free it
-        free(existingEntry->allocPtr);
+        freeVideoPacketBuffer(existingEntry->allocPtr);
     }
 }
 
+// Add an RTP Packet to the queue. The depacketizer takes ownership of the packet.
+void queueRtpPacket(PRTPFEC_QUEUE_ENTRY queueEntry) {
+    processRtpPacket(queueEntry, 0);
+}
+
+// Add an RTP Packet to the queue without taking ownership of it. The packet and
+// its queue entry are left untouched, so the FEC queue can still use them to
+// recover the rest of the frame. In contiguous mode this costs nothing, since
+// the data is copied into the frame buffer either way.
+void queueBorrowedRtpPacket(PRTPFEC_QUEUE_ENTRY queueEntry) {
+    processRtpPacket(queueEntry, 1);
+}
+
+// Called by the FEC queue when it gives up on a frame after it already
+// passed us some of that frame's packets
+void abortRtpFrame(void) {
+    if (decodingFrame) {
+        Limelog("Dropping partially received frame %d\n", nextFrameNumber);
+        decodingFrame = 0;
+        nextFrameNumber++;
+        waitingForNextSuccessfulFrame = 1;
+        dropFrameState();
+    }
+}
+
+void LiReleaseDecodeUnitBuffer(PLENTRY bufferList) {
+    freeNalChain(bufferList);
+}
+
 int LiGetPendingVideoFrames(void) {
-    return LbqGetItemCount(&decodeUnitQueue);
+    return SpscGetItemCount(&decodeUnitRing);
 }
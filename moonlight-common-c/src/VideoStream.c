@@ -2,6 +2,7 @@
 #include "PlatformSockets.h"
 #include "PlatformThreads.h"
 #include "RtpFecQueue.h"
+#include "BufferPool.h"
 
 #define FIRST_FRAME_MAX 1500
 #define FIRST_FRAME_TIMEOUT_SEC 10
@@ -12,6 +13,7 @@
 #define RTP_RECV_BUFFER (512 * 1024)
 
 static RTP_FEC_QUEUE rtpQueue;
+static BUFFER_POOL packetPool;
 
 static SOCKET rtpSocket = INVALID_SOCKET;
 static SOCKET firstFrameSocket = INVALID_SOCKET;
@@ -30,15 +32,43 @@ static int receivedDataFromPeer;
 
 // Initialize the video stream
 void initializeVideoStream(void) {
+    if (BpInitializePool(&packetPool,
+                         StreamConfig.packetSize + MAX_RTP_HEADER_SIZE + sizeof(RTPFEC_QUEUE_ENTRY),
+                         VIDEO_PACKET_POOL_BUFFERS) != 0) {
+        Limelog("Video packet pool allocation failed; using malloc()\n");
+    }
     initializeVideoDepacketizer(StreamConfig.packetSize);
-    RtpfInitializeQueue(&rtpQueue); //TODO RTP_QUEUE_DELAY
+    RtpfInitializeQueue(&rtpQueue, RTP_FEC_FRAME_WINDOW,
+                        (VideoCallbacks.capabilities & CAPABILITY_SLICE_SUBMIT) != 0); //TODO RTP_QUEUE_DELAY
     receivedDataFromPeer = 0;
 }
 
 // Clean up the video stream
 void destroyVideoStream(void) {
+    unsigned int hits, misses;
+
     destroyVideoDepacketizer();
     RtpfCleanupQueue(&rtpQueue);
+
+    BpGetStatistics(&packetPool, &hits, &misses);
+    Limelog("Video packet pool: %u hits, %u misses\n", hits, misses);
+    BpCleanupPool(&packetPool);
+}
+
+// Packet buffers are sized for a full RTP packet plus its trailing
+// RTPFEC_QUEUE_ENTRY. Any malloc()ed pointer may be passed to
+// freeVideoPacketBuffer(), not just ones from the pool.
+void* allocateVideoPacketBuffer(void) {
+    return BpAllocateBuffer(&packetPool);
+}
+
+void freeVideoPacketBuffer(void* buffer) {
+    BpFreeBuffer(&packetPool, buffer);
+}
+
+void LiGetFecStatistics(PFEC_STATISTICS stats) {
+    memcpy(stats, &rtpQueue.stats, sizeof(*stats));
+    BpGetStatistics(&packetPool, &stats->packetPoolHits, &stats->packetPoolMisses);
 }
 
 // UDP Ping proc
@@ -71,13 +101,12 @@ static void UdpPingThreadProc(void* context) {
 // Receive thread proc
 static void ReceiveThreadProc(void* context) {
     int err;
-    int bufferSize, receiveSize;
+    int receiveSize;
     char* buffer;
     int queueStatus;
     int useSelect;
 
     receiveSize = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
-    bufferSize = receiveSize + sizeof(RTPFEC_QUEUE_ENTRY);
     buffer = NULL;
 
     if (setNonFatalRecvTimeoutMs(rtpSocket, UDP_RECV_POLL_TIMEOUT_MS) < 0) {
@@ -93,7 +122,7 @@ static void ReceiveThreadProc(void* context) {
         PRTP_PACKET packet;
 
         if (buffer == NULL) {
-            buffer = (char*)malloc(bufferSize);
+            buffer = (char*)allocateVideoPacketBuffer();
             if (buffer == NULL) {
                 Limelog("Video Receive: malloc() failed\n");
                 ListenerCallbacks.connectionTerminated(-1);
@@ -112,6 +141,8 @@ static void ReceiveThreadProc(void* context) {
             continue;
         }
 
+        CAPTURE_DATAGRAM(CAPTURE_STREAM_VIDEO, buffer, err);
+
         // We've received data, so we can stop sending our ping packets
         // as quickly, since we're now just keeping the NAT session open.
         receivedDataFromPeer = 1;
@@ -131,7 +162,7 @@ static void ReceiveThreadProc(void* context) {
     }
 
     if (buffer != NULL) {
-        free(buffer);
+        freeVideoPacketBuffer(buffer);
     }
 }
 
@@ -143,7 +174,15 @@ static void DecoderThreadProc(void* context) {
             return;
         }
 
-        int ret = VideoCallbacks.submitDecodeUnit(&qdu->decodeUnit);
+        int ret;
+        TRACE_BEGIN("Submit decode unit", qdu->decodeUnit.frameNumber);
+        if (qdu->isSliceUnit) {
+            ret = VideoCallbacks.submitSliceUnit(&qdu->decodeUnit, qdu->sliceFlags);
+        }
+        else {
+            ret = VideoCallbacks.submitDecodeUnit(&qdu->decodeUnit);
+        }
+        TRACE_END("Submit decode unit", qdu->decodeUnit.frameNumber);
 
         completeQueuedDecodeUnit(qdu, ret);
     }
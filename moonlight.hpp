@@ -28,15 +28,24 @@
 
 #include <opus_multistream.h>
 
-// Uncomment this line to enable the profiling infrastructure
-//#define ENABLE_PROFILING 1
+#include "pacer.hpp"
+#include "latency.hpp"
+#include "jitterbuffer.hpp"
 
-// Use this define to choose the time threshold in milliseconds above
-// which a profiling message is printed
-#define PROFILING_MESSAGE_THRESHOLD 1
+#define DR_FLAG_FORCE_SW_DECODE     0x01
 
+// Number of decode units that can be waiting on the decoder at once. The
+// decoder thread only blocks when all of them are in use.
+#define MAX_DECODES_IN_FLIGHT 3
 
-#define DR_FLAG_FORCE_SW_DECODE     0x01
+// Interval in milliseconds between FEC statistics updates sent to JS
+#define FEC_STATS_INTERVAL_MS 1000
+
+// Interval in milliseconds between audio jitter buffer statistics updates sent to JS
+#define AUDIO_STATS_INTERVAL_MS 1000
+
+// Interval in milliseconds between frame pacing and latency statistics updates sent to JS
+#define PACING_STATS_INTERVAL_MS 1000
 
 // These will mostly be I/O bound so we'll create
 // a bunch to allow more concurrent server requests
@@ -56,10 +65,14 @@ class MoonlightInstance : public pp::Instance, public pp::MouseLock {
         explicit MoonlightInstance(PP_Instance instance) :
             pp::Instance(instance),
             pp::MouseLock(this),
-            m_HasNextPicture(false),
             m_IsPainting(false),
+            m_PacingTimerPending(false),
+            m_FramePacingPolicy(FRAME_PACING_LOWEST_LATENCY),
+            m_LastPacingStatsTime(0),
             m_RequestIdrFrame(false),
             m_OpusDecoder(NULL),
+            m_AudioLatencyMs(AUDIO_JITTER_DEFAULT_TARGET_MS),
+            m_AudioConfiguration(AUDIO_CONFIGURATION_STEREO),
             m_CallbackFactory(this),
             m_MouseLocked(false),
             m_WaitingForAllModifiersUp(false),
@@ -98,11 +111,20 @@ class MoonlightInstance : public pp::Instance, public pp::MouseLock {
         void HandleStopStream(int32_t callbackId, pp::VarArray args);
         void HandleOpenURL(int32_t callbackId, pp::VarArray args);
         void HandleSTUN(int32_t callbackId, pp::VarArray args);
+        void HandleSetFramePacing(int32_t callbackId, pp::VarArray args);
+        void HandleSetAudioLatency(int32_t callbackId, pp::VarArray args);
+        void HandleSetAudioConfiguration(int32_t callbackId, pp::VarArray args);
+        void HandleStartTrace(int32_t callbackId, pp::VarArray args);
+        void HandleStopTrace(int32_t callbackId, pp::VarArray args);
         void PairCallback(int32_t /*result*/, int32_t callbackId, pp::VarArray args);
         void STUNCallback(int32_t /*result*/, int32_t callbackId, pp::VarArray args);
     
         bool HandleInputEvent(const pp::InputEvent& event);
         void ReportMouseMovement();
+        void ReportFecStatistics();
+        void ReportPacingStatistics();
+        void ReportLatencyStatistics();
+        void ReportAudioStatistics();
         
         void PollGamepads();
         
@@ -113,15 +135,6 @@ class MoonlightInstance : public pp::Instance, public pp::MouseLock {
         void OnConnectionStarted(uint32_t error);
         void StopConnection();
 
-        static uint32_t ProfilerGetPackedMillis();
-        static uint64_t ProfilerGetMillis();
-        static uint64_t ProfilerUnpackTime(uint32_t packedTime);
-        static void ProfilerPrintPackedDelta(const char* message, uint32_t packedTimeA, uint32_t packedTimeB);
-        static void ProfilerPrintDelta(const char* message, uint64_t timeA, uint64_t timeB);
-        static void ProfilerPrintPackedDeltaFromNow(const char* message, uint32_t packedTime);
-        static void ProfilerPrintDeltaFromNow(const char* message, uint64_t time);
-        static void ProfilerPrintWarning(const char* message);
-
         static void* ConnectionThreadFunc(void* context);
         static void* InputThreadFunc(void* context);
         static void* StopThreadFunc(void* context);
@@ -140,7 +153,11 @@ class MoonlightInstance : public pp::Instance, public pp::MouseLock {
         void PaintFinished(int32_t result);
         void DispatchGetPicture(uint32_t unused);
         void PictureReady(int32_t result, PP_VideoPicture picture);
+        void DispatchDecode(uint32_t unused);
+        void StartNextDecode(void);
+        void DecodeDone(int32_t result);
         void PaintPicture(void);
+        void PacingTimerFired(int32_t result);
         bool InitializeRenderingSurface(int width, int height);
         void DidChangeFocus(bool got_focus);
         
@@ -179,14 +196,20 @@ class MoonlightInstance : public pp::Instance, public pp::MouseLock {
         Shader m_Texture2DShader;
         Shader m_RectangleArbShader;
         Shader m_ExternalOesShader;
-        PP_VideoPicture m_NextPicture;
-        bool m_HasNextPicture;
         PP_VideoPicture m_CurrentPicture;
         bool m_IsPainting;
+        FramePacer m_FramePacer;
+        LatencyTracker m_LatencyTracker;
+        bool m_PacingTimerPending;
+        FramePacingPolicy m_FramePacingPolicy;
+        uint64_t m_LastPacingStatsTime;
         bool m_RequestIdrFrame;
     
         OpusMSDecoder* m_OpusDecoder;
         pp::Audio m_AudioPlayer;
+        AudioJitterBuffer m_AudioJitterBuffer;
+        int m_AudioLatencyMs;
+        int m_AudioConfiguration;
         
         double m_LastPadTimestamps[4];
         const PPB_Gamepad* m_GamepadApi;
@@ -0,0 +1,125 @@
+#include "pacer.hpp"
+
+#include <string.h>
+
+FramePacer::FramePacer() {
+    Reset(FRAME_PACING_LOWEST_LATENCY, 60);
+}
+
+void FramePacer::Reset(FramePacingPolicy policy, int fps) {
+    m_Policy = policy;
+    m_FrameIntervalMs = 1000.0 / (fps > 0 ? fps : 60);
+    m_Queue.clear();
+    m_TargetBufferedFrames = (policy == FRAME_PACING_SMOOTHEST) ? FRAME_PACER_MAX_BUFFERED : 0;
+    m_LastReadyTime = 0;
+    m_JitterMs = 0;
+    m_PresentingReadyTime = 0;
+    m_LastPresentTime = 0;
+    memset(&m_Stats, 0, sizeof(m_Stats));
+    m_TotalPresentLatencyMs = 0;
+}
+
+void FramePacer::UpdateJitter(uint64_t now) {
+    if (m_LastReadyTime != 0) {
+        double deviation = (double)(now - m_LastReadyTime) - m_FrameIntervalMs;
+        if (deviation < 0) {
+            deviation = -deviation;
+        }
+        m_JitterMs += (deviation - m_JitterMs) / 16;
+    }
+    m_LastReadyTime = now;
+
+    if (m_Policy == FRAME_PACING_ADAPTIVE) {
+        // Twice the mean deviation covers nearly all late frames
+        int target = (int)(2 * m_JitterMs / m_FrameIntervalMs + 0.5);
+        m_TargetBufferedFrames = target > FRAME_PACER_MAX_BUFFERED ? FRAME_PACER_MAX_BUFFERED : target;
+    }
+}
+
+bool FramePacer::AddPicture(const PP_VideoPicture& picture, uint64_t now, PP_VideoPicture* dropped) {
+    QueuedPicture queued;
+    bool droppedPicture = false;
+
+    UpdateJitter(now);
+
+    // Only the newest picture is worth keeping for lowest latency
+    size_t limit = (m_Policy == FRAME_PACING_LOWEST_LATENCY) ? 1 : FRAME_PACER_MAX_BUFFERED + 1;
+    if (m_Queue.size() >= limit) {
+        *dropped = m_Queue.front().picture;
+        m_Queue.pop_front();
+        m_Stats.framesDropped++;
+        droppedPicture = true;
+    }
+
+    queued.picture = picture;
+    queued.readyTime = now;
+    m_Queue.push_back(queued);
+
+    return droppedPicture;
+}
+
+bool FramePacer::GetNextPicture(uint64_t now, PP_VideoPicture* picture, int* waitMs) {
+    *waitMs = 0;
+
+    if (m_Queue.empty()) {
+        return false;
+    }
+
+    // Present as soon as we have more than we want to hold back or the
+    // oldest picture has been held for as long as the buffer allows.
+    if ((int)m_Queue.size() <= m_TargetBufferedFrames) {
+        uint64_t dueTime = m_Queue.front().readyTime +
+            (uint64_t)(m_TargetBufferedFrames * m_FrameIntervalMs);
+        if (now < dueTime) {
+            *waitMs = (int)(dueTime - now);
+            return false;
+        }
+    }
+
+    *picture = m_Queue.front().picture;
+    m_PresentingReadyTime = m_Queue.front().readyTime;
+    m_Queue.pop_front();
+    return true;
+}
+
+void FramePacer::PicturePresented(uint64_t now) {
+    if (m_LastPresentTime != 0) {
+        // Count the stream frame intervals that went by without a new frame
+        int intervals = (int)((now - m_LastPresentTime) / m_FrameIntervalMs + 0.5);
+        if (intervals > 1) {
+            m_Stats.framesMissed += intervals - 1;
+        }
+    }
+    m_LastPresentTime = now;
+
+    m_Stats.framesPresented++;
+    m_TotalPresentLatencyMs += now - m_PresentingReadyTime;
+}
+
+void FramePacer::TakeStats(FRAME_PACER_STATS* stats) {
+    *stats = m_Stats;
+    if (m_Stats.framesPresented != 0) {
+        stats->averagePresentLatencyMs = (uint32_t)(m_TotalPresentLatencyMs / m_Stats.framesPresented);
+    }
+    stats->targetBufferedFrames = m_TargetBufferedFrames;
+
+    memset(&m_Stats, 0, sizeof(m_Stats));
+    m_TotalPresentLatencyMs = 0;
+}
+
+bool FramePacer::ParsePolicy(const char* name, FramePacingPolicy* policy) {
+    if (strcmp(name, "lowestLatency") == 0) {
+        *policy = FRAME_PACING_LOWEST_LATENCY;
+    }
+    else if (strcmp(name, "smoothest") == 0) {
+        *policy = FRAME_PACING_SMOOTHEST;
+    }
+    else if (strcmp(name, "adaptive") == 0) {
+        *policy = FRAME_PACING_ADAPTIVE;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
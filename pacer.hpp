@@ -0,0 +1,89 @@
+#pragma once
+
+#include "ppapi/c/ppb_video_decoder.h"
+
+#include <deque>
+#include <stdint.h>
+
+enum FramePacingPolicy {
+    // Always present the newest decoded picture as soon as possible
+    FRAME_PACING_LOWEST_LATENCY,
+
+    // Hold back a fixed 2 frames to absorb network and decoder jitter
+    FRAME_PACING_SMOOTHEST,
+
+    // Hold back 0-2 frames depending on the jitter we've measured
+    FRAME_PACING_ADAPTIVE
+};
+
+// Most frames that the jitter buffer will hold back
+#define FRAME_PACER_MAX_BUFFERED 2
+
+typedef struct _FRAME_PACER_STATS {
+    uint32_t framesPresented;
+    uint32_t framesDropped;
+
+    // Stream frame intervals that went by without a new picture being
+    // presented. This is counted against the stream's frame rate, not
+    // display refreshes.
+    uint32_t framesMissed;
+
+    // Average time from PictureReady() to the frame being on screen
+    uint32_t averagePresentLatencyMs;
+
+    // Number of frames currently being held back
+    int targetBufferedFrames;
+} FRAME_PACER_STATS;
+
+// Decides which decoded picture to present and when. All calls must be
+// made on the main thread.
+//
+// This is not vsync-aware. PPAPI doesn't tell us the display's refresh rate
+// or when the next refresh is, so pictures are held back in multiples of the
+// stream's frame interval and the caller wakes up for them with a millisecond
+// timer. The compositor still decides which refresh a swapped picture lands on.
+class FramePacer {
+    public:
+        FramePacer();
+
+        void Reset(FramePacingPolicy policy, int fps);
+
+        // Queues a picture from the decoder. Returns true if a picture has to
+        // be dropped to make room, which the caller must recycle.
+        bool AddPicture(const PP_VideoPicture& picture, uint64_t now, PP_VideoPicture* dropped);
+
+        // Returns true if picture should be presented now. Otherwise, waitMs is
+        // set to the time until one is due or 0 if there's nothing queued.
+        bool GetNextPicture(uint64_t now, PP_VideoPicture* picture, int* waitMs);
+
+        // Called when the picture from GetNextPicture() has been swapped to the screen
+        void PicturePresented(uint64_t now);
+
+        // Returns the counters since the last call and resets them
+        void TakeStats(FRAME_PACER_STATS* stats);
+
+        static bool ParsePolicy(const char* name, FramePacingPolicy* policy);
+
+    private:
+        struct QueuedPicture {
+            PP_VideoPicture picture;
+            uint64_t readyTime;
+        };
+
+        void UpdateJitter(uint64_t now);
+
+        FramePacingPolicy m_Policy;
+        double m_FrameIntervalMs;
+        std::deque<QueuedPicture> m_Queue;
+        int m_TargetBufferedFrames;
+
+        // Interarrival jitter of decoded pictures, smoothed like RFC 3550 does
+        uint64_t m_LastReadyTime;
+        double m_JitterMs;
+
+        uint64_t m_PresentingReadyTime;
+        uint64_t m_LastPresentTime;
+
+        FRAME_PACER_STATS m_Stats;
+        uint64_t m_TotalPresentLatencyMs;
+};
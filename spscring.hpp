@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+// Keeps the producer's and consumer's indices on separate cache lines
+#define SPSC_RING_CACHE_LINE_SIZE 64
+
+// Bounded single-producer/single-consumer ring of trivially copyable items.
+// One thread may call the producer methods and one other thread the consumer
+// methods at a time; neither side ever waits for the other.
+//
+// Indices run freely and wrap at 2^32, so the ring is never ambiguously full
+// or empty. Each side publishes its index with a release store and reads the
+// other's with an acquire load, so items are always visible before the index
+// that covers them. Each side also keeps the last index it saw from the other
+// and only reloads it when that copy says there isn't enough room or data,
+// which keeps the shared cache lines from bouncing on every call.
+//
+// The indices are kept apart by padding rather than alignment, since new
+// doesn't honor over-aligned types before C++17.
+template <typename T, uint32_t Capacity>
+class SpscRing {
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+    public:
+        SpscRing() {
+            Reset();
+        }
+
+        // Empties the ring. Must not be called while either side is active.
+        void Reset() {
+            m_WriteIndex.store(0, std::memory_order_relaxed);
+            m_CachedReadIndex = 0;
+            m_ReadIndex.store(0, std::memory_order_relaxed);
+            m_CachedWriteIndex = 0;
+        }
+
+        // Producer side. Returns how many items can be written right now.
+        uint32_t GetWriteAvailable() {
+            m_CachedReadIndex = m_ReadIndex.load(std::memory_order_acquire);
+            return Capacity - (m_WriteIndex.load(std::memory_order_relaxed) - m_CachedReadIndex);
+        }
+
+        // Producer side. Writes as many of count items as fit and returns how
+        // many that was.
+        uint32_t Write(const T* items, uint32_t count) {
+            uint32_t writeIndex = m_WriteIndex.load(std::memory_order_relaxed);
+
+            if (Capacity - (writeIndex - m_CachedReadIndex) < count) {
+                m_CachedReadIndex = m_ReadIndex.load(std::memory_order_acquire);
+            }
+
+            uint32_t space = Capacity - (writeIndex - m_CachedReadIndex);
+            if (count > space) {
+                count = space;
+            }
+
+            // Copy in up to 2 parts if this wraps around the end
+            uint32_t start = writeIndex & (Capacity - 1);
+            uint32_t firstCount = Capacity - start < count ? Capacity - start : count;
+            memcpy(&m_Items[start], items, firstCount * sizeof(T));
+            memcpy(&m_Items[0], &items[firstCount], (count - firstCount) * sizeof(T));
+
+            m_WriteIndex.store(writeIndex + count, std::memory_order_release);
+            return count;
+        }
+
+        // Consumer side. Returns how many items can be read right now.
+        uint32_t GetReadAvailable() {
+            m_CachedWriteIndex = m_WriteIndex.load(std::memory_order_acquire);
+            return m_CachedWriteIndex - m_ReadIndex.load(std::memory_order_relaxed);
+        }
+
+        // Consumer side. Returns the item offset places from the front of the
+        // ring without removing it. offset must be less than the last value
+        // returned by GetReadAvailable().
+        const T& Peek(uint32_t offset) const {
+            return m_Items[(m_ReadIndex.load(std::memory_order_relaxed) + offset) & (Capacity - 1)];
+        }
+
+        // Consumer side. Removes count items that have been looked at with Peek().
+        void Consume(uint32_t count) {
+            m_ReadIndex.store(m_ReadIndex.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        }
+
+        // Consumer side. Reads up to count items and returns how many were read.
+        uint32_t Read(T* items, uint32_t count) {
+            uint32_t readIndex = m_ReadIndex.load(std::memory_order_relaxed);
+
+            if (m_CachedWriteIndex - readIndex < count) {
+                m_CachedWriteIndex = m_WriteIndex.load(std::memory_order_acquire);
+            }
+
+            uint32_t available = m_CachedWriteIndex - readIndex;
+            if (count > available) {
+                count = available;
+            }
+
+            uint32_t start = readIndex & (Capacity - 1);
+            uint32_t firstCount = Capacity - start < count ? Capacity - start : count;
+            memcpy(items, &m_Items[start], firstCount * sizeof(T));
+            memcpy(&items[firstCount], &m_Items[0], (count - firstCount) * sizeof(T));
+
+            m_ReadIndex.store(readIndex + count, std::memory_order_release);
+            return count;
+        }
+
+    private:
+        T m_Items[Capacity];
+        char m_ItemsPad[SPSC_RING_CACHE_LINE_SIZE];
+
+        // Written by the producer only
+        std::atomic<uint32_t> m_WriteIndex;
+        uint32_t m_CachedReadIndex;
+        char m_ProducerPad[SPSC_RING_CACHE_LINE_SIZE];
+
+        // Written by the consumer only
+        std::atomic<uint32_t> m_ReadIndex;
+        uint32_t m_CachedWriteIndex;
+        char m_ConsumerPad[SPSC_RING_CACHE_LINE_SIZE];
+};
@@ -5,6 +5,9 @@ var myUniqueid = '0123456789ABCDEF'; // Use the same UID as other Moonlight clie
 var api; // `api` should only be set if we're in a host-specific screen. on the initial screen it should always be null.
 var isInGame = false; // flag indicating whether the game stream started
 var windowState = 'normal'; // chrome's windowState, possible values: 'normal' or 'fullscreen'
+var framePacing = 'lowestLatency'; // frame pacing policy: 'lowestLatency', 'smoothest' or 'adaptive'
+var audioLatencyMs = 40; // audio latency the jitter buffer aims for, 10-150 ms. It grows past this on underruns.
+var audioConfiguration = 'stereo'; // audio channel layout requested from the host: 'stereo' or '51Surround'
 
 // Called by the common.js module.
 function attachListeners() {
@@ -693,9 +696,13 @@ function startGame(host, appID) {
       $('#loadingMessage').text('Starting ' + appToStart.title + '...');
       playGameMode();
 
+      sendMessage('setFramePacing', [framePacing]);
+      sendMessage('setAudioLatency', [audioLatencyMs]);
+      sendMessage('setAudioConfiguration', [audioConfiguration]);
+
       if (host.currentGame == appID) { // if user wants to launch the already-running app, then we resume it.
         return host.resumeApp(
-          rikey, rikeyid, 0x030002 // Surround channel mask << 16 | Surround channel count
+          rikey, rikeyid, getSurroundAudioInfo()
         ).then(function(launchResult) {
           $xml = $($.parseXML(launchResult.toString()));
           $root = $xml.find('root');
@@ -723,7 +730,7 @@ function startGame(host, appID) {
         optimize, // DON'T Allow GFE (0) to optimize game settings, or ALLOW (1) to optimize game settings
         rikey, rikeyid,
         remote_audio_enabled, // Play audio locally too?
-        0x030002, // Surround channel mask << 16 | Surround channel count
+        getSurroundAudioInfo(),
         gamepadMask
       ).then(function(launchResult) {
         $xml = $($.parseXML(launchResult.toString()));
@@ -748,6 +755,14 @@ function startGame(host, appID) {
   });
 }
 
+// The host's surroundAudioInfo launch parameter is the speaker mask << 16 | the channel count
+function getSurroundAudioInfo() {
+  if (audioConfiguration === '51Surround') {
+    return 0x3F0006; // FL FR FC LFE BL BR
+  }
+  return 0x030002; // FL FR
+}
+
 function playGameMode() {
   console.log('%c[index.js, playGameMode]', 'color:green;', 'Entering play game mode');
   isInGame = true;
@@ -1,6 +1,18 @@
 var callbacks = {}
 var callbacks_ids = 1;
 
+// Latest FEC counters reported by the NaCl module for the current stream
+var fecStats = null;
+
+// Latest frame pacing counters reported by the NaCl module for the current stream
+var pacingStats = null;
+
+// Latest per-stage frame latency histograms reported by the NaCl module for the current stream
+var latencyStats = null;
+
+// Latest audio jitter buffer counters reported by the NaCl module for the current stream
+var audioStats = null;
+
 /**
  * var sendMessage - Sends a message with arguments to the NaCl module
  *
@@ -34,6 +46,14 @@ function handleMessage(msg) {
   if (msg.data.callbackId && callbacks[msg.data.callbackId]) { // if it's a callback, treat it as such
     callbacks[msg.data.callbackId][msg.data.type](msg.data.ret);
     delete callbacks[msg.data.callbackId]
+  } else if (msg.data.indexOf('FecStats: ') === 0) { // periodic, so don't log it
+    fecStats = JSON.parse(msg.data.replace('FecStats: ', ''));
+  } else if (msg.data.indexOf('PacingStats: ') === 0) { // periodic, so don't log it
+    pacingStats = JSON.parse(msg.data.replace('PacingStats: ', ''));
+  } else if (msg.data.indexOf('LatencyStats: ') === 0) { // periodic, so don't log it
+    latencyStats = JSON.parse(msg.data.replace('LatencyStats: ', ''));
+  } else if (msg.data.indexOf('AudioStats: ') === 0) { // periodic, so don't log it
+    audioStats = JSON.parse(msg.data.replace('AudioStats: ', ''));
   } else { // else, it's just info, or an event
     console.log('%c[messages.js, handleMessage]', 'color:gray;', 'Message data: ', msg.data)
     if (msg.data.indexOf('streamTerminated: ') === 0) { // if it's a recognized event, notify the appropriate function
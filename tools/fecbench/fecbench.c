@@ -0,0 +1,799 @@
+// Benchmark for the video receive path (RtpFecQueue -> VideoDepacketizer).
+//
+// Synthesizes GameStream-style RTP video packets, passes them through a
+// simulated lossy channel and feeds them to RtpfAddPacket() exactly like
+// the video receive thread does. Decode units are consumed by a stub
+// direct-submit decoder that validates and times them, or with -q, by the
+// same stub decoder running on a decoder thread behind the decode unit queue.
+//
+// Only time spent inside RtpfAddPacket() is measured. Frame latency is
+// measured on that same receive-path clock, from the first packet of a
+// frame being received to the frame's decode unit being submitted. That
+// clock only exists on the receive thread, so there's no latency with -q.
+
+#include "Limelight-internal.h"
+#include "RtpFecQueue.h"
+#include "BufferPool.h"
+#include "rs.h"
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <time.h>
+
+// Matches the packet size requested by the client
+#define DEFAULT_PACKET_SIZE 1392
+
+// Frame headers from GFE 7.1.415+
+#define FRAME_HEADER_SIZE 8
+
+// Largest number of packets held back by the reorder model
+#define MAX_REORDER_DEPTH 64
+
+// Frame timestamps are tracked in a ring this large
+#define FRAME_HISTORY 1024
+
+// GFE won't send more shards than the Reed-Solomon coder supports
+#define MAX_FRAME_SHARDS DATA_SHARDS_MAX
+
+typedef struct _BENCH_OPTIONS {
+    int frames;
+    int packetSize;
+    int dataPackets;
+    int fecPercentage;
+    int frameWindow;
+    int idrInterval;
+    int slices;
+    int contiguous;
+    int queued;
+    unsigned int seed;
+    int verbose;
+    const char* traceFile;
+
+    // Bernoulli loss
+    double lossRate;
+
+    // Gilbert-Elliott loss
+    int gilbertElliott;
+    double geGoodToBad;
+    double geBadToGood;
+    double geBadLossRate;
+
+    // Reordering and duplication
+    double reorderRate;
+    int reorderDepth;
+    double duplicateRate;
+} BENCH_OPTIONS;
+
+typedef struct _DELAYED_PACKET {
+    char* buffer;
+    int length;
+    int releaseAt;
+} DELAYED_PACKET;
+
+typedef struct _BENCH_STATS {
+    unsigned long long packetsSent;
+    unsigned long long packetsLost;
+    unsigned long long packetsDuplicated;
+    unsigned long long packetsReordered;
+    unsigned long long packetsReceived;
+    unsigned long long bytesReceived;
+
+    int framesSent;
+    int framesSubmitted;
+    int idrRequests;
+    int frameLossReports;
+    int corruptFrames;
+    int slicedFrames;
+    int slicesSubmitted;
+
+    unsigned long long allocations;
+} BENCH_STATS;
+
+static BENCH_OPTIONS options;
+static BENCH_STATS stats;
+
+static RTP_FEC_QUEUE rtpQueue;
+static BUFFER_POOL packetPool;
+static PLT_THREAD decoderThread;
+
+// Simulated channel state
+static DELAYED_PACKET delayLine[MAX_REORDER_DEPTH * 2];
+static int delayedPackets;
+static int channelClock;
+static int geBadState;
+
+// Generator state
+static unsigned short nextSequenceNumber;
+static unsigned int nextStreamPacketIndex;
+static int idrPending;
+
+// Receive-path clock, which only advances while we're inside RtpfAddPacket()
+static unsigned long long receiveClockNs;
+static unsigned long long receiveCallStartNs;
+static unsigned long long frameFirstPacketNs[FRAME_HISTORY];
+static unsigned long long* frameLatencyNs;
+static unsigned long long* firstSliceLatencyNs;
+
+// Allocation counting through the linker's --wrap option
+static int countAllocations;
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    if (countAllocations) {
+        stats.allocations++;
+    }
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    if (countAllocations) {
+        stats.allocations++;
+    }
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    if (countAllocations) {
+        stats.allocations++;
+    }
+    return __real_realloc(ptr, size);
+}
+
+static unsigned long long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double randomUnit(void) {
+    return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+// Globals and callbacks normally provided by the rest of moonlight-common-c
+
+STREAM_CONFIGURATION StreamConfig;
+CONNECTION_LISTENER_CALLBACKS ListenerCallbacks;
+DECODER_RENDERER_CALLBACKS VideoCallbacks;
+int AppVersionQuad[4] = { 7, 1, 431, 0 };
+int NegotiatedVideoFormat = VIDEO_FORMAT_H264;
+
+void requestIdrOnDemand(void) {
+    stats.idrRequests++;
+    idrPending = 1;
+}
+
+void connectionDetectedFrameLoss(int startFrame, int endFrame) {
+    stats.frameLossReports++;
+}
+
+void connectionReceivedCompleteFrame(int frameIndex) {
+}
+
+void connectionSawFrame(int frameIndex) {
+}
+
+void connectionLostPackets(int lastReceivedPacket, int nextReceivedPacket) {
+}
+
+int isReferenceFrameInvalidationEnabled(void) {
+    return 0;
+}
+
+void* allocateVideoPacketBuffer(void) {
+    return BpAllocateBuffer(&packetPool);
+}
+
+void freeVideoPacketBuffer(void* buffer) {
+    BpFreeBuffer(&packetPool, buffer);
+}
+
+// Platform.c references these for LiStartConnection() setup, which we never call
+int enet_initialize(void) {
+    return 0;
+}
+
+void enet_deinitialize(void) {
+}
+
+int initializePlatformSockets(void) {
+    return 0;
+}
+
+void cleanupPlatformSockets(void) {
+}
+
+static void benchLogMessage(const char* format, ...) {
+    va_list va;
+
+    if (!options.verbose) {
+        return;
+    }
+
+    va_start(va, format);
+    vfprintf(stderr, format, va);
+    va_end(va);
+}
+
+// Stub decoder
+
+// Returns 1 if the buffer chain is consistent and starts with a start code
+static int checkDecodeUnit(PDECODE_UNIT decodeUnit) {
+    PLENTRY entry;
+    int length = 0;
+
+    for (entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+        LC_ASSERT(entry->length > 0);
+
+        // Contiguous decode units must be readable straight from the first entry
+        if (options.contiguous && entry->data != decodeUnit->bufferList->data + length) {
+            return 0;
+        }
+
+        length += entry->length;
+    }
+
+    return length == decodeUnit->fullLength && decodeUnit->bufferList->data[0] == 0 &&
+        decodeUnit->bufferList->data[1] == 0 && decodeUnit->bufferList->data[2] == 0 &&
+        decodeUnit->bufferList->data[3] == 1;
+}
+
+static unsigned long long frameLatency(PDECODE_UNIT decodeUnit) {
+    if (options.queued) {
+        return 0;
+    }
+
+    return receiveClockNs + (nowNs() - receiveCallStartNs) -
+        frameFirstPacketNs[decodeUnit->frameNumber % FRAME_HISTORY];
+}
+
+static int benchSubmitDecodeUnit(PDECODE_UNIT decodeUnit) {
+    if (!checkDecodeUnit(decodeUnit)) {
+        stats.corruptFrames++;
+        return DR_NEED_IDR;
+    }
+
+    frameLatencyNs[stats.framesSubmitted++] = frameLatency(decodeUnit);
+
+    return DR_OK;
+}
+
+static int benchSubmitSliceUnit(PDECODE_UNIT sliceUnit, int sliceFlags) {
+    if (!checkDecodeUnit(sliceUnit)) {
+        stats.corruptFrames++;
+        return DR_NEED_IDR;
+    }
+
+    stats.slicesSubmitted++;
+
+    if (sliceFlags & SLICE_FLAG_FIRST) {
+        firstSliceLatencyNs[stats.slicedFrames++] = frameLatency(sliceUnit);
+    }
+    if (sliceFlags & SLICE_FLAG_LAST) {
+        frameLatencyNs[stats.framesSubmitted++] = frameLatency(sliceUnit);
+    }
+
+    return DR_OK;
+}
+
+// Same as DecoderThreadProc() in VideoStream.c
+static void benchDecoderThreadProc(void* context) {
+    PQUEUED_DECODE_UNIT qdu;
+    int ret;
+
+    while (!PltIsThreadInterrupted(&decoderThread)) {
+        if (!getNextQueuedDecodeUnit(&qdu)) {
+            return;
+        }
+
+        TRACE_BEGIN("Submit decode unit", qdu->decodeUnit.frameNumber);
+        if (qdu->isSliceUnit) {
+            ret = benchSubmitSliceUnit(&qdu->decodeUnit, qdu->sliceFlags);
+        }
+        else {
+            ret = benchSubmitDecodeUnit(&qdu->decodeUnit);
+        }
+        TRACE_END("Submit decode unit", qdu->decodeUnit.frameNumber);
+
+        completeQueuedDecodeUnit(qdu, ret);
+    }
+}
+
+// Packet generation
+
+static int writeAnnexBNalu(char* data, unsigned char nalType, int length) {
+    int i;
+
+    data[0] = 0;
+    data[1] = 0;
+    data[2] = 0;
+    data[3] = 1;
+    data[4] = (char)nalType;
+
+    // Avoid emitting anything that looks like a start code
+    for (i = 5; i < length; i++) {
+        data[i] = (char)(1 + rand() % 255);
+    }
+
+    return length;
+}
+
+// Builds the Annex B frame payload that will be split across packets
+static int buildFramePayload(char* payload, int payloadLength, int idr) {
+    int offset = 0;
+
+    // Frame header
+    memset(payload, 0, FRAME_HEADER_SIZE);
+    payload[0] = 0x01;
+    offset += FRAME_HEADER_SIZE;
+
+    if (idr) {
+        offset += writeAnnexBNalu(&payload[offset], 0x67, 16);
+        offset += writeAnnexBNalu(&payload[offset], 0x68, 8);
+        offset += writeAnnexBNalu(&payload[offset], 0x65, payloadLength - offset);
+    }
+    else {
+        int slice;
+
+        for (slice = options.slices; slice > 0; slice--) {
+            offset += writeAnnexBNalu(&payload[offset], 0x41, (payloadLength - offset) / slice);
+        }
+    }
+
+    return offset;
+}
+
+// Generates all data and parity packets for a frame into pool buffers
+static int generateFrame(int frameIndex, char** packets) {
+    int nvPayloadSize = options.packetSize - sizeof(NV_VIDEO_PACKET);
+    int receiveSize = options.packetSize + MAX_RTP_HEADER_SIZE;
+    int idr = idrPending || frameIndex == 1 ||
+        (options.idrInterval > 0 && frameIndex % options.idrInterval == 0);
+    int dataPackets, parityPackets;
+    reed_solomon* rs;
+    char* payload;
+    int i;
+
+    // Vary frame sizes by +/-25%, with bigger IDR frames
+    dataPackets = options.dataPackets * (75 + rand() % 51) / 100;
+    if (idr) {
+        dataPackets *= 4;
+        idrPending = 0;
+    }
+    if (dataPackets < 1) {
+        dataPackets = 1;
+    }
+    parityPackets = (dataPackets * options.fecPercentage + 99) / 100;
+    if (dataPackets + parityPackets > MAX_FRAME_SHARDS) {
+        dataPackets = MAX_FRAME_SHARDS * 100 / (100 + options.fecPercentage);
+        parityPackets = (dataPackets * options.fecPercentage + 99) / 100;
+    }
+
+    payload = malloc((size_t)dataPackets * nvPayloadSize);
+    buildFramePayload(payload, dataPackets * nvPayloadSize, idr);
+
+    for (i = 0; i < dataPackets + parityPackets; i++) {
+        PRTP_PACKET rtp;
+        PNV_VIDEO_PACKET nv;
+
+        packets[i] = allocateVideoPacketBuffer();
+        memset(packets[i], 0, receiveSize);
+
+        if (i >= dataPackets) {
+            // Parity is filled in below
+            continue;
+        }
+
+        rtp = (PRTP_PACKET)packets[i];
+        nv = (PNV_VIDEO_PACKET)(rtp + 1);
+
+        rtp->header = (char)0x80;
+        rtp->packetType = 96;
+        rtp->sequenceNumber = U16(nextSequenceNumber + i);
+        rtp->timestamp = frameIndex * 1500;
+
+        nv->streamPacketIndex = U24(nextStreamPacketIndex + i) << 8;
+        nv->frameIndex = frameIndex;
+        nv->flags = FLAG_CONTAINS_PIC_DATA;
+        if (i == 0) {
+            nv->flags |= FLAG_SOF;
+        }
+        if (i == dataPackets - 1) {
+            nv->flags |= FLAG_EOF;
+        }
+        nv->fecInfo = (dataPackets << 22) | (i << 12) | (options.fecPercentage << 4);
+
+        memcpy(nv + 1, &payload[i * nvPayloadSize], nvPayloadSize);
+    }
+
+    free(payload);
+
+    if (parityPackets > 0) {
+        rs = reed_solomon_new(dataPackets, parityPackets);
+        LC_ASSERT(rs != NULL);
+        reed_solomon_encode(rs, (unsigned char**)packets, dataPackets + parityPackets, receiveSize);
+        reed_solomon_release(rs);
+
+        // GFE rewrites the headers of the parity packets after encoding
+        for (i = dataPackets; i < dataPackets + parityPackets; i++) {
+            PRTP_PACKET rtp = (PRTP_PACKET)packets[i];
+            PNV_VIDEO_PACKET nv = (PNV_VIDEO_PACKET)(rtp + 1);
+
+            rtp->header = (char)0x80;
+            rtp->packetType = 96;
+            rtp->sequenceNumber = U16(nextSequenceNumber + i);
+            rtp->timestamp = frameIndex * 1500;
+            rtp->ssrc = 0;
+            nv->frameIndex = frameIndex;
+            nv->fecInfo = (dataPackets << 22) | (i << 12) | (options.fecPercentage << 4);
+        }
+    }
+
+    nextSequenceNumber = U16(nextSequenceNumber + dataPackets + parityPackets);
+    nextStreamPacketIndex = U24(nextStreamPacketIndex + dataPackets);
+
+    return dataPackets + parityPackets;
+}
+
+// Receive path
+
+static void receivePacket(char* buffer, int length) {
+    PRTP_PACKET packet = (PRTP_PACKET)buffer;
+    PNV_VIDEO_PACKET nvPacket = (PNV_VIDEO_PACKET)(packet + 1);
+    unsigned long long endNs;
+    int frameIndex = nvPacket->frameIndex;
+    int receiveSize = options.packetSize + MAX_RTP_HEADER_SIZE;
+
+    stats.packetsReceived++;
+    stats.bytesReceived += length;
+
+    // The first packet of each frame to arrive starts that frame's latency clock
+    if (frameFirstPacketNs[frameIndex % FRAME_HISTORY] == 0) {
+        frameFirstPacketNs[frameIndex % FRAME_HISTORY] = receiveClockNs;
+    }
+
+    countAllocations = 1;
+    receiveCallStartNs = nowNs();
+    if (RtpfAddPacket(&rtpQueue, packet, length, (PRTPFEC_QUEUE_ENTRY)&buffer[receiveSize]) != RTPF_RET_QUEUED) {
+        freeVideoPacketBuffer(buffer);
+    }
+    endNs = nowNs();
+    countAllocations = 0;
+
+    receiveClockNs += endNs - receiveCallStartNs;
+}
+
+static void releaseDelayedPackets(int flush) {
+    int i = 0;
+
+    while (i < delayedPackets) {
+        if (flush || delayLine[i].releaseAt <= channelClock) {
+            DELAYED_PACKET packet = delayLine[i];
+
+            delayLine[i] = delayLine[--delayedPackets];
+            receivePacket(packet.buffer, packet.length);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+static int isPacketLost(void) {
+    if (options.gilbertElliott) {
+        if (geBadState) {
+            if (randomUnit() < options.geBadToGood) {
+                geBadState = 0;
+            }
+        }
+        else if (randomUnit() < options.geGoodToBad) {
+            geBadState = 1;
+        }
+
+        if (geBadState && randomUnit() < options.geBadLossRate) {
+            return 1;
+        }
+    }
+
+    return randomUnit() < options.lossRate;
+}
+
+static void sendPacket(char* buffer, int length) {
+    int receiveSize = options.packetSize + MAX_RTP_HEADER_SIZE;
+
+    stats.packetsSent++;
+    channelClock++;
+
+    if (isPacketLost()) {
+        stats.packetsLost++;
+        freeVideoPacketBuffer(buffer);
+    }
+    else {
+        if (randomUnit() < options.duplicateRate) {
+            char* copy = allocateVideoPacketBuffer();
+
+            memcpy(copy, buffer, receiveSize);
+            stats.packetsDuplicated++;
+            receivePacket(copy, length);
+        }
+
+        if (delayedPackets < MAX_REORDER_DEPTH * 2 && randomUnit() < options.reorderRate) {
+            delayLine[delayedPackets].buffer = buffer;
+            delayLine[delayedPackets].length = length;
+            delayLine[delayedPackets].releaseAt = channelClock + 1 + rand() % options.reorderDepth;
+            delayedPackets++;
+            stats.packetsReordered++;
+        }
+        else {
+            receivePacket(buffer, length);
+        }
+    }
+
+    releaseDelayedPackets(0);
+}
+
+static int compareLatency(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static unsigned long long latencyPercentile(unsigned long long* samples, int count, int percentile) {
+    if (count == 0) {
+        return 0;
+    }
+
+    return samples[(count - 1) * percentile / 100];
+}
+
+static int writeTrace(const char* fileName) {
+    char* json;
+    FILE* file;
+    int err = 0;
+
+    LiTraceSetEnabled(0);
+
+    json = LiTraceDumpJson();
+    if (json == NULL) {
+        return -1;
+    }
+
+    file = fopen(fileName, "w");
+    if (file == NULL || fputs(json, file) < 0) {
+        err = -1;
+    }
+    if (file != NULL && fclose(file) != 0) {
+        err = -1;
+    }
+
+    free(json);
+    return err;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n FRAMES       number of frames to send (default 10000)\n"
+            "  -d PACKETS      average data packets per frame (default 60)\n"
+            "  -f PERCENT      FEC percentage (default 20)\n"
+            "  -s BYTES        video packet size (default %d)\n"
+            "  -w FRAMES       FEC queue frame window (default 3)\n"
+            "  -i FRAMES       IDR interval, 0 for IDR on demand only (default 0)\n"
+            "  -c SLICES       slices per P-frame; above 1, slices are submitted\n"
+            "                  to the decoder as they complete (default 1)\n"
+            "  -C              assemble each decode unit into one contiguous buffer\n"
+            "  -q              queue decode units to a decoder thread instead of\n"
+            "                  submitting them directly\n"
+            "  -l RATE         Bernoulli packet loss rate, 0-1\n"
+            "  -g P,R,LOSS     Gilbert-Elliott loss: good->bad and bad->good\n"
+            "                  transition probabilities, loss rate in the bad state\n"
+            "  -r RATE,DEPTH   delay packets with probability RATE by up to DEPTH packets\n"
+            "  -u RATE         duplicate packets with probability RATE\n"
+            "  -S SEED         random seed\n"
+            "  -t FILE         write a Chrome trace of the run to FILE\n"
+            "  -v              log messages from moonlight-common-c\n",
+            name, DEFAULT_PACKET_SIZE);
+}
+
+static int parseOptions(int argc, char** argv) {
+    int opt;
+
+    options.frames = 10000;
+    options.packetSize = DEFAULT_PACKET_SIZE;
+    options.dataPackets = 60;
+    options.fecPercentage = 20;
+    options.frameWindow = 3;
+    options.slices = 1;
+    options.seed = 1;
+    options.reorderDepth = 1;
+
+    while ((opt = getopt(argc, argv, "n:d:f:s:w:i:c:Cql:g:r:u:S:t:vh")) != -1) {
+        switch (opt) {
+        case 'n':
+            options.frames = atoi(optarg);
+            break;
+        case 'd':
+            options.dataPackets = atoi(optarg);
+            break;
+        case 'f':
+            options.fecPercentage = atoi(optarg);
+            break;
+        case 's':
+            options.packetSize = atoi(optarg);
+            break;
+        case 'w':
+            options.frameWindow = atoi(optarg);
+            break;
+        case 'i':
+            options.idrInterval = atoi(optarg);
+            break;
+        case 'c':
+            options.slices = atoi(optarg);
+            break;
+        case 'C':
+            options.contiguous = 1;
+            break;
+        case 'q':
+            options.queued = 1;
+            break;
+        case 'l':
+            options.lossRate = atof(optarg);
+            break;
+        case 'g':
+            if (sscanf(optarg, "%lf,%lf,%lf", &options.geGoodToBad,
+                       &options.geBadToGood, &options.geBadLossRate) != 3) {
+                usage(argv[0]);
+                return -1;
+            }
+            options.gilbertElliott = 1;
+            break;
+        case 'r':
+            if (sscanf(optarg, "%lf,%d", &options.reorderRate, &options.reorderDepth) != 2 ||
+                    options.reorderDepth < 1 || options.reorderDepth > MAX_REORDER_DEPTH) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'u':
+            options.duplicateRate = atof(optarg);
+            break;
+        case 'S':
+            options.seed = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            options.traceFile = optarg;
+            break;
+        case 'v':
+            options.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (options.frames <= 0 || options.dataPackets <= 0 || options.slices <= 0 ||
+            options.fecPercentage < 0 || options.fecPercentage > 255 ||
+            options.packetSize <= (int)(sizeof(NV_VIDEO_PACKET) + FRAME_HEADER_SIZE + 32)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    char* packets[MAX_FRAME_SHARDS];
+    unsigned int poolHits, poolMisses;
+    int frameIndex;
+    int i;
+
+    if (parseOptions(argc, argv) != 0) {
+        return 1;
+    }
+
+    srand(options.seed);
+
+    frameLatencyNs = calloc(options.frames, sizeof(*frameLatencyNs));
+    firstSliceLatencyNs = calloc(options.frames, sizeof(*firstSliceLatencyNs));
+
+    StreamConfig.packetSize = options.packetSize;
+    ListenerCallbacks.logMessage = benchLogMessage;
+    VideoCallbacks.submitDecodeUnit = benchSubmitDecodeUnit;
+    VideoCallbacks.capabilities = options.queued ? 0 : CAPABILITY_DIRECT_SUBMIT;
+    if (options.slices > 1) {
+        VideoCallbacks.submitSliceUnit = benchSubmitSliceUnit;
+        VideoCallbacks.capabilities |= CAPABILITY_SLICES_PER_FRAME(options.slices) | CAPABILITY_SLICE_SUBMIT;
+    }
+    if (options.contiguous) {
+        VideoCallbacks.capabilities |= CAPABILITY_CONTIGUOUS_DECODE_UNIT;
+    }
+
+    BpInitializePool(&packetPool, options.packetSize + MAX_RTP_HEADER_SIZE + sizeof(RTPFEC_QUEUE_ENTRY), 1024);
+    initializeVideoDepacketizer(options.packetSize);
+    RtpfInitializeQueue(&rtpQueue, options.frameWindow,
+                        (VideoCallbacks.capabilities & CAPABILITY_SLICE_SUBMIT) != 0);
+
+    nextSequenceNumber = (unsigned short)rand();
+
+    if (options.traceFile != NULL) {
+        LiTraceSetThreadName("Receive");
+        LiTraceSetEnabled(1);
+    }
+
+    if (options.queued && PltCreateThread("Decoder", benchDecoderThreadProc, NULL, &decoderThread) != 0) {
+        fprintf(stderr, "Failed to create decoder thread\n");
+        return 1;
+    }
+
+    for (frameIndex = 1; frameIndex <= options.frames; frameIndex++) {
+        int packetCount = generateFrame(frameIndex, packets);
+
+        frameFirstPacketNs[frameIndex % FRAME_HISTORY] = 0;
+        stats.framesSent++;
+
+        for (i = 0; i < packetCount; i++) {
+            sendPacket(packets[i], options.packetSize + sizeof(RTP_PACKET));
+        }
+    }
+    releaseDelayedPackets(1);
+
+    if (options.queued) {
+        // Let the decoder thread catch up before stopping it
+        while (LiGetPendingVideoFrames() != 0) {
+            PltSleepMs(1);
+        }
+
+        stopVideoDepacketizer();
+        PltInterruptThread(&decoderThread);
+        PltJoinThread(&decoderThread);
+        PltCloseThread(&decoderThread);
+    }
+
+    destroyVideoDepacketizer();
+    RtpfCleanupQueue(&rtpQueue);
+
+    if (options.traceFile != NULL && writeTrace(options.traceFile) != 0) {
+        fprintf(stderr, "Failed to write trace to %s\n", options.traceFile);
+    }
+
+    qsort(frameLatencyNs, stats.framesSubmitted, sizeof(*frameLatencyNs), compareLatency);
+    qsort(firstSliceLatencyNs, stats.slicedFrames, sizeof(*firstSliceLatencyNs), compareLatency);
+
+    printf("packets: %llu sent, %llu lost, %llu duplicated, %llu reordered\n",
+           stats.packetsSent, stats.packetsLost, stats.packetsDuplicated, stats.packetsReordered);
+    printf("frames: %d sent, %d submitted, %d corrupt, %d IDR requests, %d loss reports\n",
+           stats.framesSent, stats.framesSubmitted, stats.corruptFrames,
+           stats.idrRequests, stats.frameLossReports);
+    printf("fec: %u clean, %u recovered (%u shards), %u unrecoverable, %u parity wasted\n",
+           rtpQueue.stats.framesReceivedClean, rtpQueue.stats.framesRecovered,
+           rtpQueue.stats.shardsRecovered, rtpQueue.stats.framesUnrecoverable,
+           rtpQueue.stats.parityPacketsWasted);
+    printf("receive path: %.1f ms, %.0f packets/s, %.1f MB/s\n",
+           receiveClockNs / 1e6,
+           stats.packetsReceived / (receiveClockNs / 1e9),
+           stats.bytesReceived / (receiveClockNs / 1e9) / (1024 * 1024));
+    if (!options.queued) {
+        printf("frame latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+               latencyPercentile(frameLatencyNs, stats.framesSubmitted, 50) / 1e3,
+               latencyPercentile(frameLatencyNs, stats.framesSubmitted, 99) / 1e3,
+               latencyPercentile(frameLatencyNs, stats.framesSubmitted, 100) / 1e3);
+    }
+    if (stats.slicedFrames != 0 && !options.queued) {
+        printf("first slice latency: p50 %.1f us, p99 %.1f us (%d slices in %d frames)\n",
+               latencyPercentile(firstSliceLatencyNs, stats.slicedFrames, 50) / 1e3,
+               latencyPercentile(firstSliceLatencyNs, stats.slicedFrames, 99) / 1e3,
+               stats.slicesSubmitted, stats.slicedFrames);
+    }
+    BpGetStatistics(&packetPool, &poolHits, &poolMisses);
+    printf("allocations: %.2f per frame (packet pool: %u hits, %u misses)\n",
+           (double)stats.allocations / stats.framesSent, poolHits, poolMisses);
+
+    BpCleanupPool(&packetPool);
+    free(frameLatencyNs);
+    free(firstSliceLatencyNs);
+
+    return stats.corruptFrames != 0;
+}
@@ -0,0 +1,309 @@
+#include "decoder.h"
+#include "AnnexB.h"
+
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Don't flood the log if the stream is broken for a while
+#define MAX_LOGGED_ERRORS 20
+
+#define H264_NAL_TYPE(header) ((header) & 0x1F)
+#define H264_NAL_SLICE 1
+#define H264_NAL_IDR_SLICE 5
+#define H264_NAL_SPS 7
+#define H264_NAL_PPS 8
+
+#define HEVC_NAL_TYPE(header) (((header) >> 1) & 0x3F)
+#define HEVC_NAL_LAST_VCL 31
+#define HEVC_NAL_FIRST_IRAP 16
+#define HEVC_NAL_LAST_IRAP 23
+#define HEVC_NAL_VPS 32
+#define HEVC_NAL_SPS 33
+#define HEVC_NAL_PPS 34
+
+// What we've seen in the decode unit so far
+typedef struct _NAL_SUMMARY {
+    int vps;
+    int sps;
+    int pps;
+    int keyframeSlices;
+    int slices;
+} NAL_SUMMARY, *PNAL_SUMMARY;
+
+static HEADLESS_DECODER_OPTIONS options;
+static HEADLESS_DECODER_STATS stats;
+static int lastFrameNumber;
+static int loggedErrors;
+
+static unsigned long long fnv1a(unsigned long long hash, const unsigned char* data, int length) {
+    int i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static int isHevc(void) {
+    return (stats.videoFormat & VIDEO_FORMAT_MASK_H265) != 0;
+}
+
+// Returns the buffer type that a NAL unit of this type must be submitted as
+static int summarizeNal(PNAL_SUMMARY summary, const unsigned char* header) {
+    if (isHevc()) {
+        int type = HEVC_NAL_TYPE(header[0]);
+
+        switch (type) {
+        case HEVC_NAL_VPS:
+            summary->vps++;
+            return BUFFER_TYPE_VPS;
+        case HEVC_NAL_SPS:
+            summary->sps++;
+            return BUFFER_TYPE_SPS;
+        case HEVC_NAL_PPS:
+            summary->pps++;
+            return BUFFER_TYPE_PPS;
+        default:
+            if (type <= HEVC_NAL_LAST_VCL) {
+                summary->slices++;
+                if (type >= HEVC_NAL_FIRST_IRAP && type <= HEVC_NAL_LAST_IRAP) {
+                    summary->keyframeSlices++;
+                }
+            }
+            return BUFFER_TYPE_PICDATA;
+        }
+    }
+    else {
+        switch (H264_NAL_TYPE(header[0])) {
+        case H264_NAL_SPS:
+            summary->sps++;
+            return BUFFER_TYPE_SPS;
+        case H264_NAL_PPS:
+            summary->pps++;
+            return BUFFER_TYPE_PPS;
+        case H264_NAL_IDR_SLICE:
+            summary->keyframeSlices++;
+            summary->slices++;
+            return BUFFER_TYPE_PICDATA;
+        case H264_NAL_SLICE:
+            summary->slices++;
+            return BUFFER_TYPE_PICDATA;
+        default:
+            return BUFFER_TYPE_PICDATA;
+        }
+    }
+}
+
+// Checks that the buffer is a sequence of start code prefixed NAL units. Returns
+// a description of the first problem found or NULL if there isn't one.
+static const char* validateEntry(PLENTRY entry, PNAL_SUMMARY summary) {
+    const unsigned char* data = (const unsigned char*)entry->data;
+    int headerLength = isHevc() ? 2 : 1;
+    int offset;
+
+    // Every buffer starts with a 3 or 4 byte start code
+    offset = AnbFindStartCode(data, entry->length);
+    if (offset != 0 && !(offset == 1 && data[0] == 0)) {
+        return "buffer doesn't start with a start code";
+    }
+    offset += 3;
+
+    for (;;) {
+        int next = AnbFindStartCode(&data[offset], entry->length - offset);
+        int end = next < 0 ? entry->length : offset + next;
+
+        // Zeros before the next start code aren't part of this NAL unit
+        while (end > offset && data[end - 1] == 0) {
+            end--;
+        }
+
+        if (end - offset < headerLength) {
+            return "empty NAL unit";
+        }
+        if (data[offset] & 0x80) {
+            return "forbidden_zero_bit set";
+        }
+        if (AnbFindNalEnd(&data[offset], end - offset) >= 0) {
+            return "missing emulation prevention byte";
+        }
+
+        if (summarizeNal(summary, &data[offset]) != entry->bufferType) {
+            return "NAL unit type doesn't match buffer type";
+        }
+
+        if (next < 0) {
+            return NULL;
+        }
+        offset += next + 3;
+    }
+}
+
+static const char* validateDecodeUnit(PDECODE_UNIT decodeUnit, int isSliceUnit) {
+    NAL_SUMMARY summary;
+    PLENTRY entry;
+    int length = 0;
+
+    memset(&summary, 0, sizeof(summary));
+
+    for (entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+        const char* error;
+
+        if (entry->length <= 0) {
+            return "empty buffer";
+        }
+
+        error = validateEntry(entry, &summary);
+        if (error != NULL) {
+            return error;
+        }
+
+        length += entry->length;
+    }
+
+    if (length != decodeUnit->fullLength) {
+        return "fullLength doesn't match the buffer list";
+    }
+    if (summary.slices == 0) {
+        return "no slices";
+    }
+
+    if (decodeUnit->frameType == FRAME_TYPE_IDR) {
+        if (isSliceUnit) {
+            return "IDR frame submitted as a slice unit";
+        }
+        if (summary.sps == 0 || summary.pps == 0 || (isHevc() && summary.vps == 0)) {
+            return "IDR frame without parameter sets";
+        }
+        if (summary.keyframeSlices != summary.slices) {
+            return "IDR frame with non-IDR slices";
+        }
+    }
+    else {
+        if (stats.idrFrames == 0) {
+            return "P-frame before the first IDR frame";
+        }
+        if (summary.keyframeSlices != 0 || summary.sps != 0 || summary.pps != 0 || summary.vps != 0) {
+            return "P-frame with IDR data";
+        }
+    }
+
+    return NULL;
+}
+
+static int submit(PDECODE_UNIT decodeUnit, int isSliceUnit, int frameComplete) {
+    unsigned long long now = LiGetMillis();
+    unsigned long long frameHash = FNV_OFFSET_BASIS;
+    const char* error;
+    PLENTRY entry;
+
+    for (entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+        stats.streamHash = fnv1a(stats.streamHash, (unsigned char*)entry->data, entry->length);
+        if (options.printFrameHashes) {
+            frameHash = fnv1a(frameHash, (unsigned char*)entry->data, entry->length);
+        }
+        if (options.dumpFile != NULL) {
+            fwrite(entry->data, 1, entry->length, options.dumpFile);
+        }
+    }
+    stats.bytes += decodeUnit->fullLength;
+
+    // Slices of the same frame share its frame number
+    if (decodeUnit->frameNumber != lastFrameNumber) {
+        if (lastFrameNumber != 0 && decodeUnit->frameNumber > lastFrameNumber + 1) {
+            stats.missingFrames += decodeUnit->frameNumber - lastFrameNumber - 1;
+        }
+        lastFrameNumber = decodeUnit->frameNumber;
+    }
+
+    error = validateDecodeUnit(decodeUnit, isSliceUnit);
+    if (error != NULL) {
+        if (loggedErrors++ < MAX_LOGGED_ERRORS) {
+            fprintf(stderr, "Frame %d is invalid: %s\n", decodeUnit->frameNumber, error);
+        }
+        stats.invalidFrames++;
+        return DR_NEED_IDR;
+    }
+
+    if (options.printFrameHashes) {
+        printf("frame %d%s: %d bytes, hash %016llx\n", decodeUnit->frameNumber,
+               isSliceUnit ? " (slice)" : "", decodeUnit->fullLength, frameHash);
+    }
+
+    if (decodeUnit->frameType == FRAME_TYPE_IDR) {
+        stats.idrFrames++;
+    }
+
+    if (frameComplete) {
+        unsigned long long latencyMs = now - decodeUnit->receiveTimeMs;
+
+        if (stats.frames++ == 0) {
+            stats.firstFrameTimeMs = now;
+        }
+        stats.lastFrameTimeMs = now;
+
+        stats.latencyHistogram[latencyMs < HEADLESS_LATENCY_BUCKETS ? latencyMs : HEADLESS_LATENCY_BUCKETS - 1]++;
+    }
+
+    return DR_OK;
+}
+
+static int headlessSetup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+    stats.videoFormat = videoFormat;
+    stats.width = width;
+    stats.height = height;
+    return 0;
+}
+
+static int headlessSubmitDecodeUnit(PDECODE_UNIT decodeUnit) {
+    return submit(decodeUnit, 0, 1);
+}
+
+static int headlessSubmitSliceUnit(PDECODE_UNIT sliceUnit, int sliceFlags) {
+    // The slices of a frame count as one frame once the last one arrives
+    stats.sliceUnits++;
+    return submit(sliceUnit, 1, (sliceFlags & SLICE_FLAG_LAST) != 0);
+}
+
+static DECODER_RENDERER_CALLBACKS headlessCallbacks;
+
+void HeadlessDecoderInitialize(PHEADLESS_DECODER_OPTIONS decoderOptions) {
+    options = *decoderOptions;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.streamHash = FNV_OFFSET_BASIS;
+    lastFrameNumber = 0;
+    loggedErrors = 0;
+
+    LiInitializeVideoCallbacks(&headlessCallbacks);
+    headlessCallbacks.setup = headlessSetup;
+    headlessCallbacks.submitDecodeUnit = headlessSubmitDecodeUnit;
+    headlessCallbacks.submitSliceUnit = headlessSubmitSliceUnit;
+    headlessCallbacks.capabilities = options.capabilities;
+}
+
+PDECODER_RENDERER_CALLBACKS HeadlessDecoderGetCallbacks(void) {
+    return &headlessCallbacks;
+}
+
+void HeadlessDecoderGetStats(PHEADLESS_DECODER_STATS decoderStats) {
+    *decoderStats = stats;
+}
+
+int HeadlessDecoderGetLatencyPercentile(PHEADLESS_DECODER_STATS decoderStats, int percentile) {
+    unsigned long long target = ((unsigned long long)decoderStats->frames * percentile + 99) / 100;
+    unsigned long long count = 0;
+    int i;
+
+    for (i = 0; i < HEADLESS_LATENCY_BUCKETS; i++) {
+        count += decoderStats->latencyHistogram[i];
+        if (count >= target && count != 0) {
+            return i;
+        }
+    }
+
+    return 0;
+}
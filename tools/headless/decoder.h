@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Limelight.h>
+
+#include <stdio.h>
+
+// Decode latencies are kept in 1 ms buckets up to this value
+#define HEADLESS_LATENCY_BUCKETS 1000
+
+typedef struct _HEADLESS_DECODER_OPTIONS {
+    // Renderer capabilities to advertise, e.g. CAPABILITY_DIRECT_SUBMIT
+    int capabilities;
+
+    // If set, the elementary stream is appended here as it's submitted
+    FILE* dumpFile;
+
+    // Print the hash of each frame as it's submitted
+    int printFrameHashes;
+} HEADLESS_DECODER_OPTIONS, *PHEADLESS_DECODER_OPTIONS;
+
+typedef struct _HEADLESS_DECODER_STATS {
+    int videoFormat;
+    int width;
+    int height;
+
+    unsigned int frames;
+    unsigned int idrFrames;
+    unsigned int sliceUnits;
+    unsigned long long bytes;
+
+    // Frames that failed Annex B validation. We ask for an IDR frame after each.
+    unsigned int invalidFrames;
+
+    // Frame numbers that were skipped, i.e. never submitted to us
+    unsigned int missingFrames;
+
+    // FNV-1a of every byte submitted, in order. Two runs of the same
+    // recording should end up with the same hash.
+    unsigned long long streamHash;
+
+    // Submit times of the first and last frame, for throughput
+    unsigned long long firstFrameTimeMs;
+    unsigned long long lastFrameTimeMs;
+
+    // Time from the first packet of a frame being received to the frame being
+    // submitted. The last bucket counts everything slower.
+    unsigned int latencyHistogram[HEADLESS_LATENCY_BUCKETS];
+} HEADLESS_DECODER_STATS, *PHEADLESS_DECODER_STATS;
+
+// A video renderer that validates and hashes the Annex B stream instead of
+// decoding it, so the streaming core can run without a GPU. The callbacks are
+// only valid after HeadlessDecoderInitialize() and must not be shared between
+// concurrent connections.
+void HeadlessDecoderInitialize(PHEADLESS_DECODER_OPTIONS options);
+PDECODER_RENDERER_CALLBACKS HeadlessDecoderGetCallbacks(void);
+
+// Must only be called while frames aren't being submitted
+void HeadlessDecoderGetStats(PHEADLESS_DECODER_STATS stats);
+
+// Returns the submit latency in ms that percentile percent of frames were under
+int HeadlessDecoderGetLatencyPercentile(PHEADLESS_DECODER_STATS stats, int percentile);
@@ -0,0 +1,355 @@
+// Runs a full streaming session against a host without decoding or rendering
+// anything. Video is validated and hashed by the headless decoder and audio
+// is only counted, so the streaming core can be profiled on a machine without
+// a GPU. The app must already have been launched on the host with the
+// remote input key passed here.
+
+#include "decoder.h"
+
+#include "Platform.h"
+#include "PlatformThreads.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
+
+// GFE 3.x, which most hosts run
+#define DEFAULT_APP_VERSION "7.1.431.-1"
+
+typedef struct _HEADLESS_OPTIONS {
+    const char* address;
+    const char* appVersion;
+    const char* gfeVersion;
+    int width;
+    int height;
+    int fps;
+    int bitrate;
+    int packetSize;
+    int hevc;
+    int slices;
+    int directSubmit;
+    int duration;
+    const char* rikey;
+    int rikeyId;
+    const char* dumpFile;
+    int printFrameHashes;
+    const char* traceFile;
+    const char* captureFile;
+    int verbose;
+} HEADLESS_OPTIONS;
+
+static HEADLESS_OPTIONS options;
+
+static volatile int stopRequested;
+static volatile int connectionTerminated;
+static volatile int terminationError;
+
+static unsigned int audioPackets;
+static unsigned int audioPacketsLost;
+static unsigned long long audioBytes;
+
+static void headlessLogMessage(const char* format, ...) {
+    va_list va;
+
+    if (!options.verbose) {
+        return;
+    }
+
+    va_start(va, format);
+    vfprintf(stderr, format, va);
+    va_end(va);
+}
+
+static void headlessStageFailed(int stage, int errorCode) {
+    fprintf(stderr, "%s failed: %d\n", LiGetStageName(stage), errorCode);
+}
+
+static void headlessConnectionTerminated(int errorCode) {
+    terminationError = errorCode;
+    connectionTerminated = 1;
+}
+
+static int headlessAudioInit(int audioConfiguration, const POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* context, int arFlags) {
+    return 0;
+}
+
+static void headlessDecodeAndPlaySample(char* sampleData, int sampleLength) {
+    // Lost packets are reported with no data
+    if (sampleData == NULL) {
+        audioPacketsLost++;
+        return;
+    }
+
+    audioPackets++;
+    audioBytes += sampleLength;
+}
+
+static void handleSignal(int signal) {
+    stopRequested = 1;
+}
+
+static int writeTrace(const char* fileName) {
+    char* json;
+    FILE* file;
+    int err = 0;
+
+    LiTraceSetEnabled(0);
+
+    json = LiTraceDumpJson();
+    if (json == NULL) {
+        return -1;
+    }
+
+    file = fopen(fileName, "w");
+    if (file == NULL || fputs(json, file) < 0) {
+        err = -1;
+    }
+    if (file != NULL && fclose(file) != 0) {
+        err = -1;
+    }
+
+    free(json);
+    return err;
+}
+
+static void hexStringToBytes(const char* string, char* output, int length) {
+    int i;
+
+    for (i = 0; i < length && string[i * 2] != 0 && string[i * 2 + 1] != 0; i++) {
+        sscanf(&string[i * 2], "%2hhx", (unsigned char*)&output[i]);
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options] -a ADDRESS\n"
+            "  -a ADDRESS      host to stream from\n"
+            "  -A VERSION      appversion from the host's /serverinfo (default %s)\n"
+            "  -G VERSION      GfeVersion from the host's /serverinfo\n"
+            "  -r WxH          resolution (default 1280x720)\n"
+            "  -f FPS          frame rate (default 60)\n"
+            "  -b KBPS         bitrate (default 10000)\n"
+            "  -p BYTES        video packet size (default 1392)\n"
+            "  -e              request HEVC\n"
+            "  -c SLICES       slices per frame; above 1, P-frames are submitted\n"
+            "                  slice by slice (default 1)\n"
+            "  -D              submit video from the receive thread\n"
+            "  -d SECONDS      stop after this long (default: until the stream ends)\n"
+            "  -k HEX          remote input key passed to /launch\n"
+            "  -K ID           remote input key ID passed to /launch\n"
+            "  -o FILE         write the elementary video stream to FILE\n"
+            "  -x              print the hash of each frame\n"
+            "  -t FILE         write a Chrome trace of the session to FILE\n"
+            "  -w FILE         record the received datagrams to FILE for tools/replay\n"
+            "  -v              log messages from moonlight-common-c\n",
+            name, DEFAULT_APP_VERSION);
+}
+
+static int parseOptions(int argc, char** argv) {
+    int opt;
+
+    options.appVersion = DEFAULT_APP_VERSION;
+    options.width = 1280;
+    options.height = 720;
+    options.fps = 60;
+    options.bitrate = 10000;
+    options.packetSize = 1392;
+    options.slices = 1;
+    options.rikey = "";
+
+    while ((opt = getopt(argc, argv, "a:A:G:r:f:b:p:ec:Dd:k:K:o:xt:w:vh")) != -1) {
+        switch (opt) {
+        case 'a':
+            options.address = optarg;
+            break;
+        case 'A':
+            options.appVersion = optarg;
+            break;
+        case 'G':
+            options.gfeVersion = optarg;
+            break;
+        case 'r':
+            if (sscanf(optarg, "%dx%d", &options.width, &options.height) != 2) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'f':
+            options.fps = atoi(optarg);
+            break;
+        case 'b':
+            options.bitrate = atoi(optarg);
+            break;
+        case 'p':
+            options.packetSize = atoi(optarg);
+            break;
+        case 'e':
+            options.hevc = 1;
+            break;
+        case 'c':
+            options.slices = atoi(optarg);
+            break;
+        case 'D':
+            options.directSubmit = 1;
+            break;
+        case 'd':
+            options.duration = atoi(optarg);
+            break;
+        case 'k':
+            options.rikey = optarg;
+            break;
+        case 'K':
+            options.rikeyId = atoi(optarg);
+            break;
+        case 'o':
+            options.dumpFile = optarg;
+            break;
+        case 'x':
+            options.printFrameHashes = 1;
+            break;
+        case 't':
+            options.traceFile = optarg;
+            break;
+        case 'w':
+            options.captureFile = optarg;
+            break;
+        case 'v':
+            options.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (options.address == NULL || options.width <= 0 || options.height <= 0 ||
+            options.fps <= 0 || options.bitrate <= 0 || options.slices <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    SERVER_INFORMATION serverInfo;
+    STREAM_CONFIGURATION streamConfig;
+    CONNECTION_LISTENER_CALLBACKS clCallbacks;
+    AUDIO_RENDERER_CALLBACKS arCallbacks;
+    HEADLESS_DECODER_OPTIONS decoderOptions;
+    HEADLESS_DECODER_STATS stats;
+    FILE* dumpFile = NULL;
+    unsigned long long startTime;
+    int rikeyId;
+    int err;
+
+    if (parseOptions(argc, argv) != 0) {
+        return 1;
+    }
+
+    if (options.dumpFile != NULL) {
+        dumpFile = fopen(options.dumpFile, "wb");
+        if (dumpFile == NULL) {
+            fprintf(stderr, "Failed to open %s\n", options.dumpFile);
+            return 1;
+        }
+    }
+
+    LiInitializeServerInformation(&serverInfo);
+    serverInfo.address = options.address;
+    serverInfo.serverInfoAppVersion = options.appVersion;
+    serverInfo.serverInfoGfeVersion = options.gfeVersion;
+
+    LiInitializeStreamConfiguration(&streamConfig);
+    streamConfig.width = options.width;
+    streamConfig.height = options.height;
+    streamConfig.fps = options.fps;
+    streamConfig.bitrate = options.bitrate;
+    streamConfig.packetSize = options.packetSize;
+    streamConfig.streamingRemotely = STREAM_CFG_AUTO;
+    streamConfig.audioConfiguration = AUDIO_CONFIGURATION_STEREO;
+    streamConfig.supportsHevc = options.hevc;
+    hexStringToBytes(options.rikey, streamConfig.remoteInputAesKey, sizeof(streamConfig.remoteInputAesKey));
+    rikeyId = htonl(options.rikeyId);
+    memcpy(streamConfig.remoteInputAesIv, &rikeyId, sizeof(rikeyId));
+
+    LiInitializeConnectionCallbacks(&clCallbacks);
+    clCallbacks.stageFailed = headlessStageFailed;
+    clCallbacks.connectionTerminated = headlessConnectionTerminated;
+    clCallbacks.logMessage = headlessLogMessage;
+
+    LiInitializeAudioCallbacks(&arCallbacks);
+    arCallbacks.init = headlessAudioInit;
+    arCallbacks.decodeAndPlaySample = headlessDecodeAndPlaySample;
+    arCallbacks.capabilities = CAPABILITY_ADAPTIVE_SUBMIT;
+
+    memset(&decoderOptions, 0, sizeof(decoderOptions));
+    decoderOptions.capabilities = options.directSubmit ? CAPABILITY_DIRECT_SUBMIT : 0;
+    if (options.slices > 1) {
+        decoderOptions.capabilities |= CAPABILITY_SLICES_PER_FRAME(options.slices) | CAPABILITY_SLICE_SUBMIT;
+    }
+    decoderOptions.dumpFile = dumpFile;
+    decoderOptions.printFrameHashes = options.printFrameHashes;
+    HeadlessDecoderInitialize(&decoderOptions);
+
+    if (options.captureFile != NULL && LiSetCaptureFile(options.captureFile) != 0) {
+        fprintf(stderr, "Failed to set up capture to %s\n", options.captureFile);
+        return 1;
+    }
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    if (options.traceFile != NULL) {
+        LiTraceSetThreadName("Main");
+        LiTraceSetEnabled(1);
+    }
+
+    err = LiStartConnection(&serverInfo, &streamConfig, &clCallbacks,
+                            HeadlessDecoderGetCallbacks(), &arCallbacks,
+                            NULL, 0, NULL, 0);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start the connection: %d\n", err);
+        return 1;
+    }
+
+    startTime = LiGetMillis();
+    while (!stopRequested && !connectionTerminated &&
+           (options.duration == 0 || LiGetMillis() - startTime < (unsigned long long)options.duration * 1000)) {
+        PltSleepMs(100);
+    }
+
+    if (connectionTerminated) {
+        fprintf(stderr, "Connection terminated: %d\n", terminationError);
+    }
+
+    LiStopConnection();
+
+    if (options.traceFile != NULL && writeTrace(options.traceFile) != 0) {
+        fprintf(stderr, "Failed to write trace to %s\n", options.traceFile);
+    }
+    if (dumpFile != NULL) {
+        fclose(dumpFile);
+    }
+
+    HeadlessDecoderGetStats(&stats);
+
+    printf("video: %s %dx%d, %u frames (%u IDR, %u slice units), %u invalid, %u missing\n",
+           (stats.videoFormat & VIDEO_FORMAT_MASK_H265) ? "H.265" : "H.264",
+           stats.width, stats.height, stats.frames, stats.idrFrames, stats.sliceUnits,
+           stats.invalidFrames, stats.missingFrames);
+    if (stats.lastFrameTimeMs > stats.firstFrameTimeMs) {
+        double seconds = (stats.lastFrameTimeMs - stats.firstFrameTimeMs) / 1000.0;
+
+        printf("throughput: %.1f fps, %.2f Mbps\n",
+               (stats.frames - 1) / seconds, stats.bytes * 8 / seconds / 1e6);
+    }
+    printf("receive to submit latency: p50 %d ms, p99 %d ms, max %d ms\n",
+           HeadlessDecoderGetLatencyPercentile(&stats, 50),
+           HeadlessDecoderGetLatencyPercentile(&stats, 99),
+           HeadlessDecoderGetLatencyPercentile(&stats, 100));
+    printf("audio: %u packets, %llu bytes, %u lost\n", audioPackets, audioBytes, audioPacketsLost);
+    printf("stream hash: %016llx\n", stats.streamHash);
+
+    return stats.invalidFrames != 0;
+}
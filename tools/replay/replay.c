@@ -0,0 +1,497 @@
+// Replays a capture made with LiSetCaptureFile() through the video and audio
+// receive paths. Each datagram goes through the same byte order fixups as in
+// the receive threads and then into RtpfAddPacket() or RtpqAddPacket(), at
+// the pace it was received or faster. Decode units go to the headless
+// decoder, which validates and hashes them.
+//
+// Replaying as fast as possible is deterministic for video, so the stream
+// hash of two runs only differs if the depacketizer or FEC queue behaves
+// differently. The audio reorder queue has a timeout, so audio may only be
+// deterministic at the original pace.
+
+#include "Limelight-internal.h"
+#include "RtpReorderQueue.h"
+#include "BufferPool.h"
+#include "decoder.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct _REPLAY_OPTIONS {
+    const char* fileName;
+    double speed;
+    int sliceSubmit;
+    const char* dumpFile;
+    int printFrameHashes;
+    const char* traceFile;
+    int verbose;
+} REPLAY_OPTIONS;
+
+typedef struct _REPLAY_STATS {
+    unsigned int videoPackets;
+    unsigned int audioPackets;
+    unsigned int audioPacketsPlayed;
+    unsigned int audioPacketsMissing;
+    unsigned int idrRequests;
+    unsigned int frameLossReports;
+
+    // Time spent inside RtpfAddPacket()
+    unsigned long long videoReceiveNs;
+} REPLAY_STATS;
+
+typedef struct _REPLAY_AUDIO_PACKET {
+    // data must remain at the front
+    char data[AUDIO_MAX_PACKET_SIZE];
+    RTP_QUEUE_ENTRY entry;
+} REPLAY_AUDIO_PACKET, *PREPLAY_AUDIO_PACKET;
+
+static REPLAY_OPTIONS options;
+static REPLAY_STATS stats;
+
+static BUFFER_POOL packetPool;
+static RTP_FEC_QUEUE rtpQueue;
+static RTP_REORDER_QUEUE audioQueue;
+static unsigned short lastAudioSequenceNumber;
+static int audioStarted;
+
+// Globals and callbacks normally provided by the rest of moonlight-common-c
+
+STREAM_CONFIGURATION StreamConfig;
+CONNECTION_LISTENER_CALLBACKS ListenerCallbacks;
+DECODER_RENDERER_CALLBACKS VideoCallbacks;
+int AppVersionQuad[4];
+int NegotiatedVideoFormat;
+int AudioPacketDuration;
+
+void requestIdrOnDemand(void) {
+    stats.idrRequests++;
+}
+
+void connectionDetectedFrameLoss(int startFrame, int endFrame) {
+    stats.frameLossReports++;
+}
+
+void connectionReceivedCompleteFrame(int frameIndex) {
+}
+
+void connectionSawFrame(int frameIndex) {
+}
+
+void connectionLostPackets(int lastReceivedPacket, int nextReceivedPacket) {
+}
+
+int isReferenceFrameInvalidationEnabled(void) {
+    return 0;
+}
+
+uint64_t LiGetMillis(void) {
+    return PltGetMillis();
+}
+
+void LiInitializeVideoCallbacks(PDECODER_RENDERER_CALLBACKS drCallbacks) {
+    memset(drCallbacks, 0, sizeof(*drCallbacks));
+}
+
+void* allocateVideoPacketBuffer(void) {
+    return BpAllocateBuffer(&packetPool);
+}
+
+void freeVideoPacketBuffer(void* buffer) {
+    BpFreeBuffer(&packetPool, buffer);
+}
+
+// Audio packets are malloc()ed here, but RtpqCleanupQueue() frees them through this
+void freeAudioPacketBuffer(void* buffer) {
+    free(buffer);
+}
+
+// Platform.c references these for LiStartConnection() setup, which we never call
+int enet_initialize(void) {
+    return 0;
+}
+
+void enet_deinitialize(void) {
+}
+
+int initializePlatformSockets(void) {
+    return 0;
+}
+
+void cleanupPlatformSockets(void) {
+}
+
+static void replayLogMessage(const char* format, ...) {
+    va_list va;
+
+    if (!options.verbose) {
+        return;
+    }
+
+    va_start(va, format);
+    vfprintf(stderr, format, va);
+    va_end(va);
+}
+
+// Receive paths
+
+// Same as ReceiveThreadProc() in VideoStream.c
+static void replayVideoDatagram(const char* data, int length) {
+    int receiveSize = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
+    char* buffer;
+    PRTP_PACKET packet;
+    uint64_t startNs;
+
+    buffer = (char*)allocateVideoPacketBuffer();
+    if (buffer == NULL) {
+        return;
+    }
+
+    // recv() would have truncated anything longer
+    if (length > receiveSize) {
+        length = receiveSize;
+    }
+    memcpy(buffer, data, length);
+
+    stats.videoPackets++;
+
+    startNs = PltGetNanoseconds();
+
+    packet = (PRTP_PACKET)&buffer[0];
+    packet->sequenceNumber = htons(packet->sequenceNumber);
+    packet->timestamp = htonl(packet->timestamp);
+    packet->ssrc = htonl(packet->ssrc);
+
+    if (RtpfAddPacket(&rtpQueue, packet, length, (PRTPFEC_QUEUE_ENTRY)&buffer[receiveSize]) != RTPF_RET_QUEUED) {
+        freeVideoPacketBuffer(buffer);
+    }
+
+    stats.videoReceiveNs += PltGetNanoseconds() - startNs;
+}
+
+static void playAudioPacket(PREPLAY_AUDIO_PACKET packet) {
+    PRTP_PACKET rtp = (PRTP_PACKET)packet->data;
+
+    // Like decodeInputData() in AudioStream.c, count what the renderer would conceal
+    if (audioStarted) {
+        stats.audioPacketsMissing += RtpqGetLostPackets(lastAudioSequenceNumber, rtp->sequenceNumber,
+                                                        AUDIO_MAX_CONCEALED_DURATION_MS / AudioPacketDuration);
+    }
+    lastAudioSequenceNumber = rtp->sequenceNumber;
+    audioStarted = 1;
+
+    stats.audioPacketsPlayed++;
+}
+
+// Same as ReceiveThreadProc() in AudioStream.c, minus dropping the
+// backlog at the start of the stream
+static void replayAudioDatagram(const char* data, int length) {
+    PREPLAY_AUDIO_PACKET packet;
+    PRTP_PACKET rtp;
+    int queueStatus;
+
+    if (length < (int)sizeof(RTP_PACKET) || length > AUDIO_MAX_PACKET_SIZE) {
+        return;
+    }
+
+    packet = (PREPLAY_AUDIO_PACKET)malloc(sizeof(*packet));
+    if (packet == NULL) {
+        return;
+    }
+    memcpy(packet->data, data, length);
+
+    rtp = (PRTP_PACKET)&packet->data[0];
+    if (rtp->packetType != AUDIO_PACKET_TYPE) {
+        free(packet);
+        return;
+    }
+
+    stats.audioPackets++;
+
+    rtp->sequenceNumber = htons(rtp->sequenceNumber);
+    rtp->timestamp = htonl(rtp->timestamp);
+    rtp->ssrc = htonl(rtp->ssrc);
+
+    queueStatus = RtpqAddPacket(&audioQueue, rtp, &packet->entry);
+    if (RTPQ_HANDLE_NOW(queueStatus)) {
+        playAudioPacket(packet);
+        free(packet);
+        return;
+    }
+
+    if (!RTPQ_PACKET_CONSUMED(queueStatus)) {
+        free(packet);
+    }
+
+    if (RTPQ_PACKET_READY(queueStatus)) {
+        while ((packet = (PREPLAY_AUDIO_PACKET)RtpqGetQueuedPacket(&audioQueue)) != NULL) {
+            playAudioPacket(packet);
+            free(packet);
+        }
+    }
+}
+
+// Capture parsing
+
+static int checkHeader(PCAPTURE_FILE_HEADER header, size_t fileSize) {
+    if (fileSize < sizeof(*header) || memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s isn't a capture file\n", options.fileName);
+        return -1;
+    }
+    if (header->version != CAPTURE_VERSION) {
+        fprintf(stderr, "Unsupported capture version %u\n", header->version);
+        return -1;
+    }
+    if (header->headerSize < sizeof(*header) || header->chunkSize == 0 ||
+            header->headerSize > header->chunkSize || header->packetSize <= 0) {
+        fprintf(stderr, "Corrupt capture header\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Feeds every record to the receive paths. Returns the capture time of the last one.
+static uint64_t replayRecords(const char* capture, size_t fileSize, PCAPTURE_FILE_HEADER header) {
+    uint64_t startNs = PltGetNanoseconds();
+    uint64_t lastTimeNs = 0;
+    size_t offset = header->headerSize;
+
+    while (offset + sizeof(CAPTURE_RECORD_HEADER) <= fileSize) {
+        size_t chunkEnd = (offset / header->chunkSize + 1) * header->chunkSize;
+        PCAPTURE_RECORD_HEADER record;
+
+        // Too little space was left at the end of this chunk for a record
+        if (chunkEnd - offset < sizeof(CAPTURE_RECORD_HEADER)) {
+            offset = chunkEnd;
+            continue;
+        }
+
+        record = (PCAPTURE_RECORD_HEADER)&capture[offset];
+        if (record->stream == CAPTURE_STREAM_END) {
+            break;
+        }
+        if (offset + CAPTURE_RECORD_SIZE(record->length) > fileSize) {
+            fprintf(stderr, "Capture is truncated\n");
+            break;
+        }
+        offset += CAPTURE_RECORD_SIZE(record->length);
+
+        if (record->stream == CAPTURE_STREAM_PADDING) {
+            continue;
+        }
+
+        // Wait until this datagram is due
+        if (options.speed > 0) {
+            uint64_t dueNs = startNs + (uint64_t)(record->timeNs / options.speed);
+            uint64_t now = PltGetNanoseconds();
+
+            if (dueNs > now + 1000000) {
+                PltSleepMs((int)((dueNs - now) / 1000000));
+            }
+        }
+        lastTimeNs = record->timeNs;
+
+        if (record->stream == CAPTURE_STREAM_VIDEO) {
+            replayVideoDatagram((const char*)(record + 1), (int)record->length);
+        }
+        else if (record->stream == CAPTURE_STREAM_AUDIO) {
+            replayAudioDatagram((const char*)(record + 1), (int)record->length);
+        }
+    }
+
+    return lastTimeNs;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options] CAPTURE\n"
+            "  -p SPEED        replay at SPEED times the original pace, 0 for as\n"
+            "                  fast as possible (default 0)\n"
+            "  -S              submit P-frame slices to the decoder as they complete\n"
+            "  -o FILE         write the elementary video stream to FILE\n"
+            "  -x              print the hash of each frame\n"
+            "  -t FILE         write a Chrome trace of the replay to FILE\n"
+            "  -v              log messages from moonlight-common-c\n",
+            name);
+}
+
+static int parseOptions(int argc, char** argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:So:xt:vh")) != -1) {
+        switch (opt) {
+        case 'p':
+            options.speed = atof(optarg);
+            break;
+        case 'S':
+            options.sliceSubmit = 1;
+            break;
+        case 'o':
+            options.dumpFile = optarg;
+            break;
+        case 'x':
+            options.printFrameHashes = 1;
+            break;
+        case 't':
+            options.traceFile = optarg;
+            break;
+        case 'v':
+            options.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind != argc - 1 || options.speed < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    options.fileName = argv[optind];
+
+    return 0;
+}
+
+static int writeTrace(const char* fileName) {
+    char* json;
+    FILE* file;
+    int err = 0;
+
+    LiTraceSetEnabled(0);
+
+    json = LiTraceDumpJson();
+    if (json == NULL) {
+        return -1;
+    }
+
+    file = fopen(fileName, "w");
+    if (file == NULL || fputs(json, file) < 0) {
+        err = -1;
+    }
+    if (file != NULL && fclose(file) != 0) {
+        err = -1;
+    }
+
+    free(json);
+    return err;
+}
+
+int main(int argc, char** argv) {
+    HEADLESS_DECODER_OPTIONS decoderOptions;
+    HEADLESS_DECODER_STATS decoderStats;
+    PCAPTURE_FILE_HEADER header;
+    struct stat fileStat;
+    FILE* dumpFile = NULL;
+    char* capture;
+    uint64_t replayStartNs, replayNs, captureNs;
+    int fd;
+
+    if (parseOptions(argc, argv) != 0) {
+        return 1;
+    }
+
+    fd = open(options.fileName, O_RDONLY);
+    if (fd < 0 || fstat(fd, &fileStat) < 0) {
+        fprintf(stderr, "Failed to open %s\n", options.fileName);
+        return 1;
+    }
+    if (fileStat.st_size == 0) {
+        fprintf(stderr, "%s is empty\n", options.fileName);
+        return 1;
+    }
+
+    capture = (char*)mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (capture == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s\n", options.fileName);
+        return 1;
+    }
+
+    header = (PCAPTURE_FILE_HEADER)capture;
+    if (checkHeader(header, fileStat.st_size) != 0) {
+        return 1;
+    }
+
+    if (options.dumpFile != NULL) {
+        dumpFile = fopen(options.dumpFile, "wb");
+        if (dumpFile == NULL) {
+            fprintf(stderr, "Failed to open %s\n", options.dumpFile);
+            return 1;
+        }
+    }
+
+    // Set up the receive paths like the capturing connection had them
+    StreamConfig.packetSize = header->packetSize;
+    StreamConfig.width = header->width;
+    StreamConfig.height = header->height;
+    StreamConfig.fps = header->fps;
+    StreamConfig.audioConfiguration = header->audioConfiguration;
+    AudioPacketDuration = header->audioPacketDuration > 0 ? header->audioPacketDuration : 5;
+    NegotiatedVideoFormat = header->videoFormat;
+    memcpy(AppVersionQuad, header->appVersionQuad, sizeof(AppVersionQuad));
+    ListenerCallbacks.logMessage = replayLogMessage;
+
+    memset(&decoderOptions, 0, sizeof(decoderOptions));
+    decoderOptions.capabilities = CAPABILITY_DIRECT_SUBMIT;
+    if (options.sliceSubmit) {
+        decoderOptions.capabilities |= CAPABILITY_SLICE_SUBMIT;
+    }
+    decoderOptions.dumpFile = dumpFile;
+    decoderOptions.printFrameHashes = options.printFrameHashes;
+    HeadlessDecoderInitialize(&decoderOptions);
+    memcpy(&VideoCallbacks, HeadlessDecoderGetCallbacks(), sizeof(VideoCallbacks));
+    VideoCallbacks.setup(NegotiatedVideoFormat, StreamConfig.width, StreamConfig.height, StreamConfig.fps, NULL, 0);
+
+    BpInitializePool(&packetPool, StreamConfig.packetSize + MAX_RTP_HEADER_SIZE + sizeof(RTPFEC_QUEUE_ENTRY),
+                     VIDEO_PACKET_POOL_BUFFERS);
+    initializeVideoDepacketizer(StreamConfig.packetSize);
+    RtpfInitializeQueue(&rtpQueue, RTP_FEC_FRAME_WINDOW, (VideoCallbacks.capabilities & CAPABILITY_SLICE_SUBMIT) != 0);
+    RtpqInitializeQueue(&audioQueue, RTPQ_DEFAULT_MAX_SIZE, RTPQ_DEFAULT_QUEUE_TIME);
+
+    if (options.traceFile != NULL) {
+        LiTraceSetThreadName("Replay");
+        LiTraceSetEnabled(1);
+    }
+
+    replayStartNs = PltGetNanoseconds();
+    captureNs = replayRecords(capture, fileStat.st_size, header);
+    replayNs = PltGetNanoseconds() - replayStartNs;
+
+    destroyVideoDepacketizer();
+    RtpfCleanupQueue(&rtpQueue);
+    RtpqCleanupQueue(&audioQueue);
+
+    if (options.traceFile != NULL && writeTrace(options.traceFile) != 0) {
+        fprintf(stderr, "Failed to write trace to %s\n", options.traceFile);
+    }
+    if (dumpFile != NULL) {
+        fclose(dumpFile);
+    }
+
+    HeadlessDecoderGetStats(&decoderStats);
+
+    printf("capture: %.1f s replayed in %.1f s\n", captureNs / 1e9, replayNs / 1e9);
+    printf("video: %u packets, %u frames (%u IDR, %u slice units), %u invalid, %u missing\n",
+           stats.videoPackets, decoderStats.frames, decoderStats.idrFrames, decoderStats.sliceUnits,
+           decoderStats.invalidFrames, decoderStats.missingFrames);
+    printf("fec: %u clean, %u recovered (%u shards), %u unrecoverable, %u parity wasted\n",
+           rtpQueue.stats.framesReceivedClean, rtpQueue.stats.framesRecovered,
+           rtpQueue.stats.shardsRecovered, rtpQueue.stats.framesUnrecoverable,
+           rtpQueue.stats.parityPacketsWasted);
+    printf("receive path: %.1f ms, %.0f packets/s, %u IDR requests, %u loss reports\n",
+           stats.videoReceiveNs / 1e6,
+           stats.videoReceiveNs != 0 ? stats.videoPackets / (stats.videoReceiveNs / 1e9) : 0,
+           stats.idrRequests, stats.frameLossReports);
+    printf("audio: %u packets, %u played, %u missing\n",
+           stats.audioPackets, stats.audioPacketsPlayed, stats.audioPacketsMissing);
+    printf("stream hash: %016llx\n", decoderStats.streamHash);
+
+    BpCleanupPool(&packetPool);
+    munmap(capture, fileStat.st_size);
+
+    return decoderStats.invalidFrames != 0;
+}
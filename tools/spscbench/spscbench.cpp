@@ -0,0 +1,233 @@
+// Benchmark for the single-producer/single-consumer ring in spscring.hpp.
+//
+// A producer thread streams a counting sequence of samples through the ring
+// to a consumer thread, which checks that every sample arrives in order. The
+// same transfer is run through a copy of the ring the audio jitter buffer used
+// before, with volatile indices sharing a cache line and full barriers around
+// every update, so the two can be compared on the same machine.
+//
+// Both sides spin while the ring is full or empty, yielding so the benchmark
+// still makes progress with a single core. Results are only meaningful with
+// the producer and consumer on separate cores.
+
+#include "spscring.hpp"
+
+#include <chrono>
+#include <thread>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Same size as the audio jitter buffer's ring
+#define RING_CAPACITY 32768
+
+// The old jitter buffer ring, minus the audio handling
+template <typename T, uint32_t Capacity>
+class LegacyRing {
+    public:
+        LegacyRing() : m_WriteIndex(0), m_ReadIndex(0) {}
+
+        uint32_t Write(const T* items, uint32_t count) {
+            uint32_t space = Capacity - (m_WriteIndex - m_ReadIndex);
+
+            if (count > space) {
+                count = space;
+            }
+
+            uint32_t start = m_WriteIndex % Capacity;
+            uint32_t firstCount = Capacity - start < count ? Capacity - start : count;
+            memcpy(&m_Items[start], items, firstCount * sizeof(T));
+            memcpy(&m_Items[0], &items[firstCount], (count - firstCount) * sizeof(T));
+
+            __sync_synchronize();
+
+            m_WriteIndex += count;
+            return count;
+        }
+
+        uint32_t Read(T* items, uint32_t count) {
+            uint32_t available = m_WriteIndex - m_ReadIndex;
+
+            __sync_synchronize();
+
+            if (count > available) {
+                count = available;
+            }
+
+            uint32_t start = m_ReadIndex % Capacity;
+            uint32_t firstCount = Capacity - start < count ? Capacity - start : count;
+            memcpy(items, &m_Items[start], firstCount * sizeof(T));
+            memcpy(&items[firstCount], &m_Items[0], (count - firstCount) * sizeof(T));
+
+            __sync_synchronize();
+
+            m_ReadIndex += count;
+            return count;
+        }
+
+    private:
+        T m_Items[Capacity];
+        volatile uint32_t m_WriteIndex;
+        volatile uint32_t m_ReadIndex;
+};
+
+typedef struct _BENCH_OPTIONS {
+    unsigned long long items;
+    int writeBatch;
+    int readBatch;
+    int runs;
+} BENCH_OPTIONS;
+
+static BENCH_OPTIONS options = {
+    200000000ULL, // items
+    480,          // writeBatch, a 5 ms stereo packet
+    480,          // readBatch
+    3,            // runs
+};
+
+// Returns the seconds taken to move options.items through the ring, or a
+// negative value if anything arrived out of order
+template <typename Ring>
+static double runTransfer(Ring* ring) {
+    bool ok = true;
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([ring]() {
+        short* batch = new short[options.writeBatch];
+        unsigned long long sent = 0;
+
+        while (sent < options.items) {
+            uint32_t count = options.items - sent < (unsigned long long)options.writeBatch ?
+                (uint32_t)(options.items - sent) : options.writeBatch;
+
+            for (uint32_t i = 0; i < count; i++) {
+                batch[i] = (short)(sent + i);
+            }
+
+            // Keep retrying whatever didn't fit
+            uint32_t written = 0;
+            while (written < count) {
+                uint32_t n = ring->Write(&batch[written], count - written);
+                if (n == 0) {
+                    std::this_thread::yield();
+                }
+                written += n;
+            }
+            sent += count;
+        }
+
+        delete[] batch;
+    });
+
+    std::thread consumer([ring, &ok]() {
+        short* batch = new short[options.readBatch];
+        unsigned long long received = 0;
+
+        while (received < options.items) {
+            uint32_t n = ring->Read(batch, options.readBatch);
+            if (n == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            for (uint32_t i = 0; i < n; i++) {
+                if (batch[i] != (short)(received + i)) {
+                    ok = false;
+                }
+            }
+            received += n;
+        }
+
+        delete[] batch;
+    });
+
+    producer.join();
+    consumer.join();
+
+    if (!ok) {
+        return -1;
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Ring>
+static int benchRing(const char* name) {
+    double best = 0;
+
+    for (int run = 0; run < options.runs; run++) {
+        Ring* ring = new Ring();
+        double seconds = runTransfer(ring);
+        delete ring;
+
+        if (seconds < 0) {
+            fprintf(stderr, "%s: samples arrived out of order\n", name);
+            return -1;
+        }
+        if (run == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+
+    printf("%-8s %8.1f M samples/s, %6.2f ns/sample (best of %d)\n",
+           name, options.items / best / 1e6, best * 1e9 / options.items, options.runs);
+    return 0;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n SAMPLES      samples to transfer per run (default %llu)\n"
+            "  -w SAMPLES      samples per write (default %d)\n"
+            "  -r SAMPLES      samples per read (default %d)\n"
+            "  -R RUNS         runs of each ring; the best is reported (default %d)\n",
+            name, options.items, options.writeBatch, options.readBatch, options.runs);
+}
+
+static int parseOptions(int argc, char** argv) {
+    int c;
+
+    while ((c = getopt(argc, argv, "n:w:r:R:h")) != -1) {
+        switch (c) {
+        case 'n':
+            options.items = strtoull(optarg, NULL, 10);
+            break;
+        case 'w':
+            options.writeBatch = atoi(optarg);
+            break;
+        case 'r':
+            options.readBatch = atoi(optarg);
+            break;
+        case 'R':
+            options.runs = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (options.items == 0 || options.writeBatch <= 0 || options.readBatch <= 0 || options.runs <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (parseOptions(argc, argv) != 0) {
+        return 1;
+    }
+
+    printf("%llu samples, %d per write, %d per read, %u sample ring\n",
+           options.items, options.writeBatch, options.readBatch, RING_CAPACITY);
+
+    if (benchRing<LegacyRing<short, RING_CAPACITY> >("legacy") != 0 ||
+        benchRing<SpscRing<short, RING_CAPACITY> >("spsc") != 0) {
+        return 1;
+    }
+
+    return 0;
+}
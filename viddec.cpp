@@ -7,14 +7,56 @@
 
 #include <h264_stream.h>
 
+#include <pthread.h>
+
 #define INITIAL_DECODE_BUFFER_LEN 128 * 1024
 
-static unsigned char* s_DecodeBuffer;
-static unsigned int s_DecodeBufferLength;
+// Decode units are handed to the main thread in one of these, which calls
+// Decode() on them in order. The decoder thread only has to wait if all of
+// them are still waiting on the decoder.
+typedef struct _DECODE_BUFFER {
+    unsigned char* data;
+    unsigned int capacity;
+    unsigned int length;
+    
+    // If set, this is the depacketizer's buffer for the decode unit and it's
+    // decoded in place of data. It's released once the decode completes.
+    PLENTRY retainedBufferList;
+    
+    // Passed as the decode ID so PictureReady() knows which frame it got
+    uint32_t frameNumber;
+} DECODE_BUFFER;
+
+static DECODE_BUFFER s_DecodeBuffers[MAX_DECODES_IN_FLIGHT];
+static pthread_mutex_t s_DecodeBufferLock;
+static pthread_cond_t s_DecodeBufferFreed;
+static int s_FreeDecodeBuffers;
+
+// Only touched by the decoder thread
+static int s_NextFillBuffer;
+
+// Only touched by the main thread
+static int s_NextDecodeBuffer;
+static int s_ReadyDecodeBuffers;
+static bool s_DecodePending;
+
 static int s_LastTextureType;
 static int s_LastTextureId;
 static bool s_FirstFrameDisplayed;
-static uint64_t s_LastPaintFinishedTime;
+
+// The SPS is almost always identical across a session, so we keep the fixed up
+// versions of the last few we've seen instead of reparsing it on every IDR frame
+#define SPS_CACHE_ENTRIES 4
+
+typedef struct _SPS_CACHE_ENTRY {
+    unsigned char* original;
+    int originalLength;
+    unsigned char* fixedUp;
+    int fixedUpLength;
+} SPS_CACHE_ENTRY;
+
+static SPS_CACHE_ENTRY s_SpsCache[SPS_CACHE_ENTRIES];
+static int s_SpsCacheNext;
 
 #define assertNoGLError() assert(!glGetError())
 
@@ -136,11 +178,12 @@ bool MoonlightInstance::InitializeRenderingSurface(int width, int height) {
 int MoonlightInstance::VidDecSetup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
     g_Instance->m_VideoDecoder = new pp::VideoDecoder(g_Instance);
     
-    s_DecodeBufferLength = INITIAL_DECODE_BUFFER_LEN;
-    s_DecodeBuffer = (unsigned char *)malloc(s_DecodeBufferLength);
     s_LastTextureType = 0;
     s_LastTextureId = 0;
     s_FirstFrameDisplayed = false;
+    g_Instance->m_FramePacer.Reset(g_Instance->m_FramePacingPolicy, redrawRate);
+    g_Instance->m_LastPacingStatsTime = LiGetMillis();
+    g_Instance->m_LatencyTracker.Reset();
     
     int32_t err;
 
@@ -178,6 +221,20 @@ int MoonlightInstance::VidDecSetup(int videoFormat, int width, int height, int r
         }
     }
     
+    for (int i = 0; i < MAX_DECODES_IN_FLIGHT; i++) {
+        s_DecodeBuffers[i].capacity = INITIAL_DECODE_BUFFER_LEN;
+        s_DecodeBuffers[i].data = (unsigned char *)malloc(s_DecodeBuffers[i].capacity);
+        s_DecodeBuffers[i].length = 0;
+        s_DecodeBuffers[i].retainedBufferList = NULL;
+    }
+    pthread_mutex_init(&s_DecodeBufferLock, NULL);
+    pthread_cond_init(&s_DecodeBufferFreed, NULL);
+    s_FreeDecodeBuffers = MAX_DECODES_IN_FLIGHT;
+    s_NextFillBuffer = 0;
+    s_NextDecodeBuffer = 0;
+    s_ReadyDecodeBuffers = 0;
+    s_DecodePending = false;
+    
     pp::Module::Get()->core()->CallOnMainThread(0,
         g_Instance->m_CallbackFactory.NewCallback(&MoonlightInstance::DispatchGetPicture));
     
@@ -190,8 +247,31 @@ void MoonlightInstance::DispatchGetPicture(uint32_t unused) {
         g_Instance->m_CallbackFactory.NewCallbackWithOutput(&MoonlightInstance::PictureReady));
 }
 
+static void ClearSpsCache(void) {
+    for (int i = 0; i < SPS_CACHE_ENTRIES; i++) {
+        free(s_SpsCache[i].original);
+        free(s_SpsCache[i].fixedUp);
+    }
+    memset(s_SpsCache, 0, sizeof(s_SpsCache));
+    s_SpsCacheNext = 0;
+}
+
 void MoonlightInstance::VidDecCleanup(void) {
-    free(s_DecodeBuffer);
+    // The main thread still uses the decoder and our buffers until
+    // every queued decode has completed
+    pthread_mutex_lock(&s_DecodeBufferLock);
+    while (s_FreeDecodeBuffers != MAX_DECODES_IN_FLIGHT) {
+        pthread_cond_wait(&s_DecodeBufferFreed, &s_DecodeBufferLock);
+    }
+    pthread_mutex_unlock(&s_DecodeBufferLock);
+    
+    for (int i = 0; i < MAX_DECODES_IN_FLIGHT; i++) {
+        free(s_DecodeBuffers[i].data);
+        s_DecodeBuffers[i].data = NULL;
+    }
+    pthread_mutex_destroy(&s_DecodeBufferLock);
+    pthread_cond_destroy(&s_DecodeBufferFreed);
+    ClearSpsCache();
     
     // Delete the decoder
     delete g_Instance->m_VideoDecoder;
@@ -216,8 +296,45 @@ void MoonlightInstance::VidDecCleanup(void) {
     g_Instance->BindGraphics(g_Instance->m_Graphics3D);
 }
 
+// Remembers the fixed up copy of an SPS. Failing to cache it isn't fatal.
+static void CacheSpsNalu(PLENTRY nalu, unsigned char* fixedUp, int fixedUpLength) {
+    SPS_CACHE_ENTRY* entry = &s_SpsCache[s_SpsCacheNext];
+
+    free(entry->original);
+    free(entry->fixedUp);
+
+    entry->original = (unsigned char*)malloc(nalu->length);
+    entry->fixedUp = (unsigned char*)malloc(fixedUpLength);
+    if (entry->original == NULL || entry->fixedUp == NULL) {
+        free(entry->original);
+        free(entry->fixedUp);
+        memset(entry, 0, sizeof(*entry));
+        return;
+    }
+
+    memcpy(entry->original, nalu->data, nalu->length);
+    entry->originalLength = nalu->length;
+    memcpy(entry->fixedUp, fixedUp, fixedUpLength);
+    entry->fixedUpLength = fixedUpLength;
+
+    s_SpsCacheNext = (s_SpsCacheNext + 1) % SPS_CACHE_ENTRIES;
+}
+
 static void WriteSpsNalu(PLENTRY nalu, unsigned char* outBuffer, unsigned int* offset) {
     const char naluHeader[] = {0x00, 0x00, 0x00, 0x01};
+    unsigned int startOffset = *offset;
+
+    for (int i = 0; i < SPS_CACHE_ENTRIES; i++) {
+        SPS_CACHE_ENTRY* entry = &s_SpsCache[i];
+
+        if (entry->original != NULL && entry->originalLength == nalu->length &&
+                memcmp(entry->original, nalu->data, nalu->length) == 0) {
+            memcpy(&outBuffer[*offset], entry->fixedUp, entry->fixedUpLength);
+            *offset += entry->fixedUpLength;
+            return;
+        }
+    }
+
     h264_stream_t* stream = h264_new();
     
     // Read the old NALU
@@ -237,30 +354,140 @@ static void WriteSpsNalu(PLENTRY nalu, unsigned char* outBuffer, unsigned int* o
     *offset += write_nal_unit(stream, &outBuffer[*offset], nalu->length + 32 - sizeof(naluHeader));
     
     h264_free(stream);
+
+    CacheSpsNalu(nalu, &outBuffer[startOffset], *offset - startOffset);
+}
+
+// Waits for a free decode buffer and makes sure it can hold length bytes
+static DECODE_BUFFER* AcquireDecodeBuffer(unsigned int length) {
+    DECODE_BUFFER* buffer;
+    
+    pthread_mutex_lock(&s_DecodeBufferLock);
+    if (s_FreeDecodeBuffers == 0) {
+        // The decoder is falling behind
+        LiTraceBegin("Wait for decode buffer", 0);
+        do {
+            pthread_cond_wait(&s_DecodeBufferFreed, &s_DecodeBufferLock);
+        } while (s_FreeDecodeBuffers == 0);
+        LiTraceEnd("Wait for decode buffer", 0);
+    }
+    pthread_mutex_unlock(&s_DecodeBufferLock);
+    
+    // Nobody else uses this buffer until we queue it
+    buffer = &s_DecodeBuffers[s_NextFillBuffer];
+    if (length > buffer->capacity) {
+        unsigned char* data = (unsigned char *)realloc(buffer->data, length);
+        if (data == NULL) {
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->capacity = length;
+    }
+    
+    return buffer;
+}
+
+// Marks the buffer returned by AcquireDecodeBuffer() as in use by the main thread
+static void QueueDecodeBuffer(DECODE_BUFFER* buffer) {
+    int inFlight;
+    
+    s_NextFillBuffer = (s_NextFillBuffer + 1) % MAX_DECODES_IN_FLIGHT;
+    
+    pthread_mutex_lock(&s_DecodeBufferLock);
+    s_FreeDecodeBuffers--;
+    inFlight = MAX_DECODES_IN_FLIGHT - s_FreeDecodeBuffers;
+    pthread_mutex_unlock(&s_DecodeBufferLock);
+    
+    LiTraceCounter("Decodes in flight", inFlight);
+}
+
+// Starts decoding the oldest queued buffer. The decoder only takes one
+// Decode() call at a time, so the rest wait for DecodeDone().
+void MoonlightInstance::StartNextDecode(void) {
+    if (s_DecodePending || s_ReadyDecodeBuffers == 0) {
+        return;
+    }
+    
+    DECODE_BUFFER* buffer = &s_DecodeBuffers[s_NextDecodeBuffer];
+    const void* data = buffer->retainedBufferList != NULL ?
+        buffer->retainedBufferList->data : buffer->data;
+    
+    s_DecodePending = true;
+    LiTraceAsyncBegin("Decode", buffer->frameNumber);
+    m_VideoDecoder->Decode(buffer->frameNumber, buffer->length, data,
+        m_CallbackFactory.NewCallback(&MoonlightInstance::DecodeDone));
+}
+
+void MoonlightInstance::DispatchDecode(uint32_t unused) {
+    s_ReadyDecodeBuffers++;
+    StartNextDecode();
+}
+
+void MoonlightInstance::DecodeDone(int32_t result) {
+    DECODE_BUFFER* buffer = &s_DecodeBuffers[s_NextDecodeBuffer];
+    
+    LiTraceAsyncEnd("Decode", buffer->frameNumber);
+    
+    if (result != PP_OK) {
+        // Get a fresh IDR frame rather than decoding on top of a missing one
+        m_RequestIdrFrame = true;
+    }
+    
+    // The decoder has consumed the bitstream, so the depacketizer can reuse its buffer
+    if (buffer->retainedBufferList != NULL) {
+        LiReleaseDecodeUnitBuffer(buffer->retainedBufferList);
+        buffer->retainedBufferList = NULL;
+    }
+    
+    s_DecodePending = false;
+    s_ReadyDecodeBuffers--;
+    s_NextDecodeBuffer = (s_NextDecodeBuffer + 1) % MAX_DECODES_IN_FLIGHT;
+    
+    pthread_mutex_lock(&s_DecodeBufferLock);
+    s_FreeDecodeBuffers++;
+    pthread_cond_signal(&s_DecodeBufferFreed);
+    pthread_mutex_unlock(&s_DecodeBufferLock);
+    
+    StartNextDecode();
 }
 
 int MoonlightInstance::VidDecSubmitDecodeUnit(PDECODE_UNIT decodeUnit) {
+    DECODE_BUFFER* buffer;
     PLENTRY entry;
     unsigned int offset;
-    unsigned int totalLength;
 
     // Request an IDR frame if needed
     if (g_Instance->m_RequestIdrFrame) {
         g_Instance->m_RequestIdrFrame = false;
         return DR_NEED_IDR;
     }
-
-    totalLength = decodeUnit->fullLength;
-    if (decodeUnit->frameType == FRAME_TYPE_IDR) {
-        // Add some extra space for the SPS fixup
-        totalLength += 32;
+    
+    g_Instance->m_LatencyTracker.FrameSubmitted(decodeUnit, LiGetMillis());
+    
+    if (decodeUnit->frameType != FRAME_TYPE_IDR) {
+        // Every P-frame comes through here whole, and with
+        // CAPABILITY_CONTIGUOUS_DECODE_UNIT it's already in one buffer,
+        // so we keep it until the decode is done instead of copying it
+        buffer = AcquireDecodeBuffer(0);
+        if (buffer == NULL) {
+            return DR_NEED_IDR;
+        }
+        buffer->retainedBufferList = decodeUnit->bufferList;
+        buffer->length = decodeUnit->fullLength;
+        buffer->frameNumber = decodeUnit->frameNumber;
+        
+        QueueDecodeBuffer(buffer);
+        pp::Module::Get()->core()->CallOnMainThread(0,
+            g_Instance->m_CallbackFactory.NewCallback(&MoonlightInstance::DispatchDecode));
+        
+        return DR_RETAIN_BUFFER;
     }
     
-    // Resize the decode buffer if needed
-    if (totalLength > s_DecodeBufferLength) {
-        free(s_DecodeBuffer);
-        s_DecodeBufferLength = totalLength;
-        s_DecodeBuffer = (unsigned char *)malloc(s_DecodeBufferLength);
+    // IDR frames are copied into one of our buffers so the SPS can be fixed
+    // up. Add some extra space for the SPS fixup.
+    buffer = AcquireDecodeBuffer(decodeUnit->fullLength + 32);
+    if (buffer == NULL) {
+        return DR_NEED_IDR;
     }
     
     entry = decodeUnit->bufferList;
@@ -268,20 +495,22 @@ int MoonlightInstance::VidDecSubmitDecodeUnit(PDECODE_UNIT decodeUnit) {
     while (entry != NULL) {
         if (entry->bufferType == BUFFER_TYPE_SPS) {
             // Write the SPS with required fixups and update offset
-            WriteSpsNalu(entry, s_DecodeBuffer, &offset);
+            WriteSpsNalu(entry, buffer->data, &offset);
         }
         else {
-            memcpy(&s_DecodeBuffer[offset], entry->data, entry->length);
+            memcpy(&buffer->data[offset], entry->data, entry->length);
             offset += entry->length;
         }
         
         entry = entry->next;
     }
+    buffer->length = offset;
+    buffer->frameNumber = decodeUnit->frameNumber;
     
-    // Start the decoding
-    uint32_t packedMillis = ProfilerGetPackedMillis();
-    g_Instance->m_VideoDecoder->Decode(packedMillis, offset, s_DecodeBuffer, pp::BlockUntilComplete());
-    ProfilerPrintPackedDeltaFromNow("Decode (blocking)", packedMillis);
+    // Start the decoding on the main thread
+    QueueDecodeBuffer(buffer);
+    pp::Module::Get()->core()->CallOnMainThread(0,
+        g_Instance->m_CallbackFactory.NewCallback(&MoonlightInstance::DispatchDecode));
     
     return DR_OK;
 }
@@ -324,11 +553,21 @@ Shader MoonlightInstance::CreateProgram(const char* vertexShader, const char* fr
 }
 
 void MoonlightInstance::PaintPicture(void) {
-    m_IsPainting = true;
+    int waitMs;
+    
+    // Take the next picture into our ownership if the pacer says it's time
+    if (!m_FramePacer.GetNextPicture(LiGetMillis(), &m_CurrentPicture, &waitMs)) {
+        // Come back when the oldest picture is due. This is a plain
+        // millisecond timer, not a vsync callback.
+        if (waitMs > 0 && !m_PacingTimerPending) {
+            m_PacingTimerPending = true;
+            pp::Module::Get()->core()->CallOnMainThread(waitMs,
+                m_CallbackFactory.NewCallback(&MoonlightInstance::PacingTimerFired));
+        }
+        return;
+    }
     
-    // Take the next picture into our ownership
-    m_CurrentPicture = m_NextPicture;
-    m_HasNextPicture = false;
+    m_IsPainting = true;
     
     // Recycle bogus pictures immediately
     if (m_CurrentPicture.texture_target == 0) {
@@ -380,6 +619,7 @@ void MoonlightInstance::PaintPicture(void) {
     }
     
     // Draw the image
+    LiTraceAsyncBegin("Paint", m_CurrentPicture.decode_id);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     
     // Swap buffers
@@ -387,8 +627,18 @@ void MoonlightInstance::PaintPicture(void) {
         m_CallbackFactory.NewCallback(&MoonlightInstance::PaintFinished));
 }
 
+void MoonlightInstance::PacingTimerFired(int32_t result) {
+    m_PacingTimerPending = false;
+    
+    if (!m_IsPainting) {
+        PaintPicture();
+    }
+}
+
 void MoonlightInstance::PaintFinished(int32_t result) {
     m_IsPainting = false;
+    m_FramePacer.PicturePresented(LiGetMillis());
+    m_LatencyTracker.PicturePresented(m_CurrentPicture.decode_id, LiGetMillis());
 
     if (!s_FirstFrameDisplayed) {
         // Tell the JS code to display the video stream now
@@ -397,18 +647,21 @@ void MoonlightInstance::PaintFinished(int32_t result) {
         s_FirstFrameDisplayed = true;
     }
     
-    ProfilerPrintDeltaFromNow("Paint -> Paint", s_LastPaintFinishedTime);
-    s_LastPaintFinishedTime = ProfilerGetMillis();
+    LiTraceAsyncEnd("Paint", m_CurrentPicture.decode_id);
     
     // Recycle the picture now that it's been painted
-    uint64_t millis = ProfilerGetMillis();
+    LiTraceBegin("RecyclePicture", m_CurrentPicture.decode_id);
     m_VideoDecoder->RecyclePicture(m_CurrentPicture);
-    ProfilerPrintDeltaFromNow("RecyclePicture (PaintFinished)", millis);
+    LiTraceEnd("RecyclePicture", m_CurrentPicture.decode_id);
     
-    // Keep painting if we still have frames
-    if (m_HasNextPicture) {
-        PaintPicture();
+    if (LiGetMillis() - m_LastPacingStatsTime >= PACING_STATS_INTERVAL_MS) {
+        ReportPacingStatistics();
+        ReportLatencyStatistics();
+        m_LastPacingStatsTime = LiGetMillis();
     }
+    
+    // Keep painting if we still have frames
+    PaintPicture();
 }
 
 void MoonlightInstance::PictureReady(int32_t result, PP_VideoPicture picture) {
@@ -416,20 +669,18 @@ void MoonlightInstance::PictureReady(int32_t result, PP_VideoPicture picture) {
         return;
     }
     
-    ProfilerPrintPackedDeltaFromNow("Decode -> PictureReady", picture.decode_id);
+    m_LatencyTracker.PictureReady(picture.decode_id, LiGetMillis());
     
-    // Free a picture if there's one the renderer hasn't consumed yet
-    if (m_HasNextPicture) {
-        ProfilerPrintWarning("Decoder is outpacing renderer!");
-        uint64_t millis = ProfilerGetMillis();
-        m_VideoDecoder->RecyclePicture(m_NextPicture);
-        ProfilerPrintDeltaFromNow("RecyclePicture (PictureReady)", millis);
+    // Queue the picture for rendering, freeing one the pacer had to give up on
+    PP_VideoPicture droppedPicture;
+    if (m_FramePacer.AddPicture(picture, LiGetMillis(), &droppedPicture)) {
+        // The decoder is outpacing the renderer
+        LiTraceInstant("Picture dropped", droppedPicture.decode_id);
+        LiTraceBegin("RecyclePicture", droppedPicture.decode_id);
+        m_VideoDecoder->RecyclePicture(droppedPicture);
+        LiTraceEnd("RecyclePicture", droppedPicture.decode_id);
     }
     
-    // Put the latest picture in the slot for rendering next
-    m_NextPicture = picture;
-    m_HasNextPicture = true;
-    
     // Queue another call to get another picture
     g_Instance->m_VideoDecoder->GetPicture(
         g_Instance->m_CallbackFactory.NewCallbackWithOutput(&MoonlightInstance::PictureReady));
@@ -444,5 +695,7 @@ DECODER_RENDERER_CALLBACKS MoonlightInstance::s_DrCallbacks = {
     .setup = MoonlightInstance::VidDecSetup,
     .cleanup = MoonlightInstance::VidDecCleanup,
     .submitDecodeUnit = MoonlightInstance::VidDecSubmitDecodeUnit,
-    .capabilities = CAPABILITY_SLICES_PER_FRAME(4)
+    // PPB_VideoDecoder::Decode() needs a whole access unit, so slices can't
+    // be decoded as they arrive and CAPABILITY_SLICE_SUBMIT isn't used
+    .capabilities = CAPABILITY_SLICES_PER_FRAME(4) | CAPABILITY_CONTIGUOUS_DECODE_UNIT
 };